@@ -2,40 +2,27 @@
 #define LST_TIMER
 
 #include <time.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <stdio.h>
 
-const int BUFFER_SIZE = 64;
-class util_timer;  // forward declaration.
-
-// User data structure: client socket address, socket file descriptor, read cache and timer.
-struct client_data {
-
-    sockaddr_in address;
-    int sockfd;
-    char buf[BUFFER_SIZE];
-    util_timer* timer;
-};
-
-// Timer class.
+// Timer class. Template parameter T is the type of the user data passed to the callback.
+template<typename T>
 class util_timer {
 public:
-    util_timer() : prev(nullptr), next(nullptr) {}
+    util_timer() : expire(0), cb_func(nullptr), user_data(nullptr), prev(nullptr), next(nullptr) {}
 
 public:
     time_t expire;                  // The timeout of the task, absolute time is used here.
-    void (*cb_func)(client_data*);  // Task callback function.
+    void (*cb_func)(T*);            // Task callback function.
 
     // The customer data processed by the callback function is passed
     // to the callback function by the executor of the timer.
-    client_data* user_data;         
+    T* user_data;
 
     util_timer* prev;  // Points to the previous timer.
     util_timer* next;  // Points to the next timer.
 };
 
 // Timer linked list. It is an ascending, doubly linked list with a head node and a tail node.
+template<typename T>
 class sort_timer_lst {
 public:
     sort_timer_lst() : head(nullptr), tail(nullptr) {}
@@ -43,7 +30,7 @@ public:
     // When the linked list is destroyed, all timers in it are deleted.
     ~sort_timer_lst() {
 
-        util_timer* tmp = head;
+        util_timer<T>* tmp = head;
 
         while (tmp) {
 
@@ -54,7 +41,7 @@ public:
     }
 
     // Add the target timer to the linked list.
-    void add_timer(util_timer* timer) {
+    void add_timer(util_timer<T>* timer) {
 
         if (!timer) return;
 
@@ -84,13 +71,33 @@ public:
     }
 
     // When a scheduled task changes, adjust the position of the corresponding timer in the linked list. 
-    // This function only considers the extended timeout of the adjusted timer, 
-    // that is, the timer needs to be moved to the end of the linked list.
-    void adjust_timer(util_timer* timer) {
+    // An extended timeout moves the timer towards the end of the linked list, a shortened one towards the head.
+    void adjust_timer(util_timer<T>* timer) {
 
         if (!timer) return;
 
-        util_timer* tmp = timer->next;
+        // If the timeout was shortened below that of the previous timer,
+        // remove the timer from the linked list and insert it again from the head.
+        if (timer->prev && (timer->expire < timer->prev->expire)) {
+
+            timer->prev->next = timer->next;
+
+            if (timer->next) {
+
+                timer->next->prev = timer->prev;
+            }
+            else {
+
+                tail = timer->prev;
+            }
+
+            timer->prev = timer->next = nullptr;
+
+            add_timer(timer);
+            return;
+        }
+
+        util_timer<T>* tmp = timer->next;
 
         // If the adjusted target timer is at the end of the linked list, 
         // or the new timeout value of the timer is still less than the timeout value of the next timer, 
@@ -120,7 +127,7 @@ public:
     }
 
     // Delete the target timer 'timer' from the linked list.
-    void del_timer(util_timer* timer) {
+    void del_timer(util_timer<T>* timer) {
 
         if (!timer) return;
 
@@ -169,17 +176,22 @@ public:
         delete timer;
     }
 
-    // Each time the SIGALRM signal is triggered, 
-    // a tick function is executed in its signal processing function 
-    // (if the unified event source is used, the main function) to process the tasks that expire on the linked list.
+    // Get the timer that expires first.
+    util_timer<T>* top() const { return head; }
+
+    // Each time the timer fires, a tick function is executed
+    // (with the unified event source, in the main function) to process the tasks that expire on the linked list.
     void tick() {
 
-        if (!head) return;
+        tick(time(nullptr));  // Use the current system time.
+    }
 
-        printf("timer tick\n");
+    // Process the tasks that have expired at time 'cur', in the same unit as the timers' 'expire'.
+    // An expired timer is taken out of the linked list before its callback runs and deleted afterwards,
+    // so the callback must not delete it; it may add, adjust or delete any other timer.
+    void tick(time_t cur) {
 
-        time_t cur = time(nullptr);  // Get the current system time.
-        util_timer* tmp = head;
+        util_timer<T>* tmp = head;
 
         // Process each timer in sequence starting from the head node 
         // until encountering a timer that has not yet expired. 
@@ -191,17 +203,23 @@ public:
             // to determine whether the timer has expired.
             if (cur < tmp->expire) break;
 
-            // Call the timer's callback function to perform scheduled tasks.
-            tmp->cb_func(tmp->user_data);
-
-            // After executing the scheduled task in the timer, 
-            // delete it from the linked list and reset the head node of the linked list.
+            // Take the timer out of the linked list and reset the head node of the linked list.
             head = tmp->next;
 
             if (head) {
 
                 head->prev = nullptr;
             }
+            else {
+
+                tail = nullptr;
+            }
+
+            // Call the timer's callback function to perform scheduled tasks, then delete the timer.
+            if (tmp->cb_func) {
+
+                tmp->cb_func(tmp->user_data);
+            }
 
             delete tmp;
             tmp = head;
@@ -211,10 +229,10 @@ public:
 private:
     // An overloaded helper function that is called by the public 'add_timer' function and 'adjust_timer' function.
     // This function means adding the target timer 'timer' to the partial linked list after the node 'lst_head'.
-    void add_timer(util_timer* timer, util_timer* lst_head) {
+    void add_timer(util_timer<T>* timer, util_timer<T>* lst_head) {
 
-        util_timer* prev = lst_head;
-        util_timer* tmp = prev->next;
+        util_timer<T>* prev = lst_head;
+        util_timer<T>* tmp = prev->next;
 
         // Traverse the part of the linked list after the 'lst_head' node until a node with a timeout greater than 
         // the timeout of the target timer is found, and insert the target timer before the node.
@@ -249,8 +267,8 @@ private:
     }
 
 private:
-    util_timer* head;
-    util_timer* tail;
+    util_timer<T>* head;
+    util_timer<T>* tail;
 };
 
 #endif
\ No newline at end of file
@@ -12,16 +12,33 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <pthread.h>
-#include "11-2 lst_timer.h"
+#include "11-9 timer_queue.h"
 
 const int FD_LIMIT = 65535;
 const int MAX_EVENT_NUMBER = 1024;
+const int BUFFER_SIZE = 64;
 const int TIMESLOT = 5;
 
 static int pipefd[2];
 
-// Use the ascending linked list in code listing 11-2 to manage timers.
-static sort_timer_lst timer_lst;
+struct client_data;
+
+// Use the indexed heap in code listing 11-8 to manage timers, through the timer queue of code listing 11-9,
+// which wakes the server up with a timerfd when the first timer expires. Every message from a client moves its
+// timer, which the heap does in place in O(log n), where the ascending list of code listing 11-2 walks the list.
+// Any other backend of 11-9 can be used here.
+typedef timer_queue<indexed_heap_backend<client_data>> client_timers;
+
+// User data structure: client socket address, socket file descriptor, read cache and timer.
+struct client_data {
+
+    sockaddr_in address;
+    int sockfd;
+    char buf[BUFFER_SIZE];
+    client_timers::timer* timer;
+};
+
+static client_timers timer_lst;
 static int epollfd = 0;
 
 int setnonblocking(int fd) {
@@ -70,23 +87,23 @@ void addsig(int sig) {
 
 void timer_handler() {
 
-    // Timing task processing is actually calling the tick function.
-    timer_lst.tick();
-
-    // Because an alarm call will only cause the SIGALRM signal once,
-    // we need to retime it to continuously trigger the SIGALRM signal.
-    alarm(TIMESLOT);
+    // Timing task processing is actually calling the tick function,
+    // which also arms the timerfd for the next timer to expire.
+    timer_lst.handle_expiry();
 }
 
 // Timer callback function,
 // which deletes the registered events on the inactive connection socket and closes it.
 void cb_func(client_data* user_data) {
 
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
 
     close(user_data->sockfd);
 
+    // The timer is deleted after its callback, or by the caller.
+    user_data->timer = nullptr;
+
     printf("close fd %d\n", user_data->sockfd);
 }
 
@@ -121,11 +138,16 @@ int main(int argc, char* argv[])
 
     epoll_event events[MAX_EVENT_NUMBER];
 
-    int epollfd = epoll_create(5);
+    epollfd = epoll_create(5);
     assert(epollfd != -1);
 
     addfd(epollfd, listenfd);
 
+    int timerfd = timer_lst.fd();
+    assert(timerfd != -1);
+
+    addfd(epollfd, timerfd);
+
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
 
@@ -133,15 +155,12 @@ int main(int argc, char* argv[])
     addfd(epollfd, pipefd[0]);
 
     // Set signal processing functions.
-    addsig(SIGALRM);
     addsig(SIGTERM);
 
     bool timeout = false;
     bool stop_server = false;
 
     client_data* users = new client_data[FD_LIMIT];
-    
-    alarm(TIMESLOT);  // timing.
 
     while (!stop_server) {
 
@@ -170,21 +189,18 @@ int main(int argc, char* argv[])
                 users[connfd].address = client_address;
                 users[connfd].sockfd = connfd;
 
-                // Create a timer, set its callback function and timeout, 
-                // then bind the timer to user data,
-                // and finally add the timer to the linked list 'timer_lst'.
-                util_timer* timer = new util_timer;
-
-                timer->user_data = &users[connfd];
-                timer->cb_func = cb_func;
-
-                time_t cur = time(nullptr);
-                timer->expire = cur + 3 * TIMESLOT;
-
-                users[connfd].timer = timer;
-                timer_lst.add_timer(timer);
-
-                delete timer;
+                // Create a timer with its callback function and timeout,
+                // bind it to the user data and add it to 'timer_lst', then bind the user data to it.
+                users[connfd].timer = timer_lst.add_timer(3 * TIMESLOT * 1000000ULL, cb_func, &users[connfd]);
+            }
+            // The first timer has expired.
+            else if ((sockfd == timerfd) && (events[i].events & EPOLLIN)) {
+
+                // Use the 'timeout' variable to mark scheduled tasks that need to be processed,
+                // but the scheduled tasks will not be processed immediately.
+                // This is because the priority of scheduled tasks is not very high,
+                // and we prioritize other more important tasks.
+                timeout = true;
             }
             // Process signals.
             else if((sockfd == pipefd[0]) && (events[i].events & EPOLLIN)) {
@@ -209,15 +225,6 @@ int main(int argc, char* argv[])
 
                         switch (signals[i]) {
 
-                            case SIGALRM: {
-                                
-                                // Use the 'timeout' variable to mark scheduled tasks that need to be processed, 
-                                // but the scheduled tasks will not be processed immediately. 
-                                // This is because the priority of scheduled tasks is not very high,
-                                // and we prioritize other more important tasks.
-                                timeout = true;
-                                break;
-                            }
                             case SIGTERM: {
 
                                 stop_server = true;
@@ -235,7 +242,7 @@ int main(int argc, char* argv[])
                 
                 printf("get %d bytes of client data %s from %d\n", ret, users[sockfd].buf, sockfd);
 
-                util_timer* timer = users[sockfd].timer;
+                client_timers::timer* timer = users[sockfd].timer;
 
                 if (ret < 0) {
 
@@ -269,12 +276,9 @@ int main(int argc, char* argv[])
                     // to delay the time when the connection is closed.
                     if (timer) {
 
-                        time_t cur = time(nullptr);
-                        timer->expire = cur + 3 * TIMESLOT;
-
                         printf("adjust timer once\n");
 
-                        timer_lst.adjust_timer(timer);
+                        users[sockfd].timer = timer_lst.adjust_timer(timer, 3 * TIMESLOT * 1000000ULL);
                     }
                 }
             }
@@ -1,39 +1,26 @@
-#ifndef TIME_WHEEL_TIMER 
-#define TIME_WHEEL_TIMER 
+#ifndef TIME_WHEEL_TIMER
+#define TIME_WHEEL_TIMER
 
 #include <time.h>
-#include <netinet/in.h>
-#include <stdio.h>
-
-const int BUFFER_SIZE = 64; 
-
-class tw_timer; 
-
-// Bind socket and timer.
-struct client_data { 
-    
-    sockaddr_in address; 
-    int sockfd; 
-    char buf[BUFFER_SIZE]; 
-    tw_timer* timer; 
-}; 
-
-// Timer class.
-class tw_timer { 
-public: 
-    tw_timer(int rot, int ts) : prev(nullptr), next(nullptr), rotation(rot), time_slot(ts) {}
+
+// Timer class. Template parameter T is the type of the user data passed to the callback.
+template<typename T>
+class tw_timer {
+public:
+    tw_timer(int rot, int ts) : rotation(rot), time_slot(ts), cb_func(nullptr), user_data(nullptr), prev(nullptr), next(nullptr) {}
 public:
     int rotation;   // Record how many times the timer will take effect after the time rotation.
     int time_slot;  // Record which slot on the time wheel the timer belongs to (corresponding linked list, the same below).
 
-    void(*cb_func)(client_data*);  // timer callback function.
+    void(*cb_func)(T*);  // timer callback function.
 
-    client_data* user_data;  // customer data.
+    T* user_data;  // customer data.
 
     tw_timer* prev;  // Points to the previous timer.
     tw_timer* next;  // Points to the next timer.
 };
 
+template<typename T>
 class time_wheel {
 public:
     time_wheel() : cur_slot(0) {
@@ -49,7 +36,7 @@ public:
         // Iterate through each slot and destroy the timer in it.
         for (int i = 0; i < N; ++i) {
 
-            tw_timer* tmp = slots[i];
+            tw_timer<T>* tmp = slots[i];
 
             while (tmp) {
 
@@ -61,156 +48,199 @@ public:
     }
 
     // Create a timer based on the timeout value 'timeout' and insert it into the appropriate slot.
-    tw_timer* add_timer(int timeout) {
+    tw_timer<T>* add_timer(int timeout) {
 
         if (timeout < 0) return nullptr;
 
-        int ticks = 0;
+        tw_timer<T>* timer = new tw_timer<T>(0, 0);
 
-        // Next, based on the timeout value of the timer to be inserted,
-        // calculate how many ticks it will be triggered after the time wheel rotates,
-        // and store the number of ticks in the variable ticks.
-        // If the timeout value of the timer to be inserted is less than the slot interval SI of the time wheel,
-        // the ticks are folded upward to 1, otherwise the ticks are folded downward to 'timeout / SI'.
-        if (timeout < SI) {
+        link(timer, timeout);
 
-            ticks = 1;
-        }
-        else {
+        return timer;
+    }
 
-            ticks = timeout / SI;
-        }
+    // Move the target timer 'timer' so that it expires 'timeout' seconds from now, without reallocating it.
+    // This only relinks the timer, so refreshing a timer on every I/O event costs O(1).
+    void adjust_timer(tw_timer<T>* timer, int timeout) {
 
-        // Calculate how many turns the time wheel will 
-        // take before the timer to be inserted is triggered.
-        int rotation = ticks / N;
+        if (!timer or (timeout < 0)) return;
 
-        // Calculate which slot the timer to 
-        // be inserted should be inserted into.
-        int ts = (cur_slot + (ticks % N)) % N;
+        unlink(timer);
+        link(timer, timeout);
+    }
 
-        // Create a new timer, which is triggered after 
-        // the time wheel rotates 'rotation' circles and is located on the 'ts'th slot.
-        tw_timer* timer = new tw_timer(rotation, ts);
+    // Delete target timer 'timer'.
+    void del_timer(tw_timer<T>* timer) {
 
-        // If there is no timer in the 'ts' slot, 
-        // insert the new timer into it and set the timer to the head node of the slot.
-        if (!slots[ts]) {
+        if (!timer) return;
 
-            printf("add timer, rotation is %d, ts is %d, cur_slot is %d\n", rotation, ts, cur_slot);
+        unlink(timer);
 
-            slots[ts] = timer;
-        }
-        // Otherwise, insert the timer into the 'ts'th slot.
-        else {
+        delete timer;
+    }
+
+    // After the SI time is up, call this function and the time wheel will scroll forward by one slot interval.
+    // An expired timer is taken out of the wheel before its callback runs and deleted afterwards, so the callback
+    // must not delete it; it must not delete or adjust other timers of the current slot either.
+    void tick() {
 
-            timer->next = slots[ts];
+        tw_timer<T>* tmp = slots[cur_slot];  // Get the head node of the current slot on the time wheel.
 
-            slots[ts]->prev = timer;
-            slots[ts] = timer;
+        while (tmp) {
+
+            // If the timer's 'rotation' value is greater than 0,
+            // it will have no effect in this round.
+            if (tmp->rotation > 0) {
+
+                --tmp->rotation;
+                tmp = tmp->next;
+            }
+            // Otherwise, it means that the timer has expired,
+            // so execute the scheduled task and then delete the timer.
+            else {
+
+                tw_timer<T>* next = tmp->next;
+
+                unlink(tmp);
+
+                if (tmp->cb_func) {
+
+                    tmp->cb_func(tmp->user_data);
+                }
+
+                delete tmp;
+
+                tmp = next;
+            }
         }
 
-        return timer;
+        cur_slot = (cur_slot + 1) % N;  // Updates the current slot of the Time Wheel to reflect the rotation of the Time Wheel.
     }
 
-    // Delete target timer 'timer'.
-    void del_timer(tw_timer* timer) {
+    // Run the callbacks of all timers now, whatever their expiry time, and delete them; for example to cut the
+    // timeouts short when the server shuts down. The timers are taken out of the wheel first, so a callback
+    // may add new timers, which are not run; it must not delete or adjust any other timer.
+    void expire_all() {
 
-        if (!timer) return;
+        for (int i = 0; i < N; ++i) {
 
-        int ts = timer->time_slot;
+            tw_timer<T>* tmp = slots[i];
+            slots[i] = nullptr;
 
-        // slots[ts] is the head node of the slot where the target timer is located.
-        // If the target timer is the head node, the head node of the ‘ts’ slot needs to be reset.
-        if (timer == slots[ts]) {
+            while (tmp) {
 
-            slots[ts] = slots[ts]->next;
+                tw_timer<T>* next = tmp->next;
 
-            if (slots[ts]) {
+                if (tmp->cb_func) {
 
-                slots[ts]->prev = nullptr;
-            }
+                    tmp->cb_func(tmp->user_data);
+                }
+
+                delete tmp;
 
-            delete timer;
+                tmp = next;
+            }
         }
-        else {
+    }
 
-            timer->prev->next = timer->next;
+    // Call 'f' with every timer in the wheel, in no particular order. 'f' must not add, delete or adjust timers.
+    template<typename F>
+    void for_each(F f) const {
+
+        for (int i = 0; i < N; ++i) {
 
-            if (timer->next) {
+            for (tw_timer<T>* tmp = slots[i]; tmp; tmp = tmp->next) {
 
-                timer->next->prev = timer->prev;
+                f(tmp);
             }
+        }
+    }
+
+    // Number of ticks until the next one that processes a slot holding timers: 0 if the next tick does,
+    // -1 if the wheel is empty. Timers with a remaining rotation make it an earliest possible expiry.
+    int next_slot() const {
 
-            delete timer;
+        for (int i = 0; i < N; ++i) {
+
+            if (slots[(cur_slot + i) % N]) return i;
         }
+
+        return -1;
     }
 
-    // After the SI time is up, call this function and the time wheel will scroll forward by one slot interval.
-    void tick() {
+private:
+    // Insert 'timer' into the slot where it expires 'timeout' seconds from now. The next tick processes the current
+    // slot and comes within one interval, so a timer 'ticks' slots ahead expires on tick 'ticks + 1': after more than
+    // 'timeout' and at most 'timeout + SI' seconds. A timeout of N * SI seconds or more also needs 'rotation' turns;
+    // the wheel has more slots than the longest timeout of the server (KEEPALIVE_TIMEOUT), so it never does there.
+    void link(tw_timer<T>* timer, int timeout) {
 
-        tw_timer* tmp = slots[cur_slot];  // Get the head node of the current slot on the time wheel.
+        int ticks = 0;
 
-        printf("current slot is %d\n", cur_slot);
+        // Next, based on the timeout value of the timer to be inserted,
+        // calculate how many ticks it will be triggered after the time wheel rotates,
+        // and store the number of ticks in the variable ticks.
+        // If the timeout value of the timer to be inserted is less than the slot interval SI of the time wheel,
+        // the ticks are folded upward to 1, otherwise the ticks are folded downward to 'timeout / SI'.
+        if (timeout < SI) {
 
-        while (tmp) {
+            ticks = 1;
+        }
+        else {
 
-            printf("tick the timer once\n");
+            ticks = timeout / SI;
+        }
 
-            // If the timer's 'rotation' value is greater than 0,
-            // it will have no effect in this round.
-            if (tmp->rotation > 0) {
+        // Calculate how many turns the time wheel will
+        // take before the timer to be inserted is triggered.
+        timer->rotation = ticks / N;
 
-                --tmp->rotation;
-                tmp = tmp->next;
-            }
-            // Otherwise, it means that the timer has expired, 
-            // so execute the scheduled task and then delete the timer.
-            else {
+        // Calculate which slot the timer to
+        // be inserted should be inserted into.
+        timer->time_slot = (cur_slot + (ticks % N)) % N;
 
-                tmp->cb_func(tmp->user_data);
+        // Insert the timer as the head node of its slot.
+        tw_timer<T>*& head = slots[timer->time_slot];
 
-                if (tmp == slots[cur_slot]) {
+        timer->prev = nullptr;
+        timer->next = head;
 
-                    printf("delete header in cur_slot\n");
+        if (head) {
 
-                    slots[cur_slot] = tmp->next;
-                    delete tmp;
+            head->prev = timer;
+        }
 
-                    if (slots[cur_slot]) {
+        head = timer;
+    }
 
-                        slots[cur_slot]->prev = nullptr;
-                    }
+    // Take 'timer' out of its slot.
+    void unlink(tw_timer<T>* timer) {
 
-                    tmp = slots[cur_slot];
-                }
-                else {
+        // slots[ts] is the head node of the slot where the target timer is located.
+        // If the target timer is the head node, the head node of the ‘ts’ slot needs to be reset.
+        if (timer == slots[timer->time_slot]) {
 
-                    tmp->prev->next = tmp->next;
+            slots[timer->time_slot] = timer->next;
+        }
+        else {
 
-                    if (tmp->next) {
+            timer->prev->next = timer->next;
+        }
 
-                        tmp->next->prev = tmp->prev;
-                    }
+        if (timer->next) {
 
-                    tw_timer* tmp2 = tmp->next;
-                    delete tmp;
-                    
-                    tmp = tmp2;
-                    delete tmp2;
-                }
-            }
+            timer->next->prev = timer->prev;
         }
 
-        cur_slot = ++cur_slot % N;  // Updates the current slot of the Time Wheel to reflect the rotation of the Time Wheel.
+        timer->prev = timer->next = nullptr;
     }
 
 private:
-    static const int N = 60;  // The number of slots on the time wheel.
+    static const int N = 64;  // The number of slots on the time wheel, more than the longest timeout in seconds.
     static const int SI = 1;  // The time wheel rotates once every 1 s, that is, the slot interval is 1 s.
 
-    tw_timer* slots[N];  // The slot of the time wheel, where each element points to a timer linked list, and the linked list is unordered.
-    int cur_slot;        // Current slot of the time wheel.
+    tw_timer<T>* slots[N];  // The slot of the time wheel, where each element points to a timer linked list, and the linked list is unordered.
+    int cur_slot;           // Current slot of the time wheel.
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,37 +2,25 @@
 #define MIN_HEAP
 
 #include <iostream>
-#include <netinet/in.h>
 #include <time.h>
 
-const int BUFFER_SIZE = 64;
-
-class heap_timer;  // forward declaration.
-
-// Bind socket and timer.
-struct client_data {
-
-    sockaddr_in address;
-    int sockfd;
-    char buf[BUFFER_SIZE];
-    heap_timer* timer;
-};
-
-// Timer class.
+// Timer class. Template parameter T is the type of the user data passed to the callback.
+template<typename T>
 class heap_timer {
 public:
-    heap_timer(int delay) {
+    heap_timer(int delay) : cb_func(nullptr), user_data(nullptr) {
 
         expire = time(nullptr) + delay;
     }
 
 public:
     time_t expire;  // The absolute time when the timer takes effect.
-    void (*cb_func)(client_data*);  // Timer callback function.
-    client_data* user_data;  // User data.
+    void (*cb_func)(T*);  // Timer callback function.
+    T* user_data;  // User data.
 };
 
 // Time heap class.
+template<typename T>
 class time_heap {
 public:
     // Constructor 1, initializes an empty heap of size 'cap'.
@@ -40,7 +28,7 @@ public:
 
         try {
 
-            array = new heap_timer*[capacity];  // Create a heap array.
+            array = new heap_timer<T>*[capacity];  // Create a heap array.
 
             if (!array) throw std::exception();
 
@@ -56,13 +44,13 @@ public:
     }
 
     // Constructor 2, initialize the heap with an existing array.
-    time_heap(heap_timer** init_array, int size, int capacity) : cur_size(size), capacity(capacity) {
+    time_heap(heap_timer<T>** init_array, int size, int capacity) : capacity(capacity), cur_size(size) {
 
         try {
 
             if (capacity < size) throw std::exception();
 
-            array = new heap_timer*[capacity];  // Create a heap array.
+            array = new heap_timer<T>*[capacity];  // Create a heap array.
             
             if (!array) throw std::exception();
 
@@ -105,7 +93,7 @@ public:
 
 public:
     // Add target timer 'timer'.
-    void add_timer(heap_timer* timer) {
+    void add_timer(heap_timer<T>* timer) {
 
         try {
 
@@ -142,7 +130,7 @@ public:
     }
 
     // Delete target timer 'timer'.
-    void del_timer(heap_timer* timer) {
+    void del_timer(heap_timer<T>* timer) {
 
         if (!timer) return;
 
@@ -154,7 +142,7 @@ public:
     }
     
     // Get the timer at the top of the heap.
-    heap_timer* top() const {
+    heap_timer<T>* top() const {
 
         if (empty()) return nullptr;
 
@@ -180,26 +168,33 @@ public:
     // heartbeat function.
     void tick() {
 
-        heap_timer* tmp = array[0];
-        time_t cur = time(nullptr);
+        tick(time(nullptr));
+    }
+
+    // Run the timers that have expired at time 'cur', in the same unit as the timers' 'expire'.
+    // An expired timer is taken off the heap before its callback runs and deleted afterwards,
+    // so the callback must not delete it; it may add or delete any other timer.
+    void tick(time_t cur) {
 
         // Loop through expired timers in the heap.
         while (!empty()) {
 
-            if (!tmp) break;
+            heap_timer<T>* tmp = array[0];
 
             // If the timer on the top of the heap has not expired, exit the loop.
             if (tmp->expire > cur) break;
 
-            // Otherwise, execute the task in the timer on the top of the heap.
-            if (array[0]->cb_func) {
+            // Otherwise, take it off the heap, generating a new timer on the top of the heap (array[0]),
+            // and execute its task.
+            array[0] = array[--cur_size];
+            percolate_down(0);
+
+            if (tmp->cb_func) {
 
-                array[0]->cb_func(array[0]->user_data);
+                tmp->cb_func(tmp->user_data);
             }
 
-            // Delete the top element of the heap and generate a new timer on the top of the heap (array[0]).
-            pop_timer();
-            tmp = array[0];
+            delete tmp;
         }
     }
 
@@ -211,7 +206,7 @@ private:
     // as the root in the heap array has the minimum heap property.
     void percolate_down(int hole) {
 
-        heap_timer* temp = array[hole];
+        heap_timer<T>* temp = array[hole];
 
         int child = 0;
 
@@ -242,7 +237,7 @@ private:
 
         try {
 
-            heap_timer** temp = new heap_timer*[2 * capacity];
+            heap_timer<T>** temp = new heap_timer<T>*[2 * capacity];
 
             for (int i = 0; i < 2 * capacity; ++i) {
 
@@ -255,8 +250,7 @@ private:
 
             for (int i = 0; i < cur_size; ++i) {
 
-                temp[i] = array[i];
-                delete array[i];
+                temp[i] = array[i];  // Only the pointers move; the timers stay in the heap.
             }
 
             delete[] array;
@@ -270,7 +264,7 @@ private:
 
 
 private:
-    heap_timer** array;  // heap array.
+    heap_timer<T>** array;  // heap array.
     int capacity;        // capacity of the heap array.
     int cur_size;        // number of elements currently contained in the heap array.
 };
@@ -0,0 +1,454 @@
+#ifndef HIERARCHICAL_WHEEL
+#define HIERARCHICAL_WHEEL
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// Hierarchical timing wheel with a resolution of one millisecond.
+// Level 0 has 256 slots of 1 ms, and each of the four levels above it has 64 slots, each as wide as a whole
+// turn of the level below: 256 ms, 16.4 s, 17.5 min and 18.6 h. A timer is put on the lowest level whose
+// turn still covers its timeout, and when a lower level completes a turn the next slot of the level above it
+// is emptied and its timers are moved down (cascaded) to finer slots. Adding, cancelling and rescheduling a
+// timer only link or unlink it, so they cost O(1) whatever the number of timers; expiring a timer costs at
+// most one move per level. Timeouts longer than 2^32 ms (49.7 days) are shortened to that.
+// The timers are intrusive list nodes handed out by a pool, so no timer costs a call to new.
+
+// Pool of objects of type 'Node' carved out of blocks of CHUNK objects.
+// Freed objects are kept on a free list for reuse; the blocks are released when the pool is destroyed.
+// 'Node' must be default constructible and have a 'next' pointer, which is used to chain the free list.
+template<typename Node>
+class node_pool {
+public:
+    node_pool() : free_list(nullptr), chunks(nullptr) {}
+
+    ~node_pool() {
+
+        while (chunks) {
+
+            chunk* tmp = chunks;
+            chunks = chunks->next;
+            delete tmp;
+        }
+    }
+
+    Node* allocate() {
+
+        if (!free_list) grow();
+
+        Node* node = free_list;
+        free_list = node->next;
+
+        *node = Node();
+
+        return node;
+    }
+
+    void release(Node* node) {
+
+        node->next = free_list;
+        free_list = node;
+    }
+
+private:
+    static const int CHUNK = 1024;
+
+    struct chunk {
+
+        Node nodes[CHUNK];
+        chunk* next;
+    };
+
+    // Add a block of CHUNK objects to the free list.
+    void grow() {
+
+        chunk* c = new chunk;
+
+        c->next = chunks;
+        chunks = c;
+
+        for (int i = 0; i < CHUNK; ++i) {
+
+            c->nodes[i].next = free_list;
+            free_list = c->nodes + i;
+        }
+    }
+
+    Node* free_list;  // Objects ready to be handed out.
+    chunk* chunks;    // Every block allocated, to free them.
+};
+
+// Timer class. Template parameter T is the type of the user data passed to the callback.
+template<typename T>
+class hw_timer {
+public:
+    hw_timer() : expire(0), cb_func(nullptr), user_data(nullptr), slot(-1), prev(nullptr), next(nullptr) {}
+
+public:
+    uint64_t expire;  // The absolute time at which the timer expires, in milliseconds of the wheel's clock.
+
+    void(*cb_func)(T*);  // timer callback function.
+
+    T* user_data;  // customer data.
+
+    int slot;  // Index of the slot the timer is linked into, or -1 if it is in none.
+
+    hw_timer* prev;  // Points to the previous timer.
+    hw_timer* next;  // Points to the next timer.
+};
+
+template<typename T>
+class hierarchical_wheel {
+public:
+    // The wheel's clock is CLOCK_MONOTONIC in milliseconds unless the caller drives it with advance().
+    hierarchical_wheel() : hierarchical_wheel(now_ms()) {}
+
+    explicit hierarchical_wheel(uint64_t start) : current(start), running(false), count(0) {
+
+        for (int i = 0; i <= SLOT_NUMBER; ++i) {
+
+            slots[i] = nullptr;
+        }
+
+        for (int i = 0; i <= SLOT_NUMBER / 64; ++i) {
+
+            occupied[i] = 0;
+        }
+    }
+
+    static uint64_t now_ms() {
+
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // Create a timer that expires 'timeout' milliseconds from the wheel's current time.
+    hw_timer<T>* add_timer(uint64_t timeout) {
+
+        hw_timer<T>* timer = pool.allocate();
+
+        timer->expire = current + timeout;
+
+        link(timer);
+        ++count;
+
+        return timer;
+    }
+
+    // Move the target timer 'timer' so that it expires 'timeout' milliseconds from now, without reallocating it.
+    // A callback may re-arm its own timer this way, which makes it periodic.
+    void adjust_timer(hw_timer<T>* timer, uint64_t timeout) {
+
+        if (!timer) return;
+
+        if (timer->slot >= 0) {
+
+            unlink(timer);
+        }
+
+        timer->expire = current + timeout;
+
+        link(timer);
+    }
+
+    // Delete target timer 'timer'.
+    void del_timer(hw_timer<T>* timer) {
+
+        if (!timer) return;
+
+        unlink(timer);
+
+        --count;
+        pool.release(timer);
+    }
+
+    // Expire the timers that are due at the monotonic clock's current time.
+    void tick() {
+
+        advance(now_ms());
+    }
+
+    // Move the wheel's clock forward to 'now' and expire every timer due by then, in order of expiry time.
+    // An expired timer is taken out of the wheel before its callback runs and freed afterwards unless the
+    // callback re-armed it, so the callback must not delete it; it may add, adjust or delete any other timer.
+    // Runs of empty level 0 slots are skipped with the occupancy bitmap instead of being stepped through.
+    void advance(uint64_t now) {
+
+        // With no timers there is nothing to cascade or run on the way.
+        if ((count == 0) && (current <= now)) {
+
+            current = now + 1;
+            return;
+        }
+
+        while (current <= now) {
+
+            int index = current & (NEAR_SLOTS - 1);
+
+            // Level 0 starts a new turn: bring down the timers of the next slot of level 1, and so on upwards
+            // as long as the level above also starts a new turn.
+            if (index == 0) {
+
+                for (int level = 1; (level < LEVEL_NUMBER) && (cascade(level) == 0); ++level) {}
+            }
+
+            int next = next_occupied(index);
+
+            if (next != index) {
+
+                uint64_t target = current - index + next;
+
+                current = (target <= now) ? target : now + 1;
+                continue;
+            }
+
+            // Move the due timers to the running list first, so that a timer a callback adds to this slot
+            // waits for the next turn. A timer added for the current millisecond is linked for the next one.
+            hw_timer<T>* tmp = slots[index];
+
+            slots[index] = nullptr;
+            occupied[index / 64] &= ~((uint64_t) 1 << (index % 64));
+
+            slots[RUNNING] = tmp;
+            running = true;
+
+            for (; tmp; tmp = tmp->next) {
+
+                tmp->slot = RUNNING;
+            }
+
+            while (slots[RUNNING]) {
+
+                hw_timer<T>* timer = slots[RUNNING];
+
+                unlink(timer);
+
+                if (timer->cb_func) {
+
+                    timer->cb_func(timer->user_data);
+                }
+
+                if (timer->slot < 0) {
+
+                    --count;
+                    pool.release(timer);
+                }
+            }
+
+            running = false;
+            ++current;
+        }
+    }
+
+    // Store into '*when' the earliest time at which a timer may expire, so that the caller can sleep until then.
+    // Returns false if the wheel is empty. The time is exact for the timers of level 0; for a higher level it is
+    // the start of its first occupied slot, when those timers are cascaded, so waking up then may expire nothing.
+    bool next_expiry(uint64_t* when) const {
+
+        if (count == 0) return false;
+
+        uint64_t earliest = UINT64_MAX;
+
+        int index = current & (NEAR_SLOTS - 1);
+        int next = next_occupied(index);
+
+        // A slot before 'index' holds timers of the next turn of level 0.
+        if (next == NEAR_SLOTS) {
+
+            next = next_occupied(0);
+            next = (next < index) ? next + NEAR_SLOTS : NEAR_SLOTS * 2;
+        }
+
+        if (next < NEAR_SLOTS * 2) {
+
+            earliest = current - index + next;
+        }
+
+        for (int level = 1; level < LEVEL_NUMBER; ++level) {
+
+            int shift = level_shift(level);
+            uint64_t bits = occupied[level_base(level) / 64];
+
+            if (!bits) continue;
+
+            // The slot the current time is in was cascaded when the time entered it, unless the time is exactly
+            // at its start and advance() has not run it yet. Otherwise a timer in it is a whole turn away.
+            int position = (current >> shift) & (FAR_SLOTS - 1);
+            int first = ((current & (((uint64_t) 1 << shift) - 1)) == 0) ? 0 : 1;
+
+            int start = (position + first) & (FAR_SLOTS - 1);
+            uint64_t rotated = start ? (bits >> start) | (bits << (FAR_SLOTS - start)) : bits;
+
+            uint64_t distance = first + __builtin_ctzll(rotated);
+            uint64_t begin = ((current >> shift) + distance) << shift;
+
+            if (begin < earliest) earliest = begin;
+        }
+
+        *when = (earliest > current) ? earliest : current;
+
+        return true;
+    }
+
+    // The wheel's current time: every timer that expires before it has been run. Inside a callback, the time the timer was due.
+    uint64_t current_time() const { return current; }
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+private:
+    static const int NEAR_BITS = 8;
+    static const int FAR_BITS = 6;
+    static const int NEAR_SLOTS = 1 << NEAR_BITS;
+    static const int FAR_SLOTS = 1 << FAR_BITS;
+    static const int LEVEL_NUMBER = 5;
+    static const int SLOT_NUMBER = NEAR_SLOTS + (LEVEL_NUMBER - 1) * FAR_SLOTS;
+    static const int RUNNING = SLOT_NUMBER;  // The list of the timers whose callbacks advance() is running.
+
+    // Index of the first slot of 'level' in 'slots'.
+    static int level_base(int level) {
+
+        return (level == 0) ? 0 : NEAR_SLOTS + (level - 1) * FAR_SLOTS;
+    }
+
+    // Number of bits of the time below those that select a slot of 'level'.
+    static int level_shift(int level) {
+
+        return (level == 0) ? 0 : NEAR_BITS + (level - 1) * FAR_BITS;
+    }
+
+    // Insert 'timer' into the slot that matches its expiry time.
+    void link(hw_timer<T>* timer) {
+
+        // A timer already due goes into the slot that runs next, which is the following one while the
+        // current one is running.
+        uint64_t earliest = running ? current + 1 : current;
+
+        if (timer->expire < earliest) {
+
+            timer->expire = earliest;
+        }
+
+        uint64_t delta = timer->expire - current;
+
+        // The highest level covers 2^32 ms; a longer timeout is cut down to it.
+        if (delta >= ((uint64_t) 1 << 32)) {
+
+            timer->expire = current + ((uint64_t) 1 << 32) - 1;
+            delta = ((uint64_t) 1 << 32) - 1;
+        }
+
+        int level = 0;
+
+        while ((level < LEVEL_NUMBER - 1) && (delta >= ((uint64_t) 1 << level_shift(level + 1)))) {
+
+            ++level;
+        }
+
+        int size = (level == 0) ? NEAR_SLOTS : FAR_SLOTS;
+        int slot = level_base(level) + ((timer->expire >> level_shift(level)) & (size - 1));
+
+        hw_timer<T>*& head = slots[slot];
+
+        timer->slot = slot;
+        timer->prev = nullptr;
+        timer->next = head;
+
+        if (head) {
+
+            head->prev = timer;
+        }
+
+        head = timer;
+
+        occupied[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    }
+
+    // Take 'timer' out of its slot.
+    void unlink(hw_timer<T>* timer) {
+
+        int slot = timer->slot;
+
+        if (timer == slots[slot]) {
+
+            slots[slot] = timer->next;
+        }
+        else {
+
+            timer->prev->next = timer->next;
+        }
+
+        if (timer->next) {
+
+            timer->next->prev = timer->prev;
+        }
+
+        if (!slots[slot]) {
+
+            occupied[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+        }
+
+        timer->slot = -1;
+        timer->prev = timer->next = nullptr;
+    }
+
+    // Move the timers of the slot of 'level' that the current time has reached down to the lower levels.
+    // Returns the index of that slot, which is 0 when 'level' starts a new turn too.
+    int cascade(int level) {
+
+        int index = (current >> level_shift(level)) & (FAR_SLOTS - 1);
+        int slot = level_base(level) + index;
+
+        hw_timer<T>* tmp = slots[slot];
+
+        slots[slot] = nullptr;
+        occupied[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+
+        while (tmp) {
+
+            hw_timer<T>* next = tmp->next;
+
+            link(tmp);
+
+            tmp = next;
+        }
+
+        return index;
+    }
+
+    // Index of the first occupied slot of level 0 at or after 'index', or NEAR_SLOTS if there is none.
+    int next_occupied(int index) const {
+
+        for (int word = index / 64; word < NEAR_SLOTS / 64; ++word) {
+
+            uint64_t bits = occupied[word];
+
+            if (word == index / 64) {
+
+                bits &= ~(uint64_t) 0 << (index % 64);
+            }
+
+            if (bits) {
+
+                return word * 64 + __builtin_ctzll(bits);
+            }
+        }
+
+        return NEAR_SLOTS;
+    }
+
+private:
+    hw_timer<T>* slots[SLOT_NUMBER + 1];  // The slots of all levels, level 0 first, then the running list. Each one is an unordered doubly linked list.
+    uint64_t occupied[SLOT_NUMBER / 64 + 1];  // One bit per slot, set when the slot holds a timer.
+
+    uint64_t current;  // The next millisecond to run, or the one running.
+    bool running;      // Whether advance() is running the callbacks of the timers due at 'current'.
+    size_t count;      // Number of timers in the wheel.
+
+    node_pool<hw_timer<T>> pool;
+};
+
+#endif
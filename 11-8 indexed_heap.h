@@ -0,0 +1,232 @@
+#ifndef INDEXED_HEAP
+#define INDEXED_HEAP
+
+#include <time.h>
+#include <vector>
+
+#include "11-7 hierarchical_wheel.h"
+
+// Timer heap in which every timer knows its position in the heap array, so that deleting or rescheduling a
+// timer moves it in place in O(log n) instead of leaving a dead entry behind as time_heap (code listing 11-6)
+// does. The heap is 4-ary: a node's four children sit next to each other in the array, which halves the depth
+// of the tree and keeps the children compared at each level of a sift-down in one or two cache lines.
+// The array keeps each timer's expiry time next to its pointer, so that sifting never dereferences a timer.
+// The array is a std::vector, which grows by doubling, and the timers come from the node pool of code
+// listing 11-7, so no timer costs a call to new.
+
+// Timer class. Template parameter T is the type of the user data passed to the callback.
+template<typename T>
+class ih_timer {
+public:
+    ih_timer() : expire(0), cb_func(nullptr), user_data(nullptr), index(-1), next(nullptr) {}
+
+public:
+    time_t expire;  // The absolute time when the timer takes effect.
+
+    void(*cb_func)(T*);  // timer callback function.
+
+    T* user_data;  // customer data.
+
+    int index;  // Position of the timer in the heap array, or -1 if it is not in the heap.
+
+    ih_timer* next;  // Next free timer while the timer is in the pool.
+};
+
+template<typename T>
+class indexed_heap {
+public:
+    // Create a timer that expires 'delay' seconds from now.
+    ih_timer<T>* add_timer(int delay) {
+
+        if (delay < 0) return nullptr;
+
+        return add_timer_at(time(nullptr) + delay);
+    }
+
+    // Create a timer that expires at time 'expire', in the unit that tick() is given.
+    ih_timer<T>* add_timer_at(time_t expire) {
+
+        ih_timer<T>* timer = pool.allocate();
+
+        timer->expire = expire;
+
+        array.push_back(entry { timer->expire, timer });
+        sift_up(array.size() - 1);
+
+        return timer;
+    }
+
+    // Move the target timer 'timer' so that it expires 'delay' seconds from now, earlier or later.
+    void adjust_timer(ih_timer<T>* timer, int delay) {
+
+        if (delay < 0) return;
+
+        adjust_timer_at(timer, time(nullptr) + delay);
+    }
+
+    // Move the target timer 'timer' so that it expires at time 'expire'.
+    void adjust_timer_at(ih_timer<T>* timer, time_t expire) {
+
+        if (!timer) return;
+
+        timer->expire = expire;
+
+        // A callback re-arming its own timer puts it back into the heap.
+        if (timer->index < 0) {
+
+            array.push_back(entry { timer->expire, timer });
+            sift_up(array.size() - 1);
+
+            return;
+        }
+
+        int hole = timer->index;
+
+        array[hole].expire = timer->expire;
+
+        sift_up(hole);
+        sift_down(timer->index);
+    }
+
+    // Delete target timer 'timer'.
+    void del_timer(ih_timer<T>* timer) {
+
+        if (!timer) return;
+
+        if (timer->index >= 0) {
+
+            remove(timer->index);
+        }
+
+        pool.release(timer);
+    }
+
+    // Get the timer at the top of the heap.
+    ih_timer<T>* top() const {
+
+        if (empty()) return nullptr;
+
+        return array[0].timer;
+    }
+
+    // heartbeat function. Runs the timers that have expired, earliest first.
+    // An expired timer is taken out of the heap before its callback runs and freed afterwards unless the
+    // callback re-armed it with adjust_timer, so the callback must not delete it; it may add, adjust or
+    // delete any other timer.
+    void tick() {
+
+        tick(time(nullptr));
+    }
+
+    // Run the timers that have expired at time 'cur'.
+    void tick(time_t cur) {
+
+        while (!empty() && (array[0].expire <= cur)) {
+
+            ih_timer<T>* timer = array[0].timer;
+
+            remove(0);
+
+            if (timer->cb_func) {
+
+                timer->cb_func(timer->user_data);
+            }
+
+            if (timer->index < 0) {
+
+                pool.release(timer);
+            }
+        }
+    }
+
+    size_t size() const { return array.size(); }
+
+    bool empty() const { return array.empty(); }
+
+private:
+    // An element of the heap array.
+    struct entry {
+
+        time_t expire;
+        ih_timer<T>* timer;
+    };
+
+    static const int D = 4;  // Number of children of a node.
+
+    // Take the element at 'hole' out of the heap, filling the hole with the last element.
+    void remove(int hole) {
+
+        array[hole].timer->index = -1;
+
+        entry last = array.back();
+        array.pop_back();
+
+        if (hole == (int) array.size()) return;
+
+        array[hole] = last;
+        last.timer->index = hole;
+
+        sift_up(hole);
+        sift_down(last.timer->index);
+    }
+
+    // Move the element at 'hole' up until its parent expires no later than it.
+    void sift_up(int hole) {
+
+        entry temp = array[hole];
+
+        while (hole > 0) {
+
+            int parent = (hole - 1) / D;
+
+            if (array[parent].expire <= temp.expire) break;
+
+            array[hole] = array[parent];
+            array[hole].timer->index = hole;
+
+            hole = parent;
+        }
+
+        array[hole] = temp;
+        temp.timer->index = hole;
+    }
+
+    // Move the element at 'hole' down until none of its children expires before it.
+    void sift_down(int hole) {
+
+        entry temp = array[hole];
+        int size = array.size();
+
+        while (true) {
+
+            int first = hole * D + 1;
+
+            if (first >= size) break;
+
+            int last = (first + D < size) ? first + D : size;
+            int child = first;
+
+            for (int i = first + 1; i < last; ++i) {
+
+                if (array[i].expire < array[child].expire) child = i;
+            }
+
+            if (array[child].expire >= temp.expire) break;
+
+            array[hole] = array[child];
+            array[hole].timer->index = hole;
+
+            hole = child;
+        }
+
+        array[hole] = temp;
+        temp.timer->index = hole;
+    }
+
+private:
+    std::vector<entry> array;  // heap array.
+
+    node_pool<ih_timer<T>> pool;
+};
+
+#endif
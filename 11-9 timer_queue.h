@@ -0,0 +1,397 @@
+#ifndef TIMER_QUEUE
+#define TIMER_QUEUE
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "11-2 lst_timer.h"
+#include "11-5 time_wheel_timer.h"
+#include "11-6 timeHeap.h"
+#include "11-7 hierarchical_wheel.h"
+#include "11-8 indexed_heap.h"
+
+// Timer queue driven by a timerfd, with the timer container as a pluggable backend.
+// Instead of ticking at a fixed interval with alarm() and SIGALRM, the queue arms one timerfd to the earliest
+// deadline of its backend, and re-arms it after every expiry and whenever a new timer would expire earlier.
+// A queue without timers leaves the timerfd disarmed, so an idle server is never woken up by it, and the
+// deadlines have the resolution of the backend rather than that of a periodic tick.
+// The caller adds fd() to its epoll set and calls handle_expiry() when it becomes readable.
+//
+// Times are microseconds of CLOCK_MONOTONIC. A backend adapts a container of code listings 11-2 to 11-8:
+//   typedef ... timer;                                     the timer type;
+//   typedef T user_type;                                   the type of the user data of the callbacks;
+//   timer* add(uint64_t expire, void (*cb)(T*), T* data);   create a timer expiring at 'expire';
+//   timer* adjust(timer*, uint64_t expire);                 move it, returning the timer to use from now on;
+//   void del(timer*);                                       delete it;
+//   void run(uint64_t now);                                 run the timers due by 'now';
+//   bool next(uint64_t* when) const;                        earliest time a timer may expire, false if none.
+
+// Microseconds of CLOCK_MONOTONIC.
+inline uint64_t timer_clock() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sorted list of code listing 11-2: O(n) add and adjust, exact deadlines.
+template<typename T>
+class list_backend {
+public:
+    typedef util_timer<T> timer;
+    typedef T user_type;
+
+    timer* add(uint64_t expire, void (*cb)(T*), T* data) {
+
+        timer* t = new timer;
+
+        t->expire = expire;
+        t->cb_func = cb;
+        t->user_data = data;
+
+        timers.add_timer(t);
+
+        return t;
+    }
+
+    timer* adjust(timer* t, uint64_t expire) {
+
+        t->expire = expire;
+        timers.adjust_timer(t);
+
+        return t;
+    }
+
+    void del(timer* t) { timers.del_timer(t); }
+
+    void run(uint64_t now) { timers.tick(now); }
+
+    bool next(uint64_t* when) const {
+
+        if (!timers.top()) return false;
+
+        *when = timers.top()->expire;
+        return true;
+    }
+
+private:
+    sort_timer_lst<T> timers;
+};
+
+// Time wheel of code listing 11-5: O(1) operations, one-second slots. Its tick number k falls at 'origin' plus
+// k seconds, so the deadlines are rounded up to whole seconds from when the backend was created.
+template<typename T>
+class wheel_backend {
+public:
+    wheel_backend() : origin(timer_clock()), ticks(0) {}
+
+    typedef tw_timer<T> timer;
+    typedef T user_type;
+
+    timer* add(uint64_t expire, void (*cb)(T*), T* data) {
+
+        timer* t = timers.add_timer(slot_timeout(expire));
+
+        t->cb_func = cb;
+        t->user_data = data;
+
+        return t;
+    }
+
+    timer* adjust(timer* t, uint64_t expire) {
+
+        timers.adjust_timer(t, slot_timeout(expire));
+
+        return t;
+    }
+
+    void del(timer* t) { timers.del_timer(t); }
+
+    void run(uint64_t now) {
+
+        while (tick_time(ticks + 1) <= now) {
+
+            timers.tick();
+            ++ticks;
+        }
+    }
+
+    bool next(uint64_t* when) const {
+
+        int slot = timers.next_slot();
+
+        if (slot < 0) return false;
+
+        *when = tick_time(ticks + 1 + slot);
+        return true;
+    }
+
+private:
+    static const uint64_t SLOT_US = 1000000;  // The slot interval of the time wheel.
+
+    uint64_t tick_time(uint64_t tick) const { return origin + tick * SLOT_US; }
+
+    // The timeout to give the time wheel for a timer expiring at 'expire'. A timer added with a timeout of
+    // t slots is run by tick number ticks + 1 + t, and the wheel turns a timeout of 0 into 1.
+    int slot_timeout(uint64_t expire) const {
+
+        uint64_t tick = (expire > origin) ? (expire - origin + SLOT_US - 1) / SLOT_US : 0;
+
+        return (tick > ticks + 1) ? (int) (tick - ticks - 1) : 0;
+    }
+
+    time_wheel<T> timers;
+    uint64_t origin;  // When the backend was created.
+    uint64_t ticks;   // Number of ticks the wheel has done.
+};
+
+// Time heap of code listing 11-6: O(log n) add, but a deleted timer stays in the heap until it reaches the top,
+// and adjusting a timer replaces it with a new one. Exact deadlines; the earliest may belong to a deleted timer.
+template<typename T>
+class heap_backend {
+public:
+    heap_backend() : timers(64) {}
+
+    typedef heap_timer<T> timer;
+    typedef T user_type;
+
+    timer* add(uint64_t expire, void (*cb)(T*), T* data) {
+
+        timer* t = new timer(0);
+
+        t->expire = expire;
+        t->cb_func = cb;
+        t->user_data = data;
+
+        timers.add_timer(t);
+
+        return t;
+    }
+
+    timer* adjust(timer* t, uint64_t expire) {
+
+        timer* replacement = add(expire, t->cb_func, t->user_data);
+
+        timers.del_timer(t);
+
+        return replacement;
+    }
+
+    void del(timer* t) { timers.del_timer(t); }
+
+    void run(uint64_t now) { timers.tick(now); }
+
+    bool next(uint64_t* when) const {
+
+        if (timers.empty()) return false;
+
+        *when = timers.top()->expire;
+        return true;
+    }
+
+private:
+    time_heap<T> timers;
+};
+
+// Hierarchical wheel of code listing 11-7: O(1) operations, one-millisecond slots.
+template<typename T>
+class hierarchical_backend {
+public:
+    hierarchical_backend() : timers(timer_clock() / 1000) {}
+
+    typedef hw_timer<T> timer;
+    typedef T user_type;
+
+    timer* add(uint64_t expire, void (*cb)(T*), T* data) {
+
+        timer* t = timers.add_timer(0);
+
+        t->cb_func = cb;
+        t->user_data = data;
+
+        return adjust(t, expire);
+    }
+
+    timer* adjust(timer* t, uint64_t expire) {
+
+        uint64_t ms = (expire + 999) / 1000;
+        uint64_t now = timers.current_time();
+
+        timers.adjust_timer(t, (ms > now) ? ms - now : 0);
+
+        return t;
+    }
+
+    void del(timer* t) { timers.del_timer(t); }
+
+    void run(uint64_t now) { timers.advance(now / 1000); }
+
+    bool next(uint64_t* when) const {
+
+        if (!timers.next_expiry(when)) return false;
+
+        *when *= 1000;
+        return true;
+    }
+
+private:
+    hierarchical_wheel<T> timers;
+};
+
+// Indexed 4-ary heap of code listing 11-8: O(log n) operations, exact deadlines.
+template<typename T>
+class indexed_heap_backend {
+public:
+    typedef ih_timer<T> timer;
+    typedef T user_type;
+
+    timer* add(uint64_t expire, void (*cb)(T*), T* data) {
+
+        timer* t = timers.add_timer_at(expire);
+
+        t->cb_func = cb;
+        t->user_data = data;
+
+        return t;
+    }
+
+    timer* adjust(timer* t, uint64_t expire) {
+
+        timers.adjust_timer_at(t, expire);
+
+        return t;
+    }
+
+    void del(timer* t) { timers.del_timer(t); }
+
+    void run(uint64_t now) { timers.tick(now); }
+
+    bool next(uint64_t* when) const {
+
+        if (timers.empty()) return false;
+
+        *when = timers.top()->expire;
+        return true;
+    }
+
+private:
+    indexed_heap<T> timers;
+};
+
+template<typename Backend>
+class timer_queue {
+public:
+    typedef typename Backend::timer timer;
+    typedef typename Backend::user_type user_type;
+
+    timer_queue() : armed(0), wakeups(0), arms(0) {
+
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+
+    ~timer_queue() {
+
+        close(timerfd);
+    }
+
+    // The timerfd to watch for EPOLLIN, or -1 if it could not be created.
+    int fd() const { return timerfd; }
+
+    // Create a timer that calls 'cb' with 'data' 'timeout' microseconds from now.
+    timer* add_timer(uint64_t timeout, void (*cb)(user_type*), user_type* data) {
+
+        uint64_t expire = timer_clock() + timeout;
+
+        timer* t = backend.add(expire, cb, data);
+
+        if (!armed or (expire < armed)) rearm();
+
+        return t;
+    }
+
+    // Move the target timer 'timer' so that it expires 'timeout' microseconds from now, earlier or later.
+    // Returns the timer to use from now on, which is a new one with some backends.
+    timer* adjust_timer(timer* t, uint64_t timeout) {
+
+        if (!t) return nullptr;
+
+        uint64_t expire = timer_clock() + timeout;
+
+        t = backend.adjust(t, expire);
+
+        if (!armed or (expire < armed)) rearm();
+
+        return t;
+    }
+
+    // Delete target timer 'timer'. The timerfd is left as it is: if it was armed for this timer,
+    // the wakeup finds nothing to run and re-arms it, which is cheaper than re-arming on every delete.
+    void del_timer(timer* t) {
+
+        if (!t) return;
+
+        backend.del(t);
+    }
+
+    // Run the timers that are due, and arm the timerfd for the next one. Call when fd() is readable.
+    void handle_expiry() {
+
+        uint64_t expirations;
+
+        // Clear the readable state; the number of expirations is of no use, the backend is run up to now.
+        if (read(timerfd, &expirations, sizeof(expirations)) < 0) {}
+
+        ++wakeups;
+        armed = 0;
+
+        backend.run(timer_clock());
+
+        rearm();
+    }
+
+    // Number of times the timerfd woke the caller up, and number of times it was armed.
+    long wakeup_count() const { return wakeups; }
+    long arm_count() const { return arms; }
+
+private:
+    // Arm the timerfd for the earliest deadline of the backend, or disarm it if there is none.
+    void rearm() {
+
+        uint64_t when = 0;
+
+        if (!backend.next(&when)) {
+
+            if (!armed) return;
+
+            when = 0;
+        }
+        else if (when == armed) {
+
+            return;
+        }
+
+        // An absolute deadline that has already passed fires at once; a zero one disarms the timerfd.
+        struct itimerspec value = {};
+
+        value.it_value.tv_sec = when / 1000000;
+        value.it_value.tv_nsec = (when % 1000000) * 1000;
+
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &value, nullptr);
+
+        armed = when;
+        ++arms;
+    }
+
+    Backend backend;
+
+    int timerfd;
+    uint64_t armed;  // The deadline the timerfd is armed for, 0 if it is disarmed.
+
+    long wakeups;
+    long arms;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef FD_PASSING_H
+#define FD_PASSING_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Passing file descriptors between processes over UNIX domain sockets, as send_fd and recv_fd of code listing 13-5
+// do, but with any number of descriptors per message, so that a batch of them costs one system call, and with some
+// data along with them. The control buffer is sized for the descriptors it carries: the single cmsghdr of 13-5
+// has no room behind it for the descriptor itself.
+//
+// The second half of the file lets two unrelated processes find each other: a process serving under a name
+// listens on a SOCK_SEQPACKET socket bound to that name in the abstract namespace of Linux, which needs no file
+// and disappears with the socket, and a process started later connects to it. A sequenced-packet socket keeps
+// the boundaries of the messages, so several threads may send on one without mixing them up.
+
+// The most descriptors the kernel accepts in one message (SCM_MAX_FD).
+static const int MAX_PASSED_FDS = 253;
+
+// Send 'len' bytes of 'data', at least one, with the 'n' descriptors of 'fds' over the UNIX domain socket 'sock'.
+// The descriptors stay open in the sender. Returns the number of bytes sent, or -1.
+inline ssize_t send_fds(int sock, const void* data, size_t len, const int* fds, int n) {
+
+    if ((len == 0) or (n < 0) or (n > MAX_PASSED_FDS)) return -1;
+
+    struct iovec iov[1];
+
+    iov[0].iov_base = (void*) data;
+    iov[0].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, '\0', sizeof(msg));
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+
+    // Aligned for the cmsghdr at its start.
+    union {
+
+        char buf[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+        cmsghdr align;
+    } control;
+
+    if (n > 0) {
+
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * n);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * n);
+    }
+
+    ssize_t ret = 0;
+
+    do {
+
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    }
+    while ((ret < 0) && (errno == EINTR));
+
+    return ret;
+}
+
+// Receive a message of at most 'len' bytes into 'data', and the descriptors sent with it, at most 'max', into 'fds';
+// '*n' is set to their number. The descriptors are received close-on-exec. Returns the number of bytes received,
+// 0 if the peer has closed the socket, or -1 (with errno EAGAIN on a nonblocking socket with nothing to read).
+inline ssize_t recv_fds(int sock, void* data, size_t len, int* fds, int max, int* n) {
+
+    struct iovec iov[1];
+
+    iov[0].iov_base = data;
+    iov[0].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, '\0', sizeof(msg));
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+
+    union {
+
+        char buf[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+        cmsghdr align;
+    } control;
+
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    *n = 0;
+
+    ssize_t ret = 0;
+
+    do {
+
+        ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    }
+    while ((ret < 0) && (errno == EINTR));
+
+    if (ret <= 0) return ret;
+
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+
+        if ((cm->cmsg_level != SOL_SOCKET) or (cm->cmsg_type != SCM_RIGHTS)) continue;
+
+        int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* received = (int*) CMSG_DATA(cm);
+
+        for (int i = 0; i < count; ++i) {
+
+            // Descriptors the caller has no room for are closed rather than leaked.
+            if (*n < max) {
+
+                fds[(*n)++] = received[i];
+            }
+            else {
+
+                close(received[i]);
+            }
+        }
+    }
+
+    return ret;
+}
+
+// Fill 'address' with the abstract name 'name' and return its length.
+inline socklen_t control_address(const char* name, sockaddr_un* address) {
+
+    memset(address, '\0', sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    // The path starts with '\0' and is not terminated: its length is part of the name.
+    size_t len = strlen(name);
+
+    if (len > sizeof(address->sun_path) - 1) {
+
+        len = sizeof(address->sun_path) - 1;
+    }
+
+    memcpy(address->sun_path + 1, name, len);
+
+    return offsetof(sockaddr_un, sun_path) + 1 + len;
+}
+
+// Listen on the control socket of 'name'. Returns the listening socket, nonblocking and close-on-exec,
+// or -1 if another process serves under that name.
+inline int control_listen(const char* name) {
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (sock < 0) return -1;
+
+    sockaddr_un address;
+    socklen_t len = control_address(name, &address);
+
+    if ((bind(sock, (struct sockaddr*)& address, len) < 0) or (listen(sock, 5) < 0)) {
+
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+// Connect to the process serving under 'name'. Returns the connected socket, blocking and close-on-exec,
+// or -1 if no process serves under that name.
+inline int control_connect(const char* name) {
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (sock < 0) return -1;
+
+    sockaddr_un address;
+    socklen_t len = control_address(name, &address);
+
+    if (connect(sock, (struct sockaddr*)& address, len) < 0) {
+
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+#endif
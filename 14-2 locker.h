@@ -67,7 +67,7 @@ public:
     // release mutex lock.
     bool unlock() {
 
-        return pthread_mutex_lock(&m_mutex) == 0;
+        return pthread_mutex_unlock(&m_mutex) == 0;
     }
 
 private:
@@ -16,17 +16,98 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include <atomic>
+#include <new>
+
+#include "13-6 fd_passing.h"
+#include "15-12 fd_table.h"
 
 // A class that describes a child process. m_pid is the PID of the target child process,
 // and m_pipefd is the pipe used to communicate between the parent process and the child process.
 class process {
 public:
-    process() : m_pid(-1) {}
+    process() : m_pid(-1), m_dispatched(0), m_current_weight(0), m_full(false), m_started(0), m_respawn_at(0), m_crashes(0) {}
 public:
     pid_t m_pid;
     int m_pipefd[2];
+
+    int m_dispatched;      // The number of connections the parent has handed to the child.
+    int m_current_weight;  // The running weight of the child in weighted round robin.
+    bool m_full;           // The pipe to the child was full when the parent last dispatched to it.
+
+    uint64_t m_started;     // When the child was forked, in microseconds of CLOCK_MONOTONIC.
+    uint64_t m_respawn_at;  // When the child is due to be forked again after it died; 0 if it is not.
+    int m_crashes;          // The times in a row the child died soon after it was forked.
+};
+
+// How the parent process hands new connections to the child processes.
+enum DISPATCH_MODE {
+
+    // The parent writes a notification to the pipe of a child, which then accepts a connection on the shared
+    // listening socket itself. The child may find none: another process may have taken it first. And the parent
+    // notifies one child per event of the edge-triggered listening socket, which may stand for several connections:
+    // those beyond the first wait in the queue until later ones arrive.
+    DISPATCH_NOTIFY,
+
+    // The parent accepts all the connections waiting, and passes each child its share of them over its pipe
+    // with SCM_RIGHTS, up to MAX_PASSED_FDS in one message. A child is only woken up for connections it is given.
+    DISPATCH_PASS_FD
+};
+
+// How the parent process chooses the child for a new connection. The load of a child is the number of its open
+// connections, counting those handed to it that it has not taken yet, so that a burst dispatched in one go is spread.
+enum SELECT_POLICY {
+
+    // Each child in turn, whatever its load.
+    SELECT_ROUND_ROBIN,
+
+    // The child with the fewest connections. Ties go to each child in turn.
+    SELECT_LEAST_CONNECTIONS,
+
+    // The less loaded of two children picked at random ("power of two choices"): nearly as even as the least
+    // loaded child, without a scan of all of them.
+    SELECT_TWO_CHOICES,
+
+    // Round robin weighted by the share of time each child is idle, from the EWMA of its busy time, so that
+    // a child kept busy by expensive requests gets fewer connections whatever their number.
+    SELECT_WEIGHTED_ROUND_ROBIN
+};
+
+// The EWMA of the busy time of a child is a share of BUSY_SCALE, sampled every BUSY_WINDOW milliseconds.
+static const int BUSY_SCALE = 1024;
+static const int BUSY_WINDOW = 100;
+
+// Where the child processes run.
+enum CPU_AFFINITY {
+
+    // Wherever the scheduler puts them.
+    AFFINITY_NONE,
+
+    // Each on one CPU of those the pool may use: child i on the i-th, in turn if there are more children than CPUs.
+    AFFINITY_CORE,
+
+    // Each on the CPUs of one NUMA node: child i on the i-th node, in turn, so that the memory it allocates stays local.
+    AFFINITY_NODE
+};
+
+// The load a child process publishes to the parent, in memory shared by the whole pool. Each field is written by
+// its child only. The atomics are lock-free, so they are address-free and work between processes.
+struct child_stats {
+
+    std::atomic<int> connections;  // Connections open.
+    std::atomic<int> received;     // Connections (or notifications) taken from the pipe so far.
+    std::atomic<int> busy;         // EWMA of the share of time the event loop of the child is busy.
+
+    child_stats() : connections(0), received(0), busy(0) {}
 };
 
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared statistics need lock-free atomics");
+
 // Process pool class, defined as a template class for code reuse.
 // Its template parameter is a class that handles logical tasks.
 template<typename T>
@@ -34,16 +115,16 @@ class processpool {
 private:
     // Define the constructor as private,
     // so we can only create processpool instances through the later create static function.
-    processpool(int listenfd, int process_number = 8);
+    processpool(int listenfd, int process_number = 8, DISPATCH_MODE dispatch = DISPATCH_NOTIFY);
 
 public:
     // Single mode to ensure that the program creates at most one processpool instance,
     // which is a necessary condition for the program to correctly handle signals.
-    static processpool<T>* create(int listenfd, int process_number = 8) {
+    static processpool<T>* create(int listenfd, int process_number = 8, DISPATCH_MODE dispatch = DISPATCH_NOTIFY) {
 
         if (!m_instance) {
 
-            m_instance = new processpool<T>(listenfd, process_number);
+            m_instance = new processpool<T>(listenfd, process_number, dispatch);
         }
 
         return m_instance;
@@ -52,19 +133,82 @@ public:
     ~processpool() {
 
         delete[] m_sub_process;
+
+        munmap(m_stats, sizeof(child_stats) * m_process_number);
     }
 
     void run();  // Start process pool.
 
+    // Choose how the parent picks the child for a new connection; round robin by default.
+    void set_policy(SELECT_POLICY policy) {
+
+        m_policy = policy;
+    }
+
+    // Choose where the children run; anywhere by default. Each child pins itself when it starts to run.
+    void set_affinity(CPU_AFFINITY affinity) {
+
+        m_affinity = affinity;
+    }
+
+    // Set the maximum number of child processes of a pool, before it is created. By default it is the larger of
+    // MAX_PROCESS_NUMBER and the number of CPUs online, so that a pool can run one child per CPU.
+    static void set_max_process_number(int max_process_number) {
+
+        m_max_process_number = max_process_number;
+    }
+
+    // Hot upgrade. A new server calls take_over, with the name its pool serves under, before it creates its listening
+    // socket. If a pool serves under that name, it hands its listening socket over, which is returned, and goes on
+    // serving it until the pool created next has started its children; then it stops. Returns -1 if no pool serves
+    // under 'name'. Either way, the pool created next serves under 'name' for the next upgrade; 'name' must
+    // outlive it.
+    static int take_over(const char* name);
+
 private:
     void setup_sig_pipe();
     void run_parent();
     void run_child();
+    void pin_child();
+    pid_t spawn(int child);
+    void child_exited(int child, int stat);
+    bool respawn_children();
+    int respawn_timeout() const;
+    bool children_left() const;
+    int next_child();
+    int round_robin();
+    int least_connections();
+    int two_choices();
+    int weighted_round_robin();
+    int load(int child) const;
+    bool available(int child) const;
+    void pass_connections();
+    void send_batch(int child);
+    void redispatch(int child);
+    int receive_connections(int pipefd, fd_table<T>* users);
+    void add_connection(int connfd, const sockaddr_in& client_address, fd_table<T>* users);
+    void stop_children();
+    void drain_children();
+    void listen_control();
+    void accept_successor();
+    void read_successor();
 
 private:
-    // The maximum number of child processes allowed in the process pool.
+    // The default maximum number of child processes allowed in the process pool, if there are fewer CPUs.
     static const int MAX_PROCESS_NUMBER = 16;
 
+    // A child that dies is forked again at once. If it dies again within RESPAWN_STABLE milliseconds of its start,
+    // it is forked again after RESPAWN_DELAY milliseconds, a delay that doubles with each such death up to
+    // RESPAWN_DELAY_MAX. After RESPAWN_LIMIT such deaths in a row it is crashing in a loop, and is left dead.
+    static const int RESPAWN_STABLE = 10000;
+    static const int RESPAWN_DELAY = 10;
+    static const int RESPAWN_DELAY_MAX = 1000;
+    static const int RESPAWN_LIMIT = 10;
+
+    // After a hot upgrade, the children get DRAIN_TIMEOUT seconds to finish the connections they have; the parent
+    // stops those still running a second later with SIGTERM.
+    static const int DRAIN_TIMEOUT = 10;
+
     // The maximum number of customers that each child process can handle.
     static const int USER_PRE_PROCESS = 65536;
 
@@ -86,9 +230,46 @@ private:
     // The child process uses m_stop to decide whether to stop running.
     int m_stop;
 
+    // The parent process has stopped its children on purpose: they are not replaced.
+    bool m_stopping;
+
+    // In a child, whether it is draining, and until when; in the parent, when draining children get SIGTERM, or 0.
+    bool m_draining;
+    uint64_t m_drain_deadline;
+
     // Save description information of all child processes.
     process* m_sub_process;
 
+    // How new connections reach the children; with DISPATCH_PASS_FD, the connections the parent has accepted
+    // for each child and not passed yet.
+    DISPATCH_MODE m_dispatch;
+    std::vector<std::vector<int> > m_batches;
+
+    // The child the parent tries first for the next connection.
+    int m_sub_process_counter;
+
+    // How the parent chooses children, and the state of its random numbers.
+    SELECT_POLICY m_policy;
+    uint32_t m_random;
+
+    // The load of each child, shared with the children.
+    child_stats* m_stats;
+
+    // Where the children run.
+    CPU_AFFINITY m_affinity;
+
+    // The maximum number of child processes set at run time, 0 for the default.
+    static int m_max_process_number;
+
+    // The upgrade channels of the parent process: the socket a successor connects to, -1 once one has,
+    // and the channel to it.
+    int m_control_listenfd;
+    int m_successor;
+
+    // The name the pool serves under, and the channel to the pool it replaces.
+    static const char* m_name;
+    static int m_predecessor;
+
     // Process pool static instance.
     static processpool<T>* m_instance;
 };
@@ -96,9 +277,74 @@ private:
 template<typename T>
 processpool<T>* processpool<T>::m_instance = nullptr;
 
+template<typename T>
+const char* processpool<T>::m_name = nullptr;
+
+template<typename T>
+int processpool<T>::m_predecessor = -1;
+
+template<typename T>
+int processpool<T>::m_max_process_number = 0;
+
+// The messages of the upgrade channel: the listening socket, handed to the successor, and its answer once it serves it.
+static const char UPGRADE_LISTENER = 'L';
+static const char UPGRADE_READY = 'R';
+
+// The message of the parent on the pipe of a child, in place of a new connection (or of the number of those passed),
+// that has the child finish the connections it has and exit.
+static const int CHILD_DRAIN = -1;
+
 // Pipeline for processing signals to implement unified event sourcing. Hereafter called the signal pipeline.
 static int sig_pipefd[2];
 
+// In a child process, its own statistics; nullptr in the parent.
+static child_stats* own_stats = nullptr;
+
+static uint64_t monotonic_us() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Read the CPUs of NUMA node 'node' from sysfs, a list such as "0-3,8-11". Returns false if there is no such node.
+static bool node_cpus(int node, cpu_set_t* cpus) {
+
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+    FILE* file = fopen(path, "r");
+
+    if (!file) return false;
+
+    CPU_ZERO(cpus);
+
+    int first = 0;
+
+    while (fscanf(file, "%d", &first) == 1) {
+
+        int last = first;
+        int c = fgetc(file);
+
+        if ((c == '-') && (fscanf(file, "%d", &last) == 1)) {
+
+            c = fgetc(file);
+        }
+
+        for (int cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); ++cpu) {
+
+            CPU_SET(cpu, cpus);
+        }
+
+        if (c != ',') break;
+    }
+
+    fclose(file);
+
+    return true;
+}
+
 static int setnonblocking(int fd) {
 
     int old_option = fcntl(fd, F_GETFL);
@@ -122,10 +368,16 @@ static void addfd(int epollfd, int fd) {
 }
 
 // Remove all registered events on fd from the epoll kernel event table identified by epollfd.
+// In a child process, the sockets removed are connections: its count of open connections goes down.
 static void removefd(int epollfd, int fd) {
 
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
     close(fd);
+
+    if (own_stats) {
+
+        --own_stats->connections;
+    }
 }
 
 static void sig_handler(int sig) {
@@ -159,36 +411,123 @@ static void addsig(int sig, void(handler)(int), bool restart = true) {
 // which must be created before creating the process pool, otherwise the child process cannot directly reference it.
 // The parameter process_number specifies the number of child processes in the process pool.
 template<typename T>
-processpool<T>::processpool(int listenfd, int process_number) : m_listenfd(listenfd), m_process_number(process_number), m_idx(-1), m_stop(false) {
+processpool<T>::processpool(int listenfd, int process_number, DISPATCH_MODE dispatch) : m_listenfd(listenfd), m_process_number(process_number),
+    m_idx(-1), m_stop(false), m_stopping(false), m_draining(false), m_drain_deadline(0), m_dispatch(dispatch), m_sub_process_counter(0), m_policy(SELECT_ROUND_ROBIN),
+    m_random(2463534242U), m_affinity(AFFINITY_NONE), m_control_listenfd(-1), m_successor(-1) {
+
+    int max_process_number = m_max_process_number;
+
+    if (max_process_number <= 0) {
+
+        max_process_number = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (max_process_number < MAX_PROCESS_NUMBER) {
+
+            max_process_number = MAX_PROCESS_NUMBER;
+        }
+    }
 
-    assert((process_number > 0) && (process_number <= MAX_PROCESS_NUMBER));
+    assert((process_number > 0) && (process_number <= max_process_number));
 
     m_sub_process = new process[process_number];
     assert(m_sub_process);
 
+    // The statistics are mapped before the children are forked, so that all of them share the mapping.
+    void* stats = mmap(nullptr, sizeof(child_stats) * process_number, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(stats != MAP_FAILED);
+
+    m_stats = (child_stats*) stats;
+
+    for (int i = 0; i < process_number; ++i) {
+
+        new (m_stats + i) child_stats;
+    }
+
     // Create 'process_number' child processes and establish pipes between them and the parent process.
     for (int i = 0; i < process_number; ++i) {
 
-        int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_sub_process[i].m_pipefd);
-        assert(ret == 0);
+        pid_t pid = spawn(i);
+        assert(pid >= 0);
+
+        if (pid == 0) break;
+    }
+}
 
-        m_sub_process[i].m_pid = fork();
-        assert(m_sub_process[i].m_pid >= 0);
+// Fork child 'child', with a new pipe between it and the parent process, and fresh statistics. Returns
+// the PID of the child in the parent process, 0 in the child, and -1 on failure.
+template<typename T>
+pid_t processpool<T>::spawn(int child) {
 
-        if (m_sub_process[i].m_pid > 0) {
+    process& sub_process = m_sub_process[child];
 
-            close(m_sub_process[i].m_pipefd[1]);
+    // Passed connections travel in messages, one batch each.
+    if (socketpair(PF_UNIX, (m_dispatch == DISPATCH_PASS_FD) ? SOCK_SEQPACKET : SOCK_STREAM, 0, sub_process.m_pipefd) < 0) {
 
-            continue;
-        }
-        else {
+        return -1;
+    }
 
-            close(m_sub_process[i].m_pipefd[0]);
-            m_idx = i;
+    // The child this one replaces, if any, has been reaped: nothing else writes to its statistics.
+    m_stats[child].connections = 0;
+    m_stats[child].received = 0;
+    m_stats[child].busy = 0;
 
-            break;
+    sub_process.m_dispatched = 0;
+    sub_process.m_current_weight = 0;
+    sub_process.m_started = monotonic_us();
+
+    sub_process.m_pid = fork();
+
+    if (sub_process.m_pid < 0) {
+
+        close(sub_process.m_pipefd[0]);
+        close(sub_process.m_pipefd[1]);
+
+        return -1;
+    }
+    else if (sub_process.m_pid > 0) {
+
+        close(sub_process.m_pipefd[1]);
+
+        // A child busy with a long request does not empty its pipe: the parent must not block on it.
+        setnonblocking(sub_process.m_pipefd[0]);
+        sub_process.m_full = false;
+
+        return sub_process.m_pid;
+    }
+
+    close(sub_process.m_pipefd[0]);
+    m_idx = child;
+    own_stats = m_stats + child;
+
+    return 0;
+}
+
+template<typename T>
+int processpool<T>::take_over(const char* name) {
+
+    m_name = name;
+    m_predecessor = control_connect(name);
+
+    if (m_predecessor < 0) return -1;
+
+    char type = 0;
+    int listenfd = -1;
+    int n = 0;
+
+    if ((recv_fds(m_predecessor, &type, sizeof(type), &listenfd, 1, &n) != sizeof(type)) or (type != UPGRADE_LISTENER) or (n != 1)) {
+
+        if (n == 1) {
+
+            close(listenfd);
         }
+
+        close(m_predecessor);
+        m_predecessor = -1;
+
+        return -1;
     }
+
+    return listenfd;
 }
 
 // unified event source.
@@ -227,11 +566,70 @@ void processpool<T>::run() {
     run_parent();
 }
 
+// Pin the child to its CPU or NUMA node, among the CPUs it may run on.
+template<typename T>
+void processpool<T>::pin_child() {
+
+    if (m_affinity == AFFINITY_NONE) return;
+
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+
+    if (m_affinity == AFFINITY_NODE) {
+
+        int nodes = 0;
+
+        while (node_cpus(nodes, &cpus)) {
+
+            ++nodes;
+        }
+
+        // Without NUMA nodes in sysfs, the child stays on all of its CPUs.
+        if (nodes == 0) return;
+
+        node_cpus(m_idx % nodes, &cpus);
+        CPU_AND(&cpus, &cpus, &allowed);
+    }
+    else {
+
+        int n = m_idx % CPU_COUNT(&allowed);
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+
+            if (CPU_ISSET(cpu, &allowed) && (n-- == 0)) {
+
+                CPU_SET(cpu, &cpus);
+                break;
+            }
+        }
+    }
+
+    // A node none of whose CPUs the pool may use.
+    if (CPU_COUNT(&cpus) == 0) return;
+
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+
+        printf("child %d: pinning failed, errno is: %d\n", m_idx, errno);
+    }
+}
+
 template<typename T>
 void processpool<T>::run_child() {
 
+    pin_child();
+
     setup_sig_pipe();
 
+    // The upgrade channel belongs to the parent process.
+    if (m_predecessor != -1) {
+
+        close(m_predecessor);
+    }
+
     // Each child process finds the pipe to communicate with the parent process
     // through its sequence number value 'm_idx' in the process pool.
     int pipefd = m_sub_process[m_idx].m_pipefd[1];
@@ -242,15 +640,44 @@ void processpool<T>::run_child() {
 
     epoll_event events[MAX_EVENT_NUMBER];
 
-    T* users = new T[USER_PRE_PROCESS];
-    assert(users);
+    // The logical processing objects are indexed by connection socket. Their table allocates a page of them
+    // only when a socket in its range is first used, so an idle child does not hold USER_PRE_PROCESS objects.
+    fd_table<T>* users = new fd_table<T>(USER_PRE_PROCESS);
 
     int number = 0;
     int ret = -1;
 
+    // The connections the child has received, the times the parent woke it up for new ones,
+    // and the times it found none.
+    int connections = 0;
+    int wakeups = 0;
+    int spurious = 0;
+
+    // The time the event loop has spent handling events since the start of the current sampling window.
+    uint64_t window_start = monotonic_us();
+    uint64_t busy = 0;
+
     while (!m_stop) {
 
-        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        // While the EWMA of the busy time is above 0, the loop wakes up at least once per window to let it decay.
+        int timeout = (own_stats->busy > 0) ? BUSY_WINDOW : -1;
+
+        // A draining child ends once its last connection is closed, or at its deadline with those left.
+        if (m_draining) {
+
+            uint64_t now = monotonic_us();
+
+            if ((own_stats->connections == 0) or (now >= m_drain_deadline)) break;
+
+            int remaining = (m_drain_deadline - now + 999) / 1000;
+
+            if ((timeout == -1) or (remaining < timeout)) {
+
+                timeout = remaining;
+            }
+        }
+
+        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, timeout);
 
         if ((number < 0) && (errno != EINTR)) {
 
@@ -258,40 +685,64 @@ void processpool<T>::run_child() {
             break;
         }
 
+        uint64_t start = monotonic_us();
+
         for (int i = 0; i < number; ++i) {
 
             int sockfd = events[i].data.fd;
 
-            if ((sockfd == pipefd) && (events[i].events & EPOLLIN)) {
+            if ((sockfd == pipefd) && (events[i].events & EPOLLIN) && (m_dispatch == DISPATCH_PASS_FD)) {
 
-                int client;
+                int received = receive_connections(pipefd, users);
 
-                // Read data from the pipe between the parent and child processes and save the result in the variable client.
-                // If the read is successful, it means that a new customer connection has arrived.
-                ret = recv(sockfd, (char*)& client, sizeof(client), 0);
+                ++wakeups;
+                connections += received;
 
-                if (((ret < 0) && (errno != EAGAIN)) or ret == 0) {
+                if (received == 0) {
 
-                    continue;
+                    ++spurious;
                 }
-                else {
+            }
+            else if ((sockfd == pipefd) && (events[i].events & EPOLLIN)) {
+
+                // Read data from the pipe between the parent and child processes and save the result in the variable client.
+                // If the read is successful, it means that a new customer connection has arrived. The pipe is
+                // edge-triggered, so it is read until it is empty: a drain behind a notification is not reported again.
+                while (true) {
+
+                    int client;
+
+                    ret = recv(sockfd, (char*)& client, sizeof(client), 0);
+
+                    if (ret <= 0) break;
+
+                    if (client == CHILD_DRAIN) {
+
+                        m_draining = true;
+                        m_drain_deadline = monotonic_us() + DRAIN_TIMEOUT * 1000000ULL;
+
+                        continue;
+                    }
+
+                    ++own_stats->received;
 
                     struct sockaddr_in client_address;
                     socklen_t client_addresslength = sizeof(client_address);
 
                     int connfd = accept(m_listenfd, (struct sockaddr*)& client_address, &client_addresslength);
 
+                    ++wakeups;
+
                     if (connfd < 0) {
 
                         printf("errno is: %d\n", errno);
+                        ++spurious;
                         continue;
                     }
 
-                    addfd(m_epollfd, connfd);
+                    ++connections;
 
-                    // Template class T must implement the init method to initialize a client connection.
-                    // We directly use connfd to index logical processing objects (T type objects) to improve program efficiency.
-                    users[connfd].init(m_epollfd, connfd, client_address);
+                    add_connection(connfd, client_address, users);
                 }
             }
             // The following handles the signals received by the child process.
@@ -342,16 +793,33 @@ void processpool<T>::run_child() {
             // Call the process method of the logical processing object to process it.
             else if (events[i].events & EPOLLIN) {
 
-                users[sockfd].process();
+                users->get(sockfd)->process();
             }
             else {
 
                 continue;
             }
         }
+
+        uint64_t end = monotonic_us();
+
+        busy += end - start;
+
+        if (end - window_start >= BUSY_WINDOW * 1000ULL) {
+
+            // An EWMA with a weight of 1/4 for the last window, rounded down so that it reaches 0 when idle.
+            int sample = busy * BUSY_SCALE / (end - window_start);
+
+            own_stats->busy = (3 * own_stats->busy + sample) / 4;
+
+            window_start = end;
+            busy = 0;
+        }
     }
 
-    delete[] users;
+    printf("child %d: %d connections, %d wakeups, %d spurious\n", m_idx, connections, wakeups, spurious);
+
+    delete users;
     users = nullptr;
 
     close(pipefd);
@@ -362,131 +830,489 @@ void processpool<T>::run_child() {
 }
 
 template<typename T>
-void processpool<T>::run_parent() {
-
-    setup_sig_pipe();
+void processpool<T>::add_connection(int connfd, const sockaddr_in& client_address, fd_table<T>* users) {
 
-    // The parent process listens to m_listenfd.
-    addfd(m_epollfd, m_listenfd);
+    addfd(m_epollfd, connfd);
 
-    epoll_event events[MAX_EVENT_NUMBER];
+    ++own_stats->connections;
 
-    int sub_process_counter = 0;
-    int new_conn = 1;
-    int number = 0;
-    int ret = -1;
+    // Template class T must implement the init method to initialize a client connection.
+    // We directly use connfd to index logical processing objects (T type objects) to improve program efficiency.
+    T* user = users->acquire(connfd);
 
-    while (!m_stop) {
+    if (!user) {
 
-        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        removefd(m_epollfd, connfd);
+        return;
+    }
 
-        if ((number < 0) && (errno != EINTR)) {
+    user->init(m_epollfd, connfd, client_address);
+}
 
-            printf("epoll failure\n");
-            break;
-        }
+// Take the connections the parent has passed over 'pipefd' since the last call, and return their number.
+template<typename T>
+int processpool<T>::receive_connections(int pipefd, fd_table<T>* users) {
 
-        for (int i = 0; i < number; ++i) {
+    int received = 0;
 
-            int sockfd = events[i].data.fd;
+    while (true) {
 
-            if (sockfd == m_listenfd) {
+        int count = 0;
+        int fds[MAX_PASSED_FDS];
+        int n = 0;
 
-                // If a new connection arrives, it is assigned to a sub-process using the Round Robin method.
-                int i = sub_process_counter;
+        // Nothing more for now, or the parent has ended.
+        if (recv_fds(pipefd, &count, sizeof(count), fds, MAX_PASSED_FDS, &n) <= 0) break;
 
-                do {
+        if (count == CHILD_DRAIN) {
 
-                    if (m_sub_process[i].m_pid != -1) break;
+            m_draining = true;
+            m_drain_deadline = monotonic_us() + DRAIN_TIMEOUT * 1000000ULL;
 
-                    i = (i + 1) % m_process_number;
-                }
-                while (i != sub_process_counter);
+            continue;
+        }
 
-                if (m_sub_process[i].m_pid == -1) {
+        own_stats->received += n;
 
-                    m_stop = true;
-                    break;
-                }
+        for (int i = 0; i < n; ++i) {
 
-                sub_process_counter = (i + 1) % m_process_number;
+            struct sockaddr_in client_address;
+            socklen_t client_addresslength = sizeof(client_address);
 
-                send(m_sub_process[i].m_pipefd[0], (char*)& new_conn, sizeof(new_conn), 0);
+            if (getpeername(fds[i], (struct sockaddr*)& client_address, &client_addresslength) < 0) {
 
-                printf("send request to child %d\n", i);
+                close(fds[i]);
+                continue;
             }
-            // The following handles the signal received by the parent process.
-            else if ((sockfd == sig_pipefd[0]) && (events[i].events & EPOLLIN)) {
 
-                int sig;
-                char signals[1024];
+            add_connection(fds[i], client_address, users);
+            ++received;
+        }
+    }
 
-                ret = recv(sig_pipefd[0], signals, sizeof(signals), 0);
+    return received;
+}
 
-                if (ret <= 0) {
+// The child for the next connection, chosen by the policy of the pool. Returns -1 if all children have exited.
+template<typename T>
+int processpool<T>::next_child() {
 
-                    continue;
-                }
-                else {
+    int i = -1;
 
-                    for (int i = 0; i < ret; ++i) {
+    switch (m_policy) {
 
-                        switch (signals[i]) {
+        case SELECT_LEAST_CONNECTIONS: {
 
-                            case SIGCHLD: {
+            i = least_connections();
+            break;
+        }
+        case SELECT_TWO_CHOICES: {
 
-                                pid_t pid;
-                                int stat;
+            i = two_choices();
+            break;
+        }
+        case SELECT_WEIGHTED_ROUND_ROBIN: {
 
-                                while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
+            i = weighted_round_robin();
+            break;
+        }
+        default: {
 
-                                    for (int i = 0; i < m_process_number; ++i) {
+            i = round_robin();
+            break;
+        }
+    }
 
-                                        // If the i-th sub-process in the process pool exits,
-                                        // the main process closes the corresponding communication pipe and
-                                        // sets the corresponding m_pid to -1 to mark that the sub-process has exited.
-                                        if (m_sub_process[i].m_pid == pid) {
+    if (i != -1) {
 
-                                            printf("child %d join\n", i);
+        ++m_sub_process[i].m_dispatched;
+    }
 
-                                            close(m_sub_process[i].m_pipefd[0]);
+    return i;
+}
 
-                                            m_sub_process[i].m_pid = -1;
-                                        }
-                                    }
-                                }
+// Whether the child can be given a connection: it is running, and its pipe was not full the last time.
+template<typename T>
+bool processpool<T>::available(int child) const {
 
-                                // If all child processes have exited, the parent process also exits.
-                                m_stop = true;
+    return (m_sub_process[child].m_pid != -1) && !m_sub_process[child].m_full;
+}
 
-                                for (int i = 0; i < m_process_number; ++i) {
+// The open connections of a child, and those handed to it that it has not taken yet.
+template<typename T>
+int processpool<T>::load(int child) const {
 
-                                    if (m_sub_process[i].m_pid != -1) {
+    return m_stats[child].connections + (m_sub_process[child].m_dispatched - m_stats[child].received);
+}
 
-                                        m_stop = false;
-                                    }
-                                }
+// Connections are assigned to the child processes using the Round Robin method.
+template<typename T>
+int processpool<T>::round_robin() {
 
-                                break;
-                            }
-                            case SIGTERM:
-                            case SIGINT: {
+    int i = m_sub_process_counter;
+
+    do {
+
+        if (available(i)) break;
+
+        i = (i + 1) % m_process_number;
+    }
+    while (i != m_sub_process_counter);
+
+    if (!available(i)) return -1;
+
+    m_sub_process_counter = (i + 1) % m_process_number;
+
+    return i;
+}
+
+template<typename T>
+int processpool<T>::least_connections() {
+
+    int best = -1;
+
+    // The scan starts after the last child chosen, which then wins the ties.
+    for (int k = 0; k < m_process_number; ++k) {
+
+        int i = (m_sub_process_counter + k) % m_process_number;
+
+        if (!available(i)) continue;
+
+        if ((best == -1) or (load(i) < load(best))) {
+
+            best = i;
+        }
+    }
+
+    if (best != -1) {
+
+        m_sub_process_counter = (best + 1) % m_process_number;
+    }
+
+    return best;
+}
+
+template<typename T>
+int processpool<T>::two_choices() {
+
+    int choice[2];
+
+    for (int k = 0; k < 2; ++k) {
+
+        // xorshift32.
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+
+        choice[k] = m_random % m_process_number;
+    }
+
+    bool first = available(choice[0]);
+    bool second = available(choice[1]);
+
+    // With a child gone, the other one is taken; with both, a scan finds a child left.
+    if (first && second) return (load(choice[1]) < load(choice[0])) ? choice[1] : choice[0];
+    if (first) return choice[0];
+    if (second) return choice[1];
+
+    return least_connections();
+}
+
+// Smooth weighted round robin: every child gains its weight on each choice, the one with the most is chosen and
+// loses the sum of the weights. The choices of each child are spread out rather than consecutive.
+template<typename T>
+int processpool<T>::weighted_round_robin() {
+
+    int best = -1;
+    int total = 0;
+
+    for (int i = 0; i < m_process_number; ++i) {
+
+        if (!available(i)) continue;
+
+        // A child busy all of the time still gets a connection now and then, and its EWMA can go down.
+        int weight = BUSY_SCALE - m_stats[i].busy + 1;
+
+        m_sub_process[i].m_current_weight += weight;
+        total += weight;
+
+        if ((best == -1) or (m_sub_process[i].m_current_weight > m_sub_process[best].m_current_weight)) {
+
+            best = i;
+        }
+    }
+
+    if (best != -1) {
+
+        m_sub_process[best].m_current_weight -= total;
+    }
+
+    return best;
+}
+
+// Accept every connection waiting on the listening socket, which is edge-triggered, and pass them to the children.
+// The connections of a child are passed in as few messages as possible, after the queue has been emptied.
+template<typename T>
+void processpool<T>::pass_connections() {
+
+    // A pipe found full is tried again on each round of accepts.
+    for (int i = 0; i < m_process_number; ++i) {
+
+        m_sub_process[i].m_full = false;
+    }
+
+    while (true) {
+
+        int connfd = accept4(m_listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (connfd < 0) {
+
+            // A connection reset while it waited in the queue, or an interrupted call: try the next one.
+            if ((errno == ECONNABORTED) or (errno == EINTR)) continue;
+
+            // The queue is empty, or another process took the rest of it.
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+
+                printf("errno is: %d\n", errno);
+            }
+
+            break;
+        }
+
+        int i = next_child();
+
+        // No child is running, or all of their pipes are full. The pool stops, unless some are being respawned.
+        if (i == -1) {
+
+            printf("no child can take a connection\n");
+
+            close(connfd);
+            m_stop = !children_left();
+            break;
+        }
+
+        m_batches[i].push_back(connfd);
+
+        if (m_batches[i].size() >= (size_t) MAX_PASSED_FDS) {
+
+            send_batch(i);
+        }
+    }
+
+    // The connections of a full pipe move to the batches of other children, which may have been sent already.
+    bool pending = true;
+
+    while (pending) {
+
+        pending = false;
+
+        for (int i = 0; i < m_process_number; ++i) {
+
+            if (!m_batches[i].empty()) {
+
+                send_batch(i);
+                pending = true;
+            }
+        }
+    }
+}
 
-                                // If the parent process receives a termination signal, it kills all child processes and waits for them all to finish.
-                                // Of course, a better way to notify the end of the child process is to send special data to the communication channel
-                                // between the parent and child processes. Readers may wish to implement this by themselves.
-                                printf("kill all the child now\n");
+// Pass up to MAX_PASSED_FDS of the connections accepted for child 'child' to it, in one message. The parent closes
+// its copies. If the pipe of the child is full, because the child is busy with a long request, the parent does not
+// wait for it: the connections go to the other children.
+template<typename T>
+void processpool<T>::send_batch(int child) {
+
+    std::vector<int>& batch = m_batches[child];
+
+    int count = (batch.size() > (size_t) MAX_PASSED_FDS) ? MAX_PASSED_FDS : batch.size();
+
+    if (send_fds(m_sub_process[child].m_pipefd[0], &count, sizeof(count), batch.data(), count) < 0) {
 
-                                for (int i = 0; i < m_process_number; ++i) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
 
-                                    int pid = m_sub_process[i].m_pid;
+            printf("passing %d connections to child %d failed, errno is: %d\n", count, child, errno);
+        }
+
+        redispatch(child);
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+
+        close(batch[i]);
+    }
+
+    batch.erase(batch.begin(), batch.begin() + count);
+}
 
-                                    if (pid != -1) {
+// The connections accepted for child 'child' can not be passed to it: give them to other children, and leave it out
+// until the next round of accepts. A connection no child can take is closed.
+template<typename T>
+void processpool<T>::redispatch(int child) {
+
+    std::vector<int> batch;
+    batch.swap(m_batches[child]);
+
+    m_sub_process[child].m_full = true;
+    m_sub_process[child].m_dispatched -= batch.size();
+
+    for (size_t k = 0; k < batch.size(); ++k) {
+
+        int i = next_child();
+
+        if (i == -1) {
+
+            close(batch[k]);
+            continue;
+        }
+
+        m_batches[i].push_back(batch[k]);
+    }
+}
+
+template<typename T>
+void processpool<T>::run_parent() {
+
+    setup_sig_pipe();
+
+    // The parent process listens to m_listenfd.
+    addfd(m_epollfd, m_listenfd);
+
+    // The children are running: the pool this one replaces may stop.
+    if (m_predecessor != -1) {
+
+        send(m_predecessor, &UPGRADE_READY, sizeof(UPGRADE_READY), MSG_NOSIGNAL);
+
+        close(m_predecessor);
+        m_predecessor = -1;
+    }
+
+    if (m_name) {
+
+        listen_control();
+    }
+
+    epoll_event events[MAX_EVENT_NUMBER];
+
+    m_batches.resize(m_process_number);
+
+    int new_conn = 1;
+    int number = 0;
+    int ret = -1;
+
+    while (!m_stop) {
 
-                                        kill(pid, SIGTERM);
+        // The parent wakes up when the next child that died is due to be forked again,
+        // and when the children still draining are due to be stopped.
+        int timeout = respawn_timeout();
+
+        if (m_drain_deadline != 0) {
+
+            uint64_t now = monotonic_us();
+            int remaining = (m_drain_deadline > now) ? (m_drain_deadline - now + 999) / 1000 : 0;
+
+            if ((timeout == -1) or (remaining < timeout)) {
+
+                timeout = remaining;
+            }
+        }
+
+        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, timeout);
+
+        if ((number < 0) && (errno != EINTR)) {
+
+            printf("epoll failure\n");
+            break;
+        }
+
+        for (int i = 0; i < number; ++i) {
+
+            int sockfd = events[i].data.fd;
+
+            if ((sockfd == m_listenfd) && (m_dispatch == DISPATCH_PASS_FD)) {
+
+                pass_connections();
+            }
+            else if (sockfd == m_listenfd) {
+
+                // If a new connection arrives, it is assigned to a sub-process. A child whose pipe is full is busy
+                // with a long request; another one is notified instead.
+                for (int k = 0; k < m_process_number; ++k) {
+
+                    m_sub_process[k].m_full = false;
+                }
+
+                int i = -1;
+
+                while ((i = next_child()) != -1) {
+
+                    if (send(m_sub_process[i].m_pipefd[0], (char*)& new_conn, sizeof(new_conn), MSG_NOSIGNAL) == sizeof(new_conn)) break;
+
+                    m_sub_process[i].m_full = true;
+                    --m_sub_process[i].m_dispatched;
+                }
+
+                if (i == -1) {
+
+                    m_stop = !children_left();
+                    break;
+                }
+
+                printf("send request to child %d\n", i);
+            }
+            else if (sockfd == m_control_listenfd) {
+
+                accept_successor();
+            }
+            else if (sockfd == m_successor) {
+
+                read_successor();
+            }
+            // The following handles the signal received by the parent process.
+            else if ((sockfd == sig_pipefd[0]) && (events[i].events & EPOLLIN)) {
+
+                int sig;
+                char signals[1024];
+
+                ret = recv(sig_pipefd[0], signals, sizeof(signals), 0);
+
+                if (ret <= 0) {
+
+                    continue;
+                }
+                else {
+
+                    for (int i = 0; i < ret; ++i) {
+
+                        switch (signals[i]) {
+
+                            case SIGCHLD: {
+
+                                pid_t pid;
+                                int stat;
+
+                                while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
+
+                                    for (int i = 0; i < m_process_number; ++i) {
+
+                                        if (m_sub_process[i].m_pid == pid) {
+
+                                            child_exited(i, stat);
+                                        }
                                     }
                                 }
 
+                                // If all child processes have exited, and none is to be respawned,
+                                // the parent process also exits.
+                                m_stop = !children_left();
+
+                                break;
+                            }
+                            case SIGTERM:
+                            case SIGINT: {
+
+                                stop_children();
                                 break;
                             }
                             default: {
@@ -502,10 +1328,337 @@ void processpool<T>::run_parent() {
                 continue;
             }
         }
+
+        // A new child process leaves the loop of the parent for its own.
+        if (respawn_children()) {
+
+            run_child();
+            return;
+        }
+
+        if ((m_drain_deadline != 0) && (monotonic_us() >= m_drain_deadline)) {
+
+            m_drain_deadline = 0;
+            stop_children();
+        }
+    }
+
+    if (m_control_listenfd != -1) {
+
+        close(m_control_listenfd);
+    }
+
+    if (m_successor != -1) {
+
+        close(m_successor);
     }
 
     //close(m_listenfd); /*The file descriptor is closed by the creator (see below)*/
     close(m_epollfd);
 }
 
+// If the parent process receives a termination signal, it kills all child processes and waits for them all to finish.
+// Of course, a better way to notify the end of the child process is to send special data to the communication channel
+// between the parent and child processes. Readers may wish to implement this by themselves.
+template<typename T>
+void processpool<T>::stop_children() {
+
+    printf("kill all the child now\n");
+
+    m_stopping = true;
+
+    for (int i = 0; i < m_process_number; ++i) {
+
+        int pid = m_sub_process[i].m_pid;
+
+        if (pid != -1) {
+
+            kill(pid, SIGTERM);
+        }
+    }
+
+    // The children waiting to be respawned are not, and if no other is left the parent exits now.
+    m_stop = !children_left();
+}
+
+// Have the children finish the connections they have and exit, without taking new ones: the connections in flight
+// are not reset. The parent stops those still running after the deadline of the drain with SIGTERM.
+template<typename T>
+void processpool<T>::drain_children() {
+
+    printf("drain all the child now\n");
+
+    m_stopping = true;
+    m_drain_deadline = monotonic_us() + (DRAIN_TIMEOUT + 1) * 1000000ULL;
+
+    int drain = CHILD_DRAIN;
+
+    for (int i = 0; i < m_process_number; ++i) {
+
+        int pid = m_sub_process[i].m_pid;
+
+        if (pid == -1) continue;
+
+        int ret = -1;
+
+        if (m_dispatch == DISPATCH_PASS_FD) {
+
+            ret = send_fds(m_sub_process[i].m_pipefd[0], &drain, sizeof(drain), nullptr, 0);
+        }
+        else {
+
+            ret = send(m_sub_process[i].m_pipefd[0], (char*)& drain, sizeof(drain), MSG_NOSIGNAL);
+        }
+
+        // The pipe is nonblocking: a child whose pipe is full does not learn of the drain, and is stopped now.
+        if (ret < 0) {
+
+            printf("draining child %d failed, errno is: %d\n", i, errno);
+            kill(pid, SIGTERM);
+        }
+    }
+
+    m_stop = !children_left();
+}
+
+// Child 'child' has exited with status 'stat'. The main process closes the corresponding communication pipe, sets
+// the corresponding m_pid to -1 to mark that the child has exited, and unless the pool is stopping, schedules
+// the child to be forked again.
+template<typename T>
+void processpool<T>::child_exited(int child, int stat) {
+
+    process& sub_process = m_sub_process[child];
+
+    printf("child %d join\n", child);
+
+    close(sub_process.m_pipefd[0]);
+    sub_process.m_pid = -1;
+
+    if (m_stopping) return;
+
+    if (WIFSIGNALED(stat)) {
+
+        printf("child %d killed by signal %d\n", child, WTERMSIG(stat));
+    }
+    else {
+
+        printf("child %d exited with status %d\n", child, WEXITSTATUS(stat));
+    }
+
+    uint64_t now = monotonic_us();
+
+    // A child that ran long enough before it died starts a new series.
+    if (now - sub_process.m_started >= RESPAWN_STABLE * 1000ULL) {
+
+        sub_process.m_crashes = 0;
+    }
+
+    ++sub_process.m_crashes;
+
+    if (sub_process.m_crashes >= RESPAWN_LIMIT) {
+
+        printf("child %d crashes in a loop, not respawned\n", child);
+        return;
+    }
+
+    int delay = 0;
+
+    if (sub_process.m_crashes > 1) {
+
+        delay = RESPAWN_DELAY << (sub_process.m_crashes - 2);
+
+        if (delay > RESPAWN_DELAY_MAX) {
+
+            delay = RESPAWN_DELAY_MAX;
+        }
+    }
+
+    sub_process.m_respawn_at = now + delay * 1000ULL;
+}
+
+// Fork the children that are due to be forked again. Returns true in a new child process, which has closed
+// the descriptors of the parent it does not use, and must then run as a child.
+template<typename T>
+bool processpool<T>::respawn_children() {
+
+    if (m_stopping) return false;
+
+    uint64_t now = monotonic_us();
+
+    for (int i = 0; i < m_process_number; ++i) {
+
+        if ((m_sub_process[i].m_respawn_at == 0) or (m_sub_process[i].m_respawn_at > now)) continue;
+
+        m_sub_process[i].m_respawn_at = 0;
+
+        // The signals stay blocked until the new child has let go of the signal pipeline of the parent,
+        // which its signals would otherwise go to.
+        sigset_t all;
+        sigset_t old;
+
+        sigfillset(&all);
+        sigprocmask(SIG_BLOCK, &all, &old);
+
+        pid_t pid = spawn(i);
+
+        if (pid == 0) {
+
+            close(m_epollfd);
+            close(sig_pipefd[0]);
+            close(sig_pipefd[1]);
+
+            if (m_control_listenfd != -1) {
+
+                close(m_control_listenfd);
+                m_control_listenfd = -1;
+            }
+
+            if (m_successor != -1) {
+
+                close(m_successor);
+                m_successor = -1;
+            }
+
+            for (int j = 0; j < m_process_number; ++j) {
+
+                if ((j != i) && (m_sub_process[j].m_pid != -1)) {
+
+                    close(m_sub_process[j].m_pipefd[0]);
+                }
+            }
+
+            // Until run_child installs its own handlers.
+            addsig(SIGCHLD, SIG_DFL);
+            addsig(SIGTERM, SIG_DFL);
+            addsig(SIGINT, SIG_DFL);
+
+            sigprocmask(SIG_SETMASK, &old, nullptr);
+
+            return true;
+        }
+
+        sigprocmask(SIG_SETMASK, &old, nullptr);
+
+        if (pid < 0) {
+
+            printf("respawning child %d failed, errno is: %d\n", i, errno);
+
+            m_sub_process[i].m_respawn_at = now + RESPAWN_DELAY_MAX * 1000ULL;
+            continue;
+        }
+
+        printf("child %d respawned as %d\n", i, pid);
+    }
+
+    return false;
+}
+
+// The time in milliseconds until the next child is due to be forked again, -1 if none is.
+template<typename T>
+int processpool<T>::respawn_timeout() const {
+
+    if (m_stopping) return -1;
+
+    uint64_t now = monotonic_us();
+    int timeout = -1;
+
+    for (int i = 0; i < m_process_number; ++i) {
+
+        uint64_t at = m_sub_process[i].m_respawn_at;
+
+        if (at == 0) continue;
+
+        // Rounded up, so that the child is due when the parent wakes up.
+        int ms = (at > now) ? (at - now + 999) / 1000 : 0;
+
+        if ((timeout == -1) or (ms < timeout)) {
+
+            timeout = ms;
+        }
+    }
+
+    return timeout;
+}
+
+// Whether a child is running, or is to be forked again.
+template<typename T>
+bool processpool<T>::children_left() const {
+
+    for (int i = 0; i < m_process_number; ++i) {
+
+        if ((m_sub_process[i].m_pid != -1) or ((m_sub_process[i].m_respawn_at != 0) && !m_stopping)) return true;
+    }
+
+    return false;
+}
+
+// Serve under the name of the pool, to wait for a successor.
+template<typename T>
+void processpool<T>::listen_control() {
+
+    m_control_listenfd = control_listen(m_name);
+
+    if (m_control_listenfd < 0) {
+
+        printf("another pool serves under %s, no hot upgrade\n", m_name);
+        return;
+    }
+
+    addfd(m_epollfd, m_control_listenfd);
+}
+
+// A new pool has connected to take over: hand it the listening socket, which this pool keeps serving until the
+// successor is ready. The control socket is closed first, so that the name is free by the time the successor has
+// the socket and serves under it itself; if the hand-over fails, this pool serves under it again.
+template<typename T>
+void processpool<T>::accept_successor() {
+
+    int fd = accept4(m_control_listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd < 0) return;
+
+    removefd(m_epollfd, m_control_listenfd);
+    m_control_listenfd = -1;
+
+    if (send_fds(fd, &UPGRADE_LISTENER, sizeof(UPGRADE_LISTENER), &m_listenfd, 1) < 0) {
+
+        close(fd);
+        listen_control();
+
+        return;
+    }
+
+    printf("handed the listening socket over\n");
+
+    m_successor = fd;
+    addfd(m_epollfd, m_successor);
+}
+
+// The successor serves the listening socket: stop dispatching connections, and drain the children. If it is gone
+// before that, this pool goes on serving and waits for another one.
+template<typename T>
+void processpool<T>::read_successor() {
+
+    char type = 0;
+    int ret = recv(m_successor, &type, sizeof(type), 0);
+
+    if ((ret < 0) && (errno == EAGAIN)) return;
+
+    if ((ret == sizeof(type)) && (type == UPGRADE_READY)) {
+
+        printf("successor ready\n");
+
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+        drain_children();
+    }
+    else {
+
+        printf("successor gone\n");
+        listen_control();
+    }
+
+    removefd(m_epollfd, m_successor);
+    m_successor = -1;
+}
+
 #endif
\ No newline at end of file
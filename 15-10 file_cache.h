@@ -0,0 +1,606 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+
+#include "14-2 locker.h"
+
+// Content codings of the precompressed sidecar files a file may have next to it ("index.html.br", "index.html.gz"),
+// in order of preference. The server does not compress anything itself; see 16-11 precompress.
+enum CONTENT_CODING {
+
+    CODING_BR = 0,
+    CODING_GZIP,
+    CODING_NUMBER
+};
+
+static const char* const coding_names[CODING_NUMBER] = { "br", "gzip" };
+static const char* const coding_suffixes[CODING_NUMBER] = { ".br", ".gz" };
+
+// A file known to the cache: its status and, once a response needs the contents,
+// a read-only mapping of the whole file. An entry lives as long as it is in the cache
+// or some response still holds a reference to it, whichever is longer.
+struct file_entry {
+
+    std::string path;  // The real path of the file, which is also the key of the cache.
+    struct stat st;    // The status of the file when it was last validated.
+
+    // The HTTP validators of this version of the file, formatted once when the entry is created:
+    // an entity tag made of the inode, size and modification time, and the modification time as an HTTP-date.
+    char etag[64];
+    char last_modified[32];
+
+    // Both as the header fields of a response, "ETag: ...\r\nLast-Modified: ...\r\n", ready to be copied.
+    char validators[128];
+    int validators_length;
+
+    // Bit (1 << CONTENT_CODING) per sidecar file that exists and is not older than this file, when the cache looks for them.
+    // A re-validation updates it in place, so it is only read under the lock; acquire returns a copy.
+    unsigned char codings;
+
+    char* address;     // Where the file is mapped, or nullptr if it has not been mapped (yet).
+    int fd;            // A read-only descriptor of the file for sendfile, or -1 if it has not been opened (yet).
+
+    int refs;          // Number of responses currently using the entry.
+    bool cached;       // Whether the entry is still in the cache table.
+    time_t checked;    // When the entry was last validated against the file system.
+
+    file_entry* prev;  // Neighbours in the LRU list, the most recently used entry is at the head.
+    file_entry* next;
+};
+
+// Counters of the file cache.
+struct file_cache_stats {
+
+    long hits;           // Lookups answered from the cache.
+    long misses;         // Lookups that had to stat the file and create a new entry.
+    long evictions;      // Entries removed to stay within the size budget.
+    long invalidations;  // Entries dropped because the file changed on disk.
+    long sidecar_stats;  // Calls to stat made to look for sidecar files.
+    size_t bytes;        // Bytes currently mapped by cached entries.
+    int entries;         // Number of cached entries.
+};
+
+// Cache of file status, descriptors and mappings shared by all connections, keyed by real path.
+// A hot file is stat'ed, opened and mapped once; every response for it then shares the one mapping (or descriptor),
+// and the mapping is only unmapped after the entry has been evicted and the last response using it has finished.
+// An entry is re-validated with stat once its TTL has passed, and dropped if the inode, size or mtime changed.
+class file_cache {
+public:
+    // The limits the cache starts with, until configure is called.
+    static const size_t DEFAULT_MAX_BYTES = 256 * 1024 * 1024;
+    static const int DEFAULT_MAX_ENTRIES = 4096;
+    static const int DEFAULT_TTL = 1;
+    static const off_t DEFAULT_MAX_FILE_SIZE = 16 * 1024 * 1024;
+
+    // The cache shared by all connections of the process.
+    static file_cache* instance() {
+
+        static file_cache cache;
+        return &cache;
+    }
+
+    // The parameter max_bytes is the budget of mapped bytes, max_entries the maximum number of entries,
+    // ttl the number of seconds an entry is trusted without calling stat, and max_file_size
+    // the size above which files are not kept in the cache at all.
+    void configure(size_t max_bytes, int max_entries, int ttl, off_t max_file_size) {
+
+        m_locker.lock();
+
+        m_max_bytes = max_bytes;
+        m_max_entries = max_entries;
+        m_ttl = ttl;
+        m_max_file_size = max_file_size;
+
+        shrink();
+
+        m_locker.unlock();
+    }
+
+    // Whether entries record which precompressed sidecar files their file has. It is off by default, as
+    // looking for them costs a stat per coding whenever an entry is created or re-validated.
+    void set_sidecars(bool enabled) {
+
+        m_locker.lock();
+
+        m_sidecars = enabled;
+
+        m_locker.unlock();
+    }
+
+    // Look up the file 'path' and take a reference to its entry. Returns nullptr, with errno set,
+    // if the file can not be stat'ed. Every successful acquire must be paired with a release.
+    // With 'sidecars' false the entry does not look for sidecar files, as for a sidecar file itself.
+    // If 'codings' is not nullptr, it receives the codings of the entry as they were when the reference was taken.
+    // The lock is only held to look up and update the table: the calls to stat of a miss or of a re-validation
+    // are made without it, so that they do not hold up the lookups of the other threads.
+    file_entry* acquire(const char* path, bool sidecars = true, unsigned char* codings = nullptr) {
+
+        time_t now = time(nullptr);
+
+        m_locker.lock();
+
+        std::unordered_map<const char*, file_entry*, path_hash, path_equal>::iterator it = m_table.find(path);
+
+        // An entry whose TTL has passed must be checked again. The reference taken on it keeps it alive
+        // while the lock is released, even if another thread removes it from the cache meanwhile.
+        file_entry* stale = nullptr;
+
+        if (it != m_table.end()) {
+
+            file_entry* entry = it->second;
+
+            if (now - entry->checked < m_ttl) {
+
+                ++m_stats.hits;
+                return hold(entry, true, codings);
+            }
+
+            stale = entry;
+            ++stale->refs;
+        }
+
+        bool look = m_sidecars && sidecars;
+
+        m_locker.unlock();
+
+        struct stat st;
+        int sidecar_stats = 0;
+        unsigned char found = 0;
+
+        if (stat(path, &st) < 0) {
+
+            if (!stale) return nullptr;
+
+            int save_errno = errno;
+
+            m_locker.lock();
+
+            ++m_stats.invalidations;
+            drop(stale);
+
+            errno = save_errno;
+
+            return fail();
+        }
+
+        found = find_sidecars(path, st, look, &sidecar_stats);
+
+        if (stale && same_file(stale->st, st)) {
+
+            m_locker.lock();
+
+            m_stats.sidecar_stats += sidecar_stats;
+
+            stale->checked = now;
+            stale->codings = found;
+
+            --stale->refs;
+
+            ++m_stats.hits;
+            return hold(stale, true, codings);
+        }
+
+        // A new entry, built before the lock is taken again.
+        file_entry* entry = new file_entry;
+
+        entry->path = path;
+        entry->st = st;
+
+        set_validators(entry);
+
+        entry->codings = found;
+
+        entry->address = nullptr;
+        entry->fd = -1;
+        entry->refs = 0;
+        entry->cached = false;
+        entry->checked = now;
+        entry->prev = entry->next = nullptr;
+
+        m_locker.lock();
+
+        m_stats.sidecar_stats += sidecar_stats;
+
+        if (stale) {
+
+            ++m_stats.invalidations;
+            drop(stale);
+        }
+
+        ++m_stats.misses;
+
+        // Another thread may have cached the file while the lock was released. Its entry is used if it is
+        // for the same version of the file, and replaced by the new one otherwise.
+        it = m_table.find(path);
+
+        if (it != m_table.end()) {
+
+            if (same_file(it->second->st, st)) {
+
+                delete entry;
+                return hold(it->second, true, codings);
+            }
+
+            remove(it->second);
+        }
+
+        // Files that are too big are still served through an entry, but it is private to the response.
+        if (st.st_size <= m_max_file_size) {
+
+            insert(entry);
+        }
+
+        return hold(entry, false, codings);
+    }
+
+    // Return the mapping of the entry's contents, mapping the file on first use.
+    // Returns nullptr for an empty file or if the file can not be mapped.
+    // The file is opened and mapped without the lock. Of two threads mapping it at once, the first to finish wins.
+    char* map(file_entry* entry) {
+
+        m_locker.lock();
+
+        char* address = entry->address;
+        int fd = entry->fd;
+
+        m_locker.unlock();
+
+        if (address or (entry->st.st_size == 0)) return address;
+
+        // Reuse the descriptor if sendfile has already opened the file.
+        int map_fd = (fd >= 0) ? fd : open(entry->path.c_str(), O_RDONLY);
+
+        if (map_fd < 0) return nullptr;
+
+        void* mapped = mmap(0, entry->st.st_size, PROT_READ, MAP_PRIVATE, map_fd, 0);
+
+        if (map_fd != fd) {
+
+            close(map_fd);
+        }
+
+        if (mapped == MAP_FAILED) return nullptr;
+
+        m_locker.lock();
+
+        if (entry->address) {
+
+            munmap(mapped, entry->st.st_size);
+        }
+        else {
+
+            entry->address = (char*) mapped;
+
+            if (entry->cached) {
+
+                m_stats.bytes += entry->st.st_size;
+                shrink();
+            }
+        }
+
+        address = entry->address;
+
+        m_locker.unlock();
+
+        return address;
+    }
+
+    // Return a read-only descriptor of the entry's file, opening it on first use. Returns -1 on failure.
+    // The descriptor is shared by all responses and stays open until the entry is destroyed,
+    // so callers must use sendfile with an explicit offset and must not close it.
+    int open_fd(file_entry* entry) {
+
+        m_locker.lock();
+
+        int fd = entry->fd;
+
+        m_locker.unlock();
+
+        if (fd >= 0) return fd;
+
+        fd = open(entry->path.c_str(), O_RDONLY);
+
+        if (fd < 0) return -1;
+
+        m_locker.lock();
+
+        if (entry->fd >= 0) {
+
+            close(fd);
+        }
+        else {
+
+            entry->fd = fd;
+        }
+
+        fd = entry->fd;
+
+        m_locker.unlock();
+
+        return fd;
+    }
+
+    // Drop a reference taken by acquire.
+    void release(file_entry* entry) {
+
+        if (!entry) return;
+
+        m_locker.lock();
+
+        --entry->refs;
+
+        if (!entry->cached && (entry->refs == 0)) {
+
+            destroy(entry);
+        }
+
+        m_locker.unlock();
+    }
+
+    file_cache_stats stats() {
+
+        m_locker.lock();
+
+        file_cache_stats stats = m_stats;
+
+        m_locker.unlock();
+
+        return stats;
+    }
+
+private:
+    file_cache() : m_max_bytes(DEFAULT_MAX_BYTES), m_max_entries(DEFAULT_MAX_ENTRIES), m_ttl(DEFAULT_TTL),
+        m_max_file_size(DEFAULT_MAX_FILE_SIZE), m_sidecars(false), m_head(nullptr), m_tail(nullptr) {
+
+        memset(&m_stats, '\0', sizeof(m_stats));
+    }
+
+    ~file_cache() {
+
+        while (m_head) {
+
+            remove(m_head);
+        }
+    }
+
+    // Hash and comparison of the C string keys, so a lookup does not have to build a std::string.
+    struct path_hash {
+
+        size_t operator()(const char* s) const {
+
+            size_t h = 14695981039346656037ul;
+
+            for (; *s; ++s) {
+
+                h = (h ^ (unsigned char) *s) * 1099511628211ul;
+            }
+
+            return h;
+        }
+    };
+
+    struct path_equal {
+
+        bool operator()(const char* a, const char* b) const { return strcmp(a, b) == 0; }
+    };
+
+    static bool same_file(const struct stat& a, const struct stat& b) {
+
+        return (a.st_ino == b.st_ino) && (a.st_dev == b.st_dev) && (a.st_size == b.st_size) &&
+               (a.st_mtim.tv_sec == b.st_mtim.tv_sec) && (a.st_mtim.tv_nsec == b.st_mtim.tv_nsec);
+    }
+
+    static void set_validators(file_entry* entry) {
+
+        long long mtime_ns = (long long) entry->st.st_mtim.tv_sec * 1000000000 + entry->st.st_mtim.tv_nsec;
+
+        snprintf(entry->etag, sizeof(entry->etag), "\"%llx-%llx-%llx\"",
+                 (unsigned long long) entry->st.st_ino, (unsigned long long) entry->st.st_size, (unsigned long long) mtime_ns);
+
+        struct tm tm;
+        gmtime_r(&entry->st.st_mtim.tv_sec, &tm);
+
+        strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+        entry->validators_length = snprintf(entry->validators, sizeof(entry->validators), "ETag: %s\r\nLast-Modified: %s\r\n",
+                                            entry->etag, entry->last_modified);
+    }
+
+    // Look for the sidecar files of 'path', whose status is 'st', if 'look'. A sidecar older than the file was made from
+    // a previous version of it and is ignored. Sidecar files are trusted as long as the entry is.
+    // It is called without the lock, and adds the calls to stat it makes to 'stats'.
+    static unsigned char find_sidecars(const char* path, const struct stat& st, bool look, int* stats) {
+
+        if (!look) return 0;
+
+        char sidecar[PATH_MAX];
+        int len = strlen(path);
+
+        unsigned char codings = 0;
+
+        for (int i = 0; i < CODING_NUMBER; ++i) {
+
+            if (len + strlen(coding_suffixes[i]) >= sizeof(sidecar)) continue;
+
+            memcpy(sidecar, path, len);
+            strcpy(sidecar + len, coding_suffixes[i]);
+
+            struct stat sidecar_st;
+
+            ++*stats;
+
+            if ((stat(sidecar, &sidecar_st) == 0) && S_ISREG(sidecar_st.st_mode) &&
+                ((sidecar_st.st_mtim.tv_sec > st.st_mtim.tv_sec) or
+                 ((sidecar_st.st_mtim.tv_sec == st.st_mtim.tv_sec) && (sidecar_st.st_mtim.tv_nsec >= st.st_mtim.tv_nsec)))) {
+
+                codings |= 1 << i;
+            }
+        }
+
+        return codings;
+    }
+
+    // Take a reference, move a cached entry to the head of the LRU list, copy its codings to 'codings',
+    // and release the lock.
+    file_entry* hold(file_entry* entry, bool touch, unsigned char* codings) {
+
+        ++entry->refs;
+
+        if (codings) {
+
+            *codings = entry->codings;
+        }
+
+        if (touch && entry->cached && (entry != m_head)) {
+
+            unlink(entry);
+            link_front(entry);
+        }
+
+        // The reference taken above keeps the entry alive even if it is evicted right away.
+        shrink();
+
+        m_locker.unlock();
+
+        return entry;
+    }
+
+    // Drop the reference taken on an entry found stale, and take the entry out of the cache if it still is.
+    void drop(file_entry* entry) {
+
+        --entry->refs;
+
+        if (entry->cached) {
+
+            remove(entry);
+        }
+        else if (entry->refs == 0) {
+
+            destroy(entry);
+        }
+    }
+
+    // Release the lock and report a failed lookup, keeping the errno of the failed stat.
+    file_entry* fail() {
+
+        int save_errno = errno;
+
+        m_locker.unlock();
+        errno = save_errno;
+
+        return nullptr;
+    }
+
+    void link_front(file_entry* entry) {
+
+        entry->prev = nullptr;
+        entry->next = m_head;
+
+        if (m_head) {
+
+            m_head->prev = entry;
+        }
+        else {
+
+            m_tail = entry;
+        }
+
+        m_head = entry;
+    }
+
+    void unlink(file_entry* entry) {
+
+        if (entry->prev) entry->prev->next = entry->next;
+        else m_head = entry->next;
+
+        if (entry->next) entry->next->prev = entry->prev;
+        else m_tail = entry->prev;
+
+        entry->prev = entry->next = nullptr;
+    }
+
+    void insert(file_entry* entry) {
+
+        entry->cached = true;
+
+        m_table[entry->path.c_str()] = entry;
+        link_front(entry);
+
+        ++m_stats.entries;
+    }
+
+    // Take an entry out of the cache. It is destroyed now if no response uses it, otherwise by the last release.
+    void remove(file_entry* entry) {
+
+        m_table.erase(entry->path.c_str());
+        unlink(entry);
+
+        entry->cached = false;
+
+        --m_stats.entries;
+
+        if (entry->address) {
+
+            m_stats.bytes -= entry->st.st_size;
+        }
+
+        if (entry->refs == 0) {
+
+            destroy(entry);
+        }
+    }
+
+    void destroy(file_entry* entry) {
+
+        if (entry->address) {
+
+            munmap(entry->address, entry->st.st_size);
+        }
+
+        if (entry->fd >= 0) {
+
+            close(entry->fd);
+        }
+
+        delete entry;
+    }
+
+    // Evict least recently used entries until the cache fits its budget again.
+    void shrink() {
+
+        while (m_tail && ((m_stats.bytes > m_max_bytes) or (m_stats.entries > m_max_entries))) {
+
+            ++m_stats.evictions;
+            remove(m_tail);
+        }
+    }
+
+private:
+    size_t m_max_bytes;
+    int m_max_entries;
+    int m_ttl;
+    off_t m_max_file_size;
+    bool m_sidecars;
+
+    locker m_locker;  // Protects everything below.
+
+    std::unordered_map<const char*, file_entry*, path_hash, path_equal> m_table;
+
+    file_entry* m_head;  // The LRU list.
+    file_entry* m_tail;
+
+    file_cache_stats m_stats;
+};
+
+#endif
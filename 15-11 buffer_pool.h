@@ -0,0 +1,149 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "14-2 locker.h"
+
+// Pool of buffers in power-of-two size classes shared by all connections.
+// A connection borrows a buffer when it has data to hold and gives it back when it goes idle,
+// so memory follows the number of busy connections rather than the number of open ones.
+// Freed buffers are kept on a per-class free list for reuse, up to a limit per class.
+class buffer_pool {
+public:
+    // The smallest and the largest buffer the pool hands out.
+    static const int MIN_BUFFER_SIZE = 1024;
+    static const int MAX_BUFFER_SIZE = 1024 * 1024;
+
+    // The pool shared by all connections of the process.
+    static buffer_pool* instance() {
+
+        static buffer_pool pool;
+        return &pool;
+    }
+
+    // Round 'size' up to the size of the class that serves it. Returns 0 if it is larger than MAX_BUFFER_SIZE.
+    static int class_size(int size) {
+
+        int n = MIN_BUFFER_SIZE;
+
+        while ((n < size) && (n < MAX_BUFFER_SIZE)) {
+
+            n <<= 1;
+        }
+
+        return (n >= size) ? n : 0;
+    }
+
+    // Borrow a buffer of at least 'size' bytes. '*capacity' receives its real size.
+    // Returns nullptr if 'size' is larger than MAX_BUFFER_SIZE.
+    char* acquire(int size, int* capacity) {
+
+        int n = class_size(size);
+
+        if (n == 0) return nullptr;
+
+        size_class& c = m_classes[index_of(n)];
+        chunk* ch = nullptr;
+
+        c.lock.lock();
+
+        if (c.free_list) {
+
+            ch = c.free_list;
+            c.free_list = ch->next;
+
+            --c.free_count;
+        }
+
+        c.lock.unlock();
+
+        *capacity = n;
+
+        if (ch) return (char*) ch;
+
+        return new char[n];
+    }
+
+    // Give back a buffer of 'capacity' bytes obtained from acquire.
+    void release(char* buf, int capacity) {
+
+        if (!buf) return;
+
+        size_class& c = m_classes[index_of(capacity)];
+
+        c.lock.lock();
+
+        if (c.free_count < MAX_FREE_PER_CLASS) {
+
+            chunk* ch = (chunk*) buf;
+
+            ch->next = c.free_list;
+            c.free_list = ch;
+
+            ++c.free_count;
+            buf = nullptr;
+        }
+
+        c.lock.unlock();
+
+        // The free list of this class is full, return the memory to the system.
+        delete[] buf;
+    }
+
+private:
+    buffer_pool() {}
+
+    ~buffer_pool() {
+
+        for (int i = 0; i < CLASS_NUMBER; ++i) {
+
+            while (m_classes[i].free_list) {
+
+                chunk* ch = m_classes[i].free_list;
+
+                m_classes[i].free_list = ch->next;
+                delete[] (char*) ch;
+            }
+        }
+    }
+
+    static int index_of(int size) {
+
+        int i = 0;
+
+        for (int n = MIN_BUFFER_SIZE; n < size; n <<= 1) {
+
+            ++i;
+        }
+
+        return i;
+    }
+
+    // A free buffer stores the link of the free list in its own first bytes.
+    struct chunk {
+
+        chunk* next;
+    };
+
+    struct size_class {
+
+        size_class() : free_list(nullptr), free_count(0) {}
+
+        locker lock;
+        chunk* free_list;
+        int free_count;
+    };
+
+private:
+    // Number of size classes from MIN_BUFFER_SIZE to MAX_BUFFER_SIZE.
+    static const int CLASS_NUMBER = 11;
+
+    // Maximum number of free buffers kept per size class.
+    static const int MAX_FREE_PER_CLASS = 1024;
+
+    size_class m_classes[CLASS_NUMBER];
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <time.h>
+#include <atomic>
+#include <exception>
+
+#include "14-2 locker.h"
+
+// Table of per-connection objects indexed by file descriptor, used instead of 'new T[MAX_FD]'.
+// It is a two-level table: the descriptor selects a page, and the page holds PAGE_SIZE objects.
+// A page is only allocated when a descriptor in its range is first used, so start-up time and
+// baseline memory no longer depend on the maximum number of descriptors, and lookup stays O(1).
+template<typename T>
+class fd_table {
+public:
+    // Number of objects per page.
+    static const int PAGE_SIZE = 256;
+
+    // The parameter max_fd is the number of descriptors the table can hold (descriptors 0 to max_fd - 1).
+    explicit fd_table(int max_fd) : m_max_fd(max_fd), m_page_number((max_fd + PAGE_SIZE - 1) / PAGE_SIZE) {
+
+        if (max_fd <= 0) {
+
+            throw std::exception();
+        }
+
+        m_pages = new std::atomic<page*>[m_page_number];
+
+        for (int i = 0; i < m_page_number; ++i) {
+
+            m_pages[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~fd_table() {
+
+        for (int i = 0; i < m_page_number; ++i) {
+
+            delete m_pages[i].load(std::memory_order_relaxed);
+        }
+
+        delete[] m_pages;
+    }
+
+    // Get the object of a newly accepted descriptor, allocating its page if necessary.
+    // Returns nullptr if fd is out of range or the page can not be allocated.
+    T* acquire(int fd) {
+
+        if ((fd < 0) or (fd >= m_max_fd)) return nullptr;
+
+        m_locker.lock();
+
+        page* p = m_pages[fd / PAGE_SIZE].load(std::memory_order_relaxed);
+
+        if (!p) {
+
+            p = new page;
+            m_pages[fd / PAGE_SIZE].store(p, std::memory_order_release);
+        }
+
+        // The page is in use again, it can not be released by trim.
+        p->idle_since = 0;
+
+        m_locker.unlock();
+
+        return p->items + fd % PAGE_SIZE;
+    }
+
+    // Get the object of a descriptor that was acquired before and is still open. This path takes no lock.
+    T* get(int fd) {
+
+        if ((fd < 0) or (fd >= m_max_fd)) return nullptr;
+
+        page* p = m_pages[fd / PAGE_SIZE].load(std::memory_order_acquire);
+
+        return p ? p->items + fd % PAGE_SIZE : nullptr;
+    }
+
+    // Release the pages whose objects have all been closed for at least 'idle_seconds'.
+    // A page is seen closed by one call and released by a later one, so an object that was closed
+    // just now is never freed under a thread still finishing with it. T must provide 'bool closed() const'.
+    // Returns the number of pages released.
+    int trim(int idle_seconds) {
+
+        time_t now = time(nullptr);
+        int released = 0;
+
+        m_locker.lock();
+
+        for (int i = 0; i < m_page_number; ++i) {
+
+            page* p = m_pages[i].load(std::memory_order_relaxed);
+
+            if (!p) continue;
+
+            bool closed = true;
+
+            for (int j = 0; (j < PAGE_SIZE) && closed; ++j) {
+
+                closed = p->items[j].closed();
+            }
+
+            if (!closed) {
+
+                p->idle_since = 0;
+            }
+            else if (p->idle_since == 0) {
+
+                p->idle_since = now;
+            }
+            else if (now - p->idle_since >= idle_seconds) {
+
+                m_pages[i].store(nullptr, std::memory_order_relaxed);
+
+                delete p;
+                ++released;
+            }
+        }
+
+        m_locker.unlock();
+
+        return released;
+    }
+
+private:
+    struct page {
+
+        page() : idle_since(0) {}
+
+        T items[PAGE_SIZE];
+        time_t idle_since;  // When trim first found every object of the page closed, 0 if it did not.
+    };
+
+private:
+    int m_max_fd;
+    int m_page_number;
+
+    std::atomic<page*>* m_pages;  // The first level, one pointer per page.
+    locker m_locker;              // Serializes page allocation and release.
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <strings.h>
+
+// The request header fields the server acts on. HEADER_UNKNOWN is every other field, which is skipped.
+enum HEADER {
+
+    HEADER_UNKNOWN = 0,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_HOST,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_NUMBER
+};
+
+// The field names, indexed by HEADER.
+static constexpr const char* header_names[HEADER_NUMBER] = {
+
+    "",
+    "Connection",
+    "Content-Length",
+    "Host",
+    "Accept-Encoding",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Range",
+    "Transfer-Encoding"
+};
+
+// A header value in the read buffer: 'offset' bytes from the start of the request, 'length' bytes long.
+// Offsets stay valid when the buffer is grown or compacted, which moves the request as a whole.
+struct header_span {
+
+    int offset;
+    int length;
+};
+
+// A perfect hash of the field names, ignoring case. It is computed from the length and the first and last
+// characters of a name with a multiplier that the compiler searches for, so that every known name gets a slot
+// of its own. A lookup is then one multiplication, one table read and one comparison, whatever the name.
+static const int HEADER_TABLE_BITS = 5;
+static const int HEADER_TABLE_SIZE = 1 << HEADER_TABLE_BITS;
+
+constexpr unsigned header_lower(char c) {
+
+    return ((c >= 'A') && (c <= 'Z')) ? (unsigned)(c - 'A' + 'a') : (unsigned)(unsigned char) c;
+}
+
+constexpr int header_length(const char* name) {
+
+    int len = 0;
+
+    while (name[len]) ++len;
+
+    return len;
+}
+
+constexpr unsigned header_hash(const char* name, int len, unsigned seed) {
+
+    return ((unsigned) len + 31u * header_lower(name[0]) + 961u * header_lower(name[len - 1])) * seed >> (32 - HEADER_TABLE_BITS);
+}
+
+// The multiplier and the slot table of the hash: slots[hash] is the HEADER whose name hashes there, or HEADER_UNKNOWN.
+// 'lengths' holds the length of each name, indexed by HEADER.
+struct header_table {
+
+    unsigned seed;
+    unsigned char slots[HEADER_TABLE_SIZE];
+    unsigned char lengths[HEADER_NUMBER];
+};
+
+constexpr header_table build_header_table() {
+
+    // Candidate multipliers are spread over the whole 32-bit range, so their high bits, which pick the slot, vary.
+    for (unsigned i = 1; i < 100000; ++i) {
+
+        unsigned seed = (i * 2654435761u) | 1;
+
+        header_table table = { seed, {}, {} };
+        bool collision = false;
+
+        for (int id = 1; (id < HEADER_NUMBER) && !collision; ++id) {
+
+            table.lengths[id] = (unsigned char) header_length(header_names[id]);
+
+            unsigned slot = header_hash(header_names[id], table.lengths[id], seed);
+
+            collision = (table.slots[slot] != HEADER_UNKNOWN);
+            table.slots[slot] = (unsigned char) id;
+        }
+
+        if (!collision) return table;
+    }
+
+    return header_table { 0, {}, {} };
+}
+
+static constexpr header_table header_lookup_table = build_header_table();
+
+static_assert(header_lookup_table.seed != 0, "no perfect hash for the header names, raise HEADER_TABLE_BITS");
+
+// Map the field name of 'len' bytes at 'name' to its HEADER, ignoring case.
+inline HEADER lookup_header(const char* name, int len) {
+
+    if (len <= 0) return HEADER_UNKNOWN;
+
+    HEADER id = (HEADER) header_lookup_table.slots[header_hash(name, len, header_lookup_table.seed)];
+
+    // The slot only tells which known name it could be; a different name may hash there too.
+    if ((id == HEADER_UNKNOWN) or (header_lookup_table.lengths[id] != len) or (strncasecmp(name, header_names[id], len) != 0)) {
+
+        return HEADER_UNKNOWN;
+    }
+
+    return id;
+}
+
+#endif
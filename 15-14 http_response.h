@@ -0,0 +1,200 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+// Building blocks of the HTTP responses, so that http_conn assembles its headers from memcpy's of precomputed
+// text instead of parsing printf formats for every response: the status line and Connection field of every
+// (status, keep-alive) combination, whole static responses for the errors with a fixed body, a Date field
+// formatted once per second, and a decimal writer for the numbers in Content-Length and Content-Range.
+
+// The statuses the server answers with.
+enum RESPONSE_STATUS {
+
+    STATUS_200 = 0,
+    STATUS_206,
+    STATUS_304,
+    STATUS_400,
+    STATUS_403,
+    STATUS_404,
+    STATUS_416,
+    STATUS_500,
+    STATUS_NUMBER
+};
+
+// The code and reason phrase of each status, and the fixed body of the error responses that have one.
+struct response_status {
+
+    int code;
+    const char* title;
+    const char* body;
+};
+
+static const response_status response_statuses[STATUS_NUMBER] = {
+
+    { 200, "OK", nullptr },
+    { 206, "Partial Content", nullptr },
+    { 304, "Not Modified", nullptr },
+    { 400, "Bad Request", "Your Request has bad syntax or is inherently impossible to satisfy.\n" },
+    { 403, "Forbidden", "You do not have permission to get file from this server.\n" },
+    { 404, "Not Found", "The requested file was not found on this server.\n" },
+    { 416, "Range Not Satisfiable", "None of the requested ranges is within the file.\n" },
+    { 500, "Internal Error", "There was an unusual problem serving the requested file.\n" }
+};
+
+// A block of header text and its length.
+struct header_block {
+
+    const char* data;
+    int length;
+};
+
+// The precomputed header blocks, formatted once when first used.
+class response_templates {
+public:
+    static const response_templates& instance() {
+
+        static const response_templates templates;
+        return templates;
+    }
+
+    // "HTTP/1.1 <code> <title>\r\nConnection: keep-alive|close\r\n".
+    header_block status(RESPONSE_STATUS status, bool keep_alive) const {
+
+        return m_status[status][keep_alive];
+    }
+
+    // The status block followed by "Content-Length: <length of the fixed body>\r\n", for the errors with a fixed body.
+    // The response is complete once the Date field, the blank line and the body are added.
+    header_block error(RESPONSE_STATUS status, bool keep_alive) const {
+
+        return m_error[status][keep_alive];
+    }
+
+private:
+    response_templates() {
+
+        char* p = m_text;
+
+        for (int i = 0; i < STATUS_NUMBER; ++i) {
+
+            for (int keep_alive = 0; keep_alive < 2; ++keep_alive) {
+
+                const char* connection = keep_alive ? "keep-alive" : "close";
+
+                p = add(m_status[i][keep_alive], p, "HTTP/1.1 %d %s\r\nConnection: %s\r\n",
+                        response_statuses[i].code, response_statuses[i].title, connection, 0);
+
+                if (response_statuses[i].body) {
+
+                    p = add(m_error[i][keep_alive], p, "HTTP/1.1 %d %s\r\nConnection: %s\r\nContent-Length: %d\r\n",
+                            response_statuses[i].code, response_statuses[i].title, connection, (int) strlen(response_statuses[i].body));
+                }
+                else {
+
+                    m_error[i][keep_alive] = header_block { nullptr, 0 };
+                }
+            }
+        }
+    }
+
+    char* add(header_block& block, char* p, const char* format, int code, const char* title, const char* connection, int length) {
+
+        int len = snprintf(p, m_text + sizeof(m_text) - p, format, code, title, connection, length);
+
+        block = header_block { p, len };
+
+        return p + len + 1;
+    }
+
+    header_block m_status[STATUS_NUMBER][2];
+    header_block m_error[STATUS_NUMBER][2];
+
+    char m_text[STATUS_NUMBER * 2 * 160];
+};
+
+// The Date field. The clock is the second the server last ticked, and each thread keeps the field formatted
+// for it, so a response copies 37 bytes and the field is formatted once per second per thread.
+// The server ticks it once per second from its event loop; a clock that is never ticked stays at its first reading.
+static const int DATE_FIELD_LENGTH = 37;
+
+inline std::atomic<time_t>& date_clock() {
+
+    static std::atomic<time_t> clock(time(nullptr));
+    return clock;
+}
+
+inline void tick_date() {
+
+    date_clock().store(time(nullptr), std::memory_order_relaxed);
+}
+
+// "Date: <IMF-fixdate>\r\n", DATE_FIELD_LENGTH bytes without a terminating NUL.
+inline const char* date_field() {
+
+    static thread_local time_t formatted = -1;
+    static thread_local char field[DATE_FIELD_LENGTH + 1];
+
+    time_t now = date_clock().load(std::memory_order_relaxed);
+
+    if (now != formatted) {
+
+        struct tm tm;
+        gmtime_r(&now, &tm);
+
+        strftime(field, sizeof(field), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+
+        formatted = now;
+    }
+
+    return field;
+}
+
+// Number of decimal digits of 'value'.
+inline int decimal_length(unsigned long long value) {
+
+    int len = 1;
+
+    for (; value >= 100; value /= 100) len += 2;
+
+    return len + (value >= 10);
+}
+
+// Write 'value' in decimal at 'out', without a terminating NUL, and return the end of the digits.
+// Two digits are produced per division, from a table of the pairs 00 to 99.
+inline char* write_decimal(char* out, unsigned long long value) {
+
+    static const char pairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    int len = decimal_length(value);
+    char* p = out + len;
+
+    while (value >= 100) {
+
+        int pair = (value % 100) * 2;
+        value /= 100;
+
+        *--p = pairs[pair + 1];
+        *--p = pairs[pair];
+    }
+
+    if (value >= 10) {
+
+        *--p = pairs[value * 2 + 1];
+        *--p = pairs[value * 2];
+    }
+    else {
+
+        *--p = (char) ('0' + value);
+    }
+
+    return out + len;
+}
+
+#endif
@@ -144,23 +144,33 @@ int main(int argc, char* argv[])
     const char* ip = argv[1];
     int port = atoi(argv[2]);
 
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);
+    // A server started on the address of a running one takes its listening socket over, and replaces it
+    // without refusing or dropping any connection.
+    char name[64];
+    snprintf(name, sizeof(name), "pool_CGIServer.%s:%d", ip, port);
 
-    int ret = 0;
+    int listenfd = processpool<cgi_conn>::take_over(name);
 
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
+    if (listenfd < 0) {
 
-    address.sin_family = AF_INET;
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    address.sin_port = htons(port);
+        listenfd = socket(PF_INET, SOCK_STREAM, 0);
+        assert(listenfd >= 0);
 
-    ret = bind(listenfd, (struct sockaddr*)& address, sizeof(address));
-    assert(ret != -1);
+        int ret = 0;
 
-    ret = listen(listenfd, 5);
-    assert(ret != -1);
+        struct sockaddr_in address;
+        bzero(&address, sizeof(address));
+
+        address.sin_family = AF_INET;
+        inet_pton(AF_INET, ip, &address.sin_addr);
+        address.sin_port = htons(port);
+
+        ret = bind(listenfd, (struct sockaddr*)& address, sizeof(address));
+        assert(ret != -1);
+
+        ret = listen(listenfd, 5);
+        assert(ret != -1);
+    }
 
     processpool<cgi_conn>* pool = processpool<cgi_conn>::create(listenfd);
 
@@ -4,6 +4,7 @@
 #include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
 #include <pthread.h>
 
 // Reference to the wrapper class of the thread synchronization mechanism introduced in Chapter 14.
@@ -16,6 +17,9 @@ public:
     // The parameter thread_number is the number of threads in the thread pool,
     // and max_requests is the maximum number of requests waiting to be processed in the request queue.
     threadpool(int thread_number = 8, int max_requests = 10000);
+
+    // Stop the workers and join them. A worker finishes the request it is processing,
+    // the requests still in the queue are dropped.
     ~threadpool();
 
     // Add tasks to the request queue.
@@ -27,11 +31,13 @@ private:
 
     void run();
 
+    void stop(int started);
+
 private:
     int m_thread_number;  // Number of threads in the thread pool.
     int m_max_requests;   // Maximum number of requests allowed in the request queue.
 
-    bool m_stop;                // Whether to end the thread.
+    std::atomic<bool> m_stop;   // Whether to end the thread.
     sem m_queuestat;            // Are there any tasks that need to be processed?
     locker m_queuelocker;       // Mutex protecting request queue.
     pthread_t* m_threads;       // An array describing the thread pool with size m_thread_number.
@@ -54,20 +60,14 @@ threadpool<T>::threadpool(int thread_number, int max_requests) : m_thread_number
         throw std::exception();
     }
 
-    // Create thread_number threads and set them all to detach threads.
+    // Create thread_number threads. They are joined by the destructor, so they are not detached.
     for (int i = 0; i < thread_number; ++i) {
 
         printf("create the %d-th thread\n", i);
 
         if (pthread_create(m_threads + i, nullptr, worker, this) != 0) {
 
-            delete[] m_threads;
-            throw std::exception();
-        }
-
-        if (pthread_detach(m_threads[i])) {
-
-            delete[] m_threads;
+            stop(i);
             throw std::exception();
         }
     }
@@ -76,8 +76,28 @@ threadpool<T>::threadpool(int thread_number, int max_requests) : m_thread_number
 template<typename T>
 threadpool<T>::~threadpool() {
 
-    delete[] m_threads;
+    stop(m_thread_number);
+}
+
+// Wake up the first 'started' workers with the stop flag set, wait for them to end, and free the thread array.
+template<typename T>
+void threadpool<T>::stop(int started) {
+
     m_stop = true;
+
+    // One post per worker: a worker that is processing a request sees the flag when it is done
+    // and consumes a post that nobody else needed.
+    for (int i = 0; i < started; ++i) {
+
+        m_queuestat.post();
+    }
+
+    for (int i = 0; i < started; ++i) {
+
+        pthread_join(m_threads[i], nullptr);
+    }
+
+    delete[] m_threads;
 }
 
 template<typename T>
@@ -114,6 +134,9 @@ void threadpool<T>::run() {
     while (!m_stop) {
 
         m_queuestat.wait();
+
+        if (m_stop) break;
+
         m_queuelocker.lock();
 
         if (m_workqueue.empty()) {
@@ -18,19 +18,49 @@
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <sys/sendfile.h>
+#include <atomic>
 #include "14-2 locker.h"
+#include "15-10 file_cache.h"
+#include "15-11 buffer_pool.h"
+#include "8-4 line_scanner.h"
+#include "15-13 http_header.h"
+#include "15-14 http_response.h"
+
+template<typename T>
+class tw_timer;
 
 class http_conn {
 public:
     // Maximum length of file name.
     static const int FILENAME_LEN = 200;
 
-    // Read buffer size.
+    // Initial read buffer size. The buffer doubles when a request does not fit, up to m_max_read_buffer.
     static const int READ_BUFFER_SIZE = 2048;
 
     // Write buffer size.
     static const int WRITE_BUFFER_SIZE = 1024;
 
+    // Maximum number of pipelined requests answered with one batch of responses.
+    static const int PIPELINE_DEPTH = 16;
+
+    // Maximum number of ranges answered for one Range request. A request asking for more gets the whole file.
+    static const int MAX_RANGES = 8;
+
+    // Maximum number of memory blocks one response may need: a multipart/byteranges response has
+    // a header block and a slice of the file for each part, and the closing boundary.
+    static const int RESPONSE_IOVEC_NUMBER = 2 * MAX_RANGES + 2;
+
+    // Maximum number of memory blocks in one batch of responses: a header block and a body for each,
+    // and room for the last response to be a multipart one.
+    static const int IOVEC_NUMBER = 2 * PIPELINE_DEPTH + RESPONSE_IOVEC_NUMBER;
+
+    // Room the write buffer must have left before another pipelined response is built into it.
+    static const int RESPONSE_RESERVE = 512;
+
+    // Room a multipart/byteranges response needs in the write buffer for its headers and those of its parts.
+    static const int MULTIPART_RESERVE = 256 + 128 * MAX_RANGES;
+
     // HTTP request method, but we only support GET.
     enum METHOD {
 
@@ -62,6 +92,8 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        NOT_MODIFIED,
+        RANGE_NOT_SATISFIABLE,
         INTERNAL_ERROR,
         CLOSED_CONNECTION
     };
@@ -75,12 +107,14 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_timer(nullptr), m_sockfd(-1), m_read_buf(nullptr), m_read_buf_size(0), m_write_buf(nullptr), m_write_buf_size(0),
+        m_file_address(nullptr), m_file(nullptr), m_file_fd(-1), m_file_count(0) {}
     ~http_conn() {}
 
 public:
-    // Initialize newly accepted connections.
-    void init(int sockfd, const sockaddr_in& addr);
+    // Initialize newly accepted connections. 'epollfd' is the epoll kernel event table of the
+    // event loop that accepted the connection; all later events of the connection are registered there.
+    void init(int epollfd, int sockfd, const sockaddr_in& addr);
 
     // close connection.
     void close_conn(bool real_close = true);
@@ -94,10 +128,34 @@ public:
     // non-blocking write operation.
     bool write();
 
+    // Whether the connection is closed, that is, the object is free for the next accepted socket.
+    bool closed() const { return m_sockfd == -1; }
+
+    // Whether write has finished a batch of responses and left pipelined input behind it in the read buffer.
+    // The socket is not re-armed in that case; the caller must hand the connection to the thread pool again.
+    bool pipelined() const { return (m_iv_count == 0) && (m_read_idx > 0); }
+
+    // Whether the connection is waiting for a new request, with nothing of it read yet.
+    bool idle() const { return m_read_idx == 0; }
+
+    // Whether a batch of responses is being sent.
+    bool writing() const { return (m_iv_count > 0) or (m_file_fd >= 0); }
+
+    // Shut the socket down in both directions without closing it. This is safe while a worker owns the connection:
+    // the event loop sees the hang-up once the socket is armed again, and closes the connection itself.
+    void shutdown_conn();
+
+    // Take the socket out of the event loop without closing it, to hand the connection over to another process.
+    // The object is closed; the caller owns the returned socket (-1 if the connection was closed already).
+    int detach();
+
 private:
     // Initialize connection.
     void init();
 
+    // Reset the parser for the next request, which starts at 'm_checked_idx' in the read buffer.
+    void next_request();
+
     // Parse HTTP requests.
     HTTP_CODE process_read();
 
@@ -107,8 +165,18 @@ private:
     // The following set of functions are called by process_read to analyze HTTP requests.
     HTTP_CODE parse_request_line(char* text);
     HTTP_CODE parse_headers(char* text);
-    HTTP_CODE parse_content(char* text);
+    HTTP_CODE parse_content();
     HTTP_CODE do_request();
+    int parse_ranges(const char* spec, off_t size);
+    bool not_modified();
+    void negotiate_coding(unsigned char codings);
+    const char* get_header(HEADER id) const;
+
+    // The read and write buffers are borrowed from the buffer pool while the connection is busy.
+    bool grow_read_buf();
+    bool grow_write_buf();
+    void compact_read_buf();
+    void release_buffers();
 
     char* get_line() {
 
@@ -117,31 +185,64 @@ private:
 
     LINE_STATUS parse_line();
 
+    // The following functions are called by write to advance the output cursor and to finish a response.
+    void advance_iv(size_t bytes);
+    bool finish_response();
+    void release_files();
+
     // The following set of functions are called by process_write to populate the HTTP response.
+    bool can_pipeline();
+    void add_iv(char* base, size_t len);
     void unmap();
-    bool add_response(const char* format, ...);
+    bool add_bytes(const char* data, int len);
+    bool add_decimal(unsigned long long value);
     bool add_content(const char* content);
-    bool add_status_line(int status, const char* title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
-    bool add_linger();
+    bool add_error(RESPONSE_STATUS status);
+    bool add_status_line(RESPONSE_STATUS status);
+    bool add_partial_content(int start);
+    bool add_validators();
+    bool add_coding();
+    bool add_headers(off_t content_length);
+    bool add_content_length(off_t content_length);
+    bool add_content_range(off_t first, off_t last, off_t size);
     bool add_blank_line();
 
+    // Append a string literal; its length is known at compile time.
+    template<int N>
+    bool add_literal(const char (&text)[N]) {
+
+        return add_bytes(text, N - 1);
+    }
+
 public:
-    // All events on the socket are registered in the same epoll kernel event table,
-    // so the epoll file descriptor is set to static.
-    static int m_epollfd;
+    // Count the number of users. It is shared by all event loops, so it is updated atomically.
+    static std::atomic<int> m_user_count;
+
+    // Files of at least this many bytes are sent with sendfile instead of writev from their mapping.
+    static off_t m_sendfile_threshold;
+
+    // The largest the read buffer may grow to. Requests whose headers do not fit are rejected.
+    static int m_max_read_buffer;
+
+    // Set when the server shuts down: every response is then sent with "Connection: close",
+    // so that the connections end after the request they are processing.
+    static std::atomic<bool> m_draining;
 
-    // Count the number of users.
-    static int m_user_count;
+    // The timeout timer of the connection in the time wheel of its event loop, which alone creates, moves and deletes it.
+    tw_timer<http_conn>* m_timer;
 
 private:
+    // The epoll kernel event table of the event loop that owns this connection.
+    // Each event loop has its own table, so there is no epoll traffic between loops.
+    int m_epollfd;
+
     // The socket of the HTTP connection and the other party’s socket address.
     int m_sockfd;
     sockaddr_in m_address;
 
-    // read buffer.
-    char m_read_buf[READ_BUFFER_SIZE];
+    // read buffer, borrowed from the buffer pool on the first read, and its size.
+    char* m_read_buf;
+    int m_read_buf_size;
 
     // Identifies the next position in the read buffer of the last byte of customer data that has been read.
     int m_read_idx;
@@ -152,8 +253,15 @@ private:
     // The starting position of the line currently being parsed.
     int m_start_line;
 
-    // write buffer.
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    // The end of the last line found by parse_line, where its '\r' was replaced by '\0'.
+    char* m_line_end;
+
+    // The starting position of the request currently being parsed. Everything before it has been answered.
+    int m_request_start;
+
+    // write buffer, borrowed from the buffer pool when a response is built, and its size.
+    char* m_write_buf;
+    int m_write_buf_size;
 
     // Number of bytes in the write buffer to be sent.
     int m_write_idx;
@@ -174,8 +282,9 @@ private:
     // HTTP protocol version number, we only support HTTP/1.1.
     char* m_version;
 
-    // Hostname.
-    char* m_host;
+    // The values of the header fields the server knows, indexed by HEADER, as spans relative to 'm_request_start'.
+    // Hostname is m_headers[HEADER_HOST]. An offset of 0 means the field is absent, since the request line comes first.
+    header_span m_headers[HEADER_NUMBER];
 
     // The length of the HTTP request message body.
     int m_content_length;
@@ -183,17 +292,56 @@ private:
     // Does the HTTP request require the connection to be kept alive?
     bool m_linger;
 
+    // Whether the connection stays open once the batch of responses being sent is finished,
+    // that is, whether the last request answered in the batch asked for keep-alive.
+    bool m_keep_alive;
+
     // The target file requested by the client is mmapped to the starting location in memory.
     char* m_file_address;
 
+    // The entry of the target file in the shared file cache, which owns the mapping above.
+    // The connection holds a reference to it until the response has been sent.
+    file_entry* m_file;
+
+    // For a file sent with sendfile: the descriptor shared through the file cache (or -1 if the file is
+    // sent from its mapping), and the offset of the next byte of the file to send.
+    // A response sent with sendfile is always the last one of its batch.
+    int m_file_fd;
+    off_t m_file_offset;
+    off_t m_file_end;
+
+    // The file cache entries of the responses in the batch being sent, released once it has been sent.
+    file_entry* m_files[PIPELINE_DEPTH];
+    int m_file_count;
+
+    // The byte ranges the request asked for, satisfiable and clipped to the file, in the order given.
+    // 'm_range_count' is 0 when the whole file is sent.
+    struct byte_range {
+
+        off_t first;
+        off_t last;
+    };
+
+    byte_range m_ranges[MAX_RANGES];
+    int m_range_count;
+
+    // The content coding of the precompressed sidecar file sent in place of the requested file, or -1 if the file
+    // itself is sent, and whether the file has sidecars at all, in which case every response for it carries Vary.
+    int m_coding;
+    bool m_vary;
+
     // The status of the target file. Through it, we can determine whether the file exists,
     // whether it is a directory, whether it is readable, and obtain information such as file size.
     struct stat m_file_stat;
 
-    // We will use writev to perform write operations, so define the following two members,
+    // We will use writev to perform write operations, so define the following members,
     // where 'm_iv_count' represents the number of memory blocks written.
-    struct iovec m_iv[2];
+    // The blocks of all responses in a batch follow each other, so pipelined responses leave in as few writev calls as possible.
+    // Together with 'm_file_offset' they form the output cursor of the batch: 'm_iv_idx' is the first block
+    // that is not completely sent yet, and the blocks before it are consumed by moving their base and length.
+    struct iovec m_iv[IOVEC_NUMBER];
     int m_iv_count;
+    int m_iv_idx;
 };
 
 #endif
\ No newline at end of file
@@ -1,17 +1,6 @@
 #include "15-4 http_conn.h"
 #include <sys/uio.h>
 
-// Define some status information of the HTTP response.
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form = "Your Request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form = "There was an unusual problem serving the requested file.\n";
-
 // The root directory of the website.
 const char* doc_root = "/var/www/html";
 
@@ -25,6 +14,8 @@ int setnonblocking(int fd) {
     return old_option;
 }
 
+// Register 'fd' for input. The descriptor must already be nonblocking: the server creates all of its sockets with
+// SOCK_NONBLOCK (and its timerfds with TFD_NONBLOCK), which saves two fcntl calls per connection.
 void addfd(int epollfd, int fd, bool one_shot) {
 
     epoll_event event;
@@ -38,7 +29,6 @@ void addfd(int epollfd, int fd, bool one_shot) {
     }
 
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
 }
 
 void removefd(int epollfd, int fd) {
@@ -58,30 +48,62 @@ void modfd(int epollfd, int fd, int ev) {
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
+off_t http_conn::m_sendfile_threshold = 256 * 1024;
+int http_conn::m_max_read_buffer = 64 * 1024;
+std::atomic<bool> http_conn::m_draining(false);
 
 void http_conn::close_conn(bool real_close) {
 
+    // A response that was cut short still holds references to its files.
+    release_files();
+    release_buffers();
+
     if (real_close && (m_sockfd != -1)) {
 
-        removefd(m_epollfd, m_sockfd);
+        // The object is done with before the descriptor is closed: once it is, another event loop may accept
+        // a connection with the same number and init this object again.
+        int sockfd = m_sockfd;
 
         m_sockfd = -1;
         --m_user_count;  // When closing a connection, reduce the total number of customers by 1.
+
+        removefd(m_epollfd, sockfd);
+    }
+}
+
+int http_conn::detach() {
+
+    release_files();
+    release_buffers();
+
+    int sockfd = m_sockfd;
+
+    if (sockfd != -1) {
+
+        m_sockfd = -1;
+        --m_user_count;
+
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, sockfd, 0);
     }
+
+    return sockfd;
 }
 
-void http_conn::init(int sockfd, const sockaddr_in& addr) {
+void http_conn::shutdown_conn() {
+
+    if (m_sockfd != -1) {
 
+        shutdown(m_sockfd, SHUT_RDWR);
+    }
+}
+
+void http_conn::init(int epollfd, int sockfd, const sockaddr_in& addr) {
+
+    m_epollfd = epollfd;
     m_sockfd = sockfd;
     m_address = addr;
 
-    // The following two lines are to avoid the TIME_WAIT state.
-    // They are only used for debugging and should be removed in actual use.
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-
     addfd(m_epollfd, sockfd, true);
 
     ++m_user_count;
@@ -91,6 +113,20 @@ void http_conn::init(int sockfd, const sockaddr_in& addr) {
 
 void http_conn::init() {
 
+    m_checked_idx = 0;
+    m_read_idx = 0;
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_keep_alive = false;
+
+    next_request();
+}
+
+// The input before 'm_checked_idx' has been answered (or is about to be), the next request starts there.
+// The read buffer itself is left alone: pipelined bytes behind the previous request are kept.
+void http_conn::next_request() {
+
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
 
@@ -98,69 +134,152 @@ void http_conn::init() {
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
-    m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_range_count = 0;
+    m_coding = -1;
+    m_vary = false;
+    m_start_line = m_checked_idx;
+    m_request_start = m_checked_idx;
+
+    memset(m_headers, '\0', sizeof(m_headers));
+    memset(m_real_file, '\0', FILENAME_LEN);
+}
+
+// Double the read buffer, keeping its contents and the parse pointers into it.
+// Returns false if the buffer has already reached m_max_read_buffer.
+bool http_conn::grow_read_buf() {
+
+    if (m_read_buf_size >= m_max_read_buffer) return false;
+
+    int size = 0;
+    char* buf = buffer_pool::instance()->acquire(m_read_buf_size * 2, &size);
+
+    if (!buf) return false;
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);    
+    memcpy(buf, m_read_buf, m_read_idx);
+
+    // The request line may already have been parsed, move the pointers into it along with the data.
+    if (m_url) m_url = buf + (m_url - m_read_buf);
+    if (m_version) m_version = buf + (m_version - m_read_buf);
+
+    buffer_pool::instance()->release(m_read_buf, m_read_buf_size);
+
+    m_read_buf = buf;
+    m_read_buf_size = size;
+
+    return true;
 }
 
-// slave state machine, please refer to Section 8.6 for its analysis and will not be repeated here.
-http_conn::LINE_STATUS http_conn::parse_line() {
+// Move the input that has not been answered yet, which starts with the request being parsed,
+// to the front of the read buffer, keeping the parse pointers into it.
+void http_conn::compact_read_buf() {
 
-    char temp;
+    int shift = m_request_start;
 
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx) {
+    if (shift == 0) return;
 
-        temp = m_read_buf[m_checked_idx];
+    memmove(m_read_buf, m_read_buf + shift, m_read_idx - shift);
 
-        if (temp == '\r') {
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_request_start = 0;
 
-            if ((m_checked_idx + 1) == m_read_idx) {
+    if (m_url) m_url -= shift;
+    if (m_version) m_version -= shift;
+}
 
-                return LINE_OPEN;
-            }
-            else if (m_read_buf[m_checked_idx + 1] == '\n') {
+// Double the write buffer, keeping its contents and the memory blocks that point into it.
+bool http_conn::grow_write_buf() {
 
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+    int size = 0;
+    char* buf = buffer_pool::instance()->acquire(m_write_buf_size * 2, &size);
 
-                return LINE_OK;
-            }
+    if (!buf) return false;
+
+    memcpy(buf, m_write_buf, m_write_idx);
+
+    for (int i = 0; i < m_iv_count; ++i) {
+
+        char* base = (char*) m_iv[i].iov_base;
 
-            return LINE_BAD;
+        if ((base >= m_write_buf) && (base < m_write_buf + m_write_buf_size)) {
+
+            m_iv[i].iov_base = buf + (base - m_write_buf);
         }
-        else if (temp == '\n') {
+    }
 
-            if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r')) {
+    buffer_pool::instance()->release(m_write_buf, m_write_buf_size);
 
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+    m_write_buf = buf;
+    m_write_buf_size = size;
 
-                return LINE_OK;
-            }
+    return true;
+}
+
+// Give the buffers back to the pool. An idle connection then costs only the http_conn object itself.
+void http_conn::release_buffers() {
 
-            return LINE_BAD;
+    buffer_pool* pool = buffer_pool::instance();
+
+    pool->release(m_read_buf, m_read_buf_size);
+    pool->release(m_write_buf, m_write_buf_size);
+
+    m_read_buf = m_write_buf = nullptr;
+    m_read_buf_size = m_write_buf_size = 0;
+}
+
+// slave state machine, please refer to Section 8.6 for its analysis and will not be repeated here.
+// The bytes up to the next '\r' or '\n' are skipped by the vectorized scanner rather than examined one by one.
+// 'm_checked_idx' is left at the first byte not yet scanned, so a line split across reads is resumed, not rescanned.
+http_conn::LINE_STATUS http_conn::parse_line() {
+
+    m_checked_idx = scan_line_end(m_read_buf + m_checked_idx, m_read_buf + m_read_idx) - m_read_buf;
+
+    if (m_checked_idx == m_read_idx) {
+
+        return LINE_OPEN;
+    }
+
+    if (m_read_buf[m_checked_idx] == '\r') {
+
+        if ((m_checked_idx + 1) == m_read_idx) {
+
+            return LINE_OPEN;
         }
+        else if (m_read_buf[m_checked_idx + 1] == '\n') {
+
+            m_line_end = m_read_buf + m_checked_idx;
+
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+
+            return LINE_OK;
+        }
+
+        return LINE_BAD;
     }
 
-    return LINE_OPEN;
+    // A '\n' that is not preceded by '\r'. The scanner stops at a '\r' first, and a '\r' that ends the input
+    // is left unconsumed above, so a "\r\n" split across reads is completed there once the '\n' arrives.
+    return LINE_BAD;
 }
 
 // Read customer data in a loop until there is no data to read or the other party closes the connection.
 bool http_conn::read() {
 
-    if (m_read_idx >= READ_BUFFER_SIZE) return false;
+    if (!m_read_buf) {
+
+        m_read_buf = buffer_pool::instance()->acquire(READ_BUFFER_SIZE, &m_read_buf_size);
+    }
 
     int bytes_read = 0;
 
     while (true) {
 
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        // Grow the buffer for a request with large headers, as long as it stays within the limit.
+        if ((m_read_idx >= m_read_buf_size) && !grow_read_buf()) return false;
+
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_buf_size - m_read_idx, 0);
 
         if (bytes_read == -1) {
 
@@ -182,9 +301,9 @@ bool http_conn::read() {
 // Parse the HTTP request line to obtain the request method, target URL, and HTTP version number.
 http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
 
-    m_url = strpbrk(text, " \t");
+    m_url = (char*) scan_blank(text, m_line_end);
 
-    if (!m_url) {
+    if (m_url == m_line_end) {
 
         return BAD_REQUEST;
     }
@@ -202,16 +321,16 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
         return BAD_REQUEST;
     }
 
-    m_url += strspn(m_url, "\t");
-    m_version = strpbrk(m_url, "\t");
+    m_url += strspn(m_url, " \t");
+    m_version = (char*) scan_blank(m_url, m_line_end);
 
-    if (!m_version) {
+    if (m_version == m_line_end) {
 
         return BAD_REQUEST;
     }
 
     *m_version++ = '\0';
-    m_version += strspn(m_version, "\t");
+    m_version += strspn(m_version, " \t");
 
     if (strcasecmp(m_version, "HTTP/1.1") != 0) {
 
@@ -252,45 +371,98 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
         // Otherwise it means we have got a complete HTTP request.
         return GET_REQUEST;
     }
-    // Processing Connection header fields.
-    else if (strncasecmp(text, "Connection:", 11) == 0) {
 
-        text += 11;
-        text += strspn(text, "\t");
+    char* colon = (char*) scan_either(text, m_line_end, ':', ':');
 
-        if (strcasecmp(text, "keep-alive") == 0) {
+    // A field without a colon is skipped like an unknown one.
+    if (colon == m_line_end) {
 
-            m_linger = true;
-        }
+        return NO_REQUEST;
     }
-    // Processing the Content-Length header field.
-    else if (strncasecmp(text, "Content-Length:", 15) == 0) {
 
-        text += 15;
-        text += strspn(text, "\t");
-        m_content_length = atol(text);
+    HEADER id = lookup_header(text, colon - text);
+
+    if (id == HEADER_UNKNOWN) {
+
+        return NO_REQUEST;
     }
-    // Processing the Host header field.
-    else if (strncasecmp(text, "Host:", 5) == 0) {
 
-        text += 5;
-        text += strspn(text, "\t");
-        m_host = text;
+    // The value without the blanks around it.
+    char* value = colon + 1;
+    value += strspn(value, " \t");
+
+    char* end = m_line_end;
+
+    while ((end > value) && ((end[-1] == ' ') or (end[-1] == '\t'))) {
+
+        *--end = '\0';
     }
-    else {
 
-        printf("oop! unknow header %s\n", text);
+    m_headers[id].offset = value - (m_read_buf + m_request_start);
+    m_headers[id].length = end - value;
+
+    switch (id) {
+
+        // Processing Connection header fields.
+        case HEADER_CONNECTION: {
+
+            if (strcasecmp(value, "keep-alive") == 0) {
+
+                m_linger = true;
+            }
+
+            break;
+        }
+        // Processing the Content-Length header field.
+        // The body is skipped by moving the parse position past it, so the length must be a plain number that
+        // keeps it inside the read buffer: a negative or wrapped one would move it before the start of the buffer.
+        case HEADER_CONTENT_LENGTH: {
+
+            char* digits_end = nullptr;
+
+            errno = 0;
+            long long length = strtoll(value, &digits_end, 10);
+
+            if ((digits_end == value) or (*digits_end != '\0') or (errno == ERANGE) or (length < 0)
+                or (length > m_max_read_buffer - m_checked_idx)) {
+
+                return BAD_REQUEST;
+            }
+
+            m_content_length = length;
+            break;
+        }
+        // A body in a transfer coding (chunked) can not be delimited by this parser,
+        // and guessing its end would answer the next pipelined request from the middle of it.
+        case HEADER_TRANSFER_ENCODING: {
+
+            return BAD_REQUEST;
+        }
+        // The others are only recorded, for do_request and process_write to look at.
+        default: {
+
+            break;
+        }
     }
 
     return NO_REQUEST;
 }
 
+// The value of a header field of the request being parsed, or nullptr if the request does not have it.
+const char* http_conn::get_header(HEADER id) const {
+
+    if (m_headers[id].offset == 0) return nullptr;
+
+    return m_read_buf + m_request_start + m_headers[id].offset;
+}
+
 // We don't actually parse the message body of the HTTP request, we just determine whether it has been completely read.
-http_conn::HTTP_CODE http_conn::parse_content(char* text) {
+// The body is then skipped, so that a request pipelined behind it starts at 'm_checked_idx'.
+http_conn::HTTP_CODE http_conn::parse_content() {
 
     if (m_read_idx >= (m_content_length + m_checked_idx)) {
 
-        text[m_content_length] = '\0';
+        m_checked_idx += m_content_length;
 
         return GET_REQUEST;
     }
@@ -305,13 +477,13 @@ http_conn::HTTP_CODE http_conn::process_read() {
     HTTP_CODE ret = NO_REQUEST;
     char* text = 0;
 
-    while (((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK)) or ((line_status = parse_line()) == LINE_OK)) {
+    // The message body is not made of lines: while it is incomplete, parse_line must not scan into it,
+    // or the end of the body, and with it the start of the next pipelined request, would be lost.
+    while ((m_check_state == CHECK_STATE_CONTENT) ? (line_status == LINE_OK) : ((line_status = parse_line()) == LINE_OK)) {
 
         text = get_line();
         m_start_line = m_checked_idx;
 
-        printf("got 1 http line: %s\n", text);
-
         switch (m_check_state) {
 
             case CHECK_STATE_REQUESTLINE: {
@@ -342,7 +514,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
             }
             case CHECK_STATE_CONTENT: {
 
-                ret = parse_content(text);
+                ret = parse_content();
 
                 if (ret == GET_REQUEST) {
 
@@ -365,7 +537,8 @@ http_conn::HTTP_CODE http_conn::process_read() {
 
 // When we get a complete and correct HTTP request, we analyze the properties of the target file.
 // If the target file exists, is readable by all users, and is not a directory,
-// use mmap to map it to the memory address 'm_file_address' and tell the caller to obtain the file successfully.
+// get its mapping at the memory address 'm_file_address' and tell the caller to obtain the file successfully.
+// The status and the mapping come from the shared file cache, so a hot file costs no system call here.
 http_conn::HTTP_CODE http_conn::do_request() {
 
     strcpy(m_real_file, doc_root);
@@ -373,18 +546,28 @@ http_conn::HTTP_CODE http_conn::do_request() {
     int len = strlen(doc_root);
     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
-    // Obtain the relevant information of the m_real_file file 
-    // by calling the stat function and save the result in the m_file_stat structure.
-    if (stat(m_real_file, &m_file_stat) < 0) {
+    file_cache* cache = file_cache::instance();
+
+    // Obtain the relevant information of the m_real_file file from the cache, which calls stat
+    // only on a miss or when the cached status is older than its TTL, and save it in the m_file_stat structure.
+    // The codings are copied under the lock of the cache, as a re-validation by another thread may update them.
+    unsigned char codings = 0;
+
+    m_file = cache->acquire(m_real_file, true, &codings);
+
+    if (!m_file) {
 
         return NO_RESOURCE;
     }
 
+    m_file_stat = m_file->st;
+
     // By determining whether the S_IROTH bit in m_file_stat.st_mode is set,
     // determine whether other users have permission to read the file.
     // If there is no read permission, returns FORBIDDEN_REQUEST.
     if (!(m_file_stat.st_mode & S_IROTH)) {
 
+        unmap();
         return FORBIDDEN_REQUEST;
     }
 
@@ -392,47 +575,319 @@ http_conn::HTTP_CODE http_conn::do_request() {
     // If it is a directory, BAD_REQUEST is returned.
     if (S_ISDIR(m_file_stat.st_mode)) {
 
+        unmap();
         return BAD_REQUEST;
     }
 
-    // First, open the m_real_file file in read-only mode by calling
-    // the open function and save the returned file descriptor in the fd variable.
-    int fd = open(m_real_file, O_RDONLY);
+    // A file with precompressed sidecars is served as the best one the client accepts. From here on m_file
+    // is the sidecar, so the validators, ranges and Content-Length below are those of the encoded bytes.
+    if (codings) {
+
+        m_vary = true;
+        negotiate_coding(codings);
+    }
+
+    // A client revalidating its cached copy gets a 304 decided from the cached status alone:
+    // the file is neither opened nor mapped. The entry stays referenced for its validators.
+    if (not_modified()) {
 
-    // Then, the file is mapped into memory by calling the mmap function. The parameters of the mmap function are: the starting address is 0 
-    // (let the system automatically select the appropriate address), the mapping length is m_file_stat.st_size (the size of the file),
-    // the protection flag is PROT_READ (read-only), and the mapping type is MAP_PRIVATE (Private mapping, modifications to the mapping will
-    // not affect the original file), the file descriptor is fd, and the offset is 0.
-    m_file_address = (char*) mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        return NOT_MODIFIED;
+    }
 
-    // Finally, the file descriptor fd is closed by calling the close function.
-    // Because the file has been mapped into memory,
-    // the file descriptor is no longer needed to access the file.
-    close(fd);
+    // A Range request is answered with only the parts of the file it asks for. A Range field that can not
+    // be parsed or asks for too many parts is ignored, and the whole file is sent.
+    const char* range = get_header(HEADER_RANGE);
+
+    if (range) {
+
+        int count = parse_ranges(range, m_file_stat.st_size);
+
+        if (count == 0) {
+
+            unmap();
+            return RANGE_NOT_SATISFIABLE;
+        }
+
+        m_range_count = (count > 0) ? count : 0;
+    }
+
+    // A large file is sent with sendfile, which copies the pages straight from the page cache to the socket
+    // instead of faulting the whole mapping in through user space. It only needs the shared descriptor.
+    // A single range is sent the same way from its first byte; several ranges are interleaved with the
+    // headers of their parts, so they are sent as slices of the mapping instead.
+    if ((m_file_stat.st_size >= m_sendfile_threshold) && (m_range_count <= 1)) {
+
+        m_file_fd = cache->open_fd(m_file);
+        m_file_offset = (m_range_count == 1) ? m_ranges[0].first : 0;
+        m_file_end = (m_range_count == 1) ? m_ranges[0].last + 1 : m_file_stat.st_size;
+
+        if (m_file_fd < 0) {
+
+            unmap();
+            return INTERNAL_ERROR;
+        }
+
+        return FILE_REQUEST;
+    }
+
+    // The cache opens the file, maps it read-only and private with mmap, and closes the descriptor
+    // the first time any response needs the contents; later responses share that mapping.
+    m_file_address = cache->map(m_file);
+
+    if (!m_file_address && (m_file_stat.st_size != 0)) {
+
+        unmap();
+        return INTERNAL_ERROR;
+    }
 
     return FILE_REQUEST;
 }
 
-// Perform munmap operation on memory mapped area.
+// Whether the Accept-Encoding field 'value' accepts the content coding 'name' (RFC 9110, section 12.5.3):
+// the coding is listed, or "*" is and the coding is not, with a quality other than 0.
+static bool accepts_coding(const char* value, const char* name) {
+
+    int listed = -1;     // Whether the coding itself is acceptable: -1 if it is not listed.
+    int wildcard = -1;   // The same for "*".
+
+    int name_len = strlen(name);
+
+    for (const char* p = value; *p; ) {
+
+        p += strspn(p, " \t,");
+
+        int len = strcspn(p, " \t,;");
+        const char* end = p + strcspn(p, ",");
+
+        // Of the parameters of the element only the quality matters; without one it is 1.
+        bool zero = false;
+
+        for (const char* q = p + len; q < end; q += strcspn(q, ";,")) {
+
+            q += strspn(q, " \t;");
+
+            if (((*q == 'q') or (*q == 'Q')) && (q[1] == '=')) {
+
+                zero = (atof(q + 2) <= 0);
+            }
+        }
+
+        if ((len == name_len) && (strncasecmp(p, name, len) == 0)) {
+
+            listed = !zero;
+        }
+        else if ((len == 1) && (*p == '*')) {
+
+            wildcard = !zero;
+        }
+
+        p = end;
+    }
+
+    return (listed >= 0) ? listed : (wildcard > 0);
+}
+
+// Replace the requested file by its preferred sidecar file among 'codings' that the client accepts, if any.
+// The sidecar's status comes from the file cache too, so a hot file is negotiated without a system call.
+void http_conn::negotiate_coding(unsigned char codings) {
+
+    const char* accept = get_header(HEADER_ACCEPT_ENCODING);
+
+    if (!accept) return;
+
+    file_cache* cache = file_cache::instance();
+
+    int len = strlen(m_real_file);
+
+    for (int i = 0; i < CODING_NUMBER; ++i) {
+
+        if (!(codings & (1 << i)) or !accepts_coding(accept, coding_names[i])) continue;
+
+        if (len + strlen(coding_suffixes[i]) >= (size_t) FILENAME_LEN) return;
+
+        strcpy(m_real_file + len, coding_suffixes[i]);
+
+        // The sidecar may have disappeared since the entry of the file looked for it.
+        file_entry* sidecar = cache->acquire(m_real_file, false);
+
+        if (sidecar && S_ISREG(sidecar->st.st_mode) && (sidecar->st.st_mode & S_IROTH)) {
+
+            cache->release(m_file);
+
+            m_file = sidecar;
+            m_file_stat = sidecar->st;
+            m_coding = i;
+
+            return;
+        }
+
+        cache->release(sidecar);
+        m_real_file[len] = '\0';
+    }
+}
+
+// Evaluate the conditional fields against the file (RFC 9110, section 13.2.2). If-None-Match, when present,
+// decides alone: the client's copy is current if any of its entity tags is ours, compared weakly.
+// Otherwise If-Modified-Since holds if the file has not changed since the given date.
+bool http_conn::not_modified() {
+
+    const char* tags = get_header(HEADER_IF_NONE_MATCH);
+
+    if (tags) {
+
+        if (strcmp(tags, "*") == 0) return true;
+
+        int len = strlen(m_file->etag);
+
+        for (const char* p = tags; *p; ) {
+
+            p += strspn(p, " \t,");
+
+            // A weak tag matches a strong one with the same opaque value.
+            if (strncmp(p, "W/", 2) == 0) p += 2;
+
+            if ((strncmp(p, m_file->etag, len) == 0) && ((p[len] == '\0') or (p[len] == ',') or (p[len] == ' ') or (p[len] == '\t'))) {
+
+                return true;
+            }
+
+            p += strcspn(p, ",");
+        }
+
+        return false;
+    }
+
+    const char* since = get_header(HEADER_IF_MODIFIED_SINCE);
+
+    if (since) {
+
+        struct tm tm;
+        memset(&tm, '\0', sizeof(tm));
+
+        // Only the IMF-fixdate form is understood; a date that does not parse is ignored.
+        const char* end = strptime(since, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+        if (end && (*end == '\0')) {
+
+            return m_file_stat.st_mtim.tv_sec <= timegm(&tm);
+        }
+    }
+
+    return false;
+}
+
+// Parse the value of a Range field, "bytes=" followed by a comma separated list of "first-last", "first-"
+// and "-suffix_length" ranges, against a file of 'size' bytes. The satisfiable ranges are clipped to the file
+// and stored in m_ranges. Returns their number, 0 if none of the ranges is satisfiable, or -1 if the field
+// must be ignored: a syntax error, a unit other than bytes, or more than MAX_RANGES ranges.
+int http_conn::parse_ranges(const char* spec, off_t size) {
+
+    if (strncasecmp(spec, "bytes=", 6) != 0) return -1;
+
+    const char* p = spec + 6;
+    int count = 0;
+    int total = 0;
+
+    while (true) {
+
+        p += strspn(p, " \t");
+
+        off_t first = -1;
+        off_t last = -1;
+
+        // Read the two numbers, either of which may be missing but not both.
+        for (int i = 0; i < 2; ++i) {
+
+            if ((*p >= '0') && (*p <= '9')) {
+
+                off_t n = 0;
+
+                for (; (*p >= '0') && (*p <= '9'); ++p) {
+
+                    // Refuse numbers that do not fit, rather than wrap around.
+                    if (n > (((off_t) 1 << 62) - 1) / 10) return -1;
+
+                    n = n * 10 + (*p - '0');
+                }
+
+                (i == 0 ? first : last) = n;
+            }
+
+            if ((i == 0) && (*p++ != '-')) return -1;
+        }
+
+        if (((first < 0) && (last < 0)) or ((last >= 0) && (first > last))) return -1;
+
+        if (++total > MAX_RANGES) return -1;
+
+        // A suffix range asks for the last 'last' bytes.
+        if (first < 0) {
+
+            first = (last < size) ? size - last : 0;
+            last = size - 1;
+
+            if (first > last) first = size;
+        }
+        else if ((last < 0) or (last >= size)) {
+
+            last = size - 1;
+        }
+
+        // Ranges that start beyond the end of the file are left out; if no range remains, the request gets a 416.
+        if (first < size) {
+
+            m_ranges[count].first = first;
+            m_ranges[count].last = last;
+
+            ++count;
+        }
+
+        p += strspn(p, " \t");
+
+        if (*p == '\0') break;
+
+        if (*p++ != ',') return -1;
+    }
+
+    return count;
+}
+
+// Give the mapped file of the request being answered back to the file cache. The mapping itself is only
+// removed with munmap once the cache has evicted the file and no other response is using it.
 void http_conn::unmap() {
 
-    if (m_file_address) {
+    if (m_file) {
+
+        file_cache::instance()->release(m_file);
 
-        // Frees the memory space occupied by a file that was previously
-        // mapped into memory so that other programs can use the memory space.
-        munmap(m_file_address, m_file_stat.st_size);
+        m_file = nullptr;
         m_file_address = 0;
+        m_file_fd = -1;
     }
 }
 
-// Write HTTP response.
+// Give back the files of all responses in the batch.
+void http_conn::release_files() {
+
+    unmap();
+
+    for (int i = 0; i < m_file_count; ++i) {
+
+        file_cache::instance()->release(m_files[i]);
+    }
+
+    m_file_count = 0;
+    m_file_fd = -1;
+}
+
+// Write HTTP responses. The batch is the memory blocks m_iv[m_iv_idx..m_iv_count), followed by the rest of
+// the file from 'm_file_offset' when its last response is sent with sendfile. Every byte the kernel accepts moves
+// the cursor, so the batch continues at exactly the right byte after any number of short writes and EPOLLOUT wakeups.
 bool http_conn::write() {
 
     int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
 
-    if (bytes_to_send == 0) {
+    if ((m_iv_idx >= m_iv_count) && (m_file_fd < 0)) {
 
         modfd(m_epollfd, m_sockfd, EPOLLIN);   
         init();
@@ -440,9 +895,9 @@ bool http_conn::write() {
         return true;
     }
 
-    while (1) {
+    while (m_iv_idx < m_iv_count) {
 
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        temp = writev(m_sockfd, m_iv + m_iv_idx, m_iv_count - m_iv_idx);
 
         if (temp <= -1) {
 
@@ -455,142 +910,302 @@ bool http_conn::write() {
                 return true;
             }
 
-            unmap();
+            release_files();
             return false;
         }
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
+        advance_iv(temp);
+    }
 
-        if (bytes_to_send <= bytes_have_send) {
+    while ((m_file_fd >= 0) && (m_file_offset < m_file_end)) {
 
-            // The HTTP response is sent successfully, and it is decided whether to close the connection immediately
-            // based on the Connection field in the HTTP request.
-            unmap();
+        // sendfile advances m_file_offset itself and leaves the file position of the shared descriptor alone.
+        temp = sendfile(m_sockfd, m_file_fd, &m_file_offset, m_file_end - m_file_offset);
 
-            if (m_linger) {
+        if (temp <= -1) {
 
-                init();
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
+            if (errno == EAGAIN) {
 
+                modfd(m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
-            else {
 
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
-                return false;
-            } 
+            release_files();
+            return false;
+        }
+
+        // The file was truncated after we took its size, the promised Content-Length can not be met.
+        if (temp == 0) {
+
+            release_files();
+            return false;
         }
     }
+
+    return finish_response();
 }
 
-// Write data to be sent into the write buffer.
-bool http_conn::add_response(const char* format, ...) {
+// Consume 'bytes' sent bytes from the front of the memory blocks. Fully sent blocks are skipped,
+// a partially sent block is shrunk in place, so nothing is ever copied.
+void http_conn::advance_iv(size_t bytes) {
 
-    if (m_write_idx >= WRITE_BUFFER_SIZE) return false;
+    while ((bytes > 0) && (m_iv_idx < m_iv_count)) {
 
-    va_list arg_list;
-    va_start(arg_list, format);
+        if (bytes >= m_iv[m_iv_idx].iov_len) {
 
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+            bytes -= m_iv[m_iv_idx].iov_len;
+            m_iv[m_iv_idx].iov_len = 0;
 
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) return false;
+            ++m_iv_idx;
+        }
+        else {
 
-    m_write_idx += len;
+            m_iv[m_iv_idx].iov_base = (char*) m_iv[m_iv_idx].iov_base + bytes;
+            m_iv[m_iv_idx].iov_len -= bytes;
 
-    va_end(arg_list);
+            bytes = 0;
+        }
+    }
+
+    // Skip empty blocks so the cursor always points at data still to be sent.
+    while ((m_iv_idx < m_iv_count) && (m_iv[m_iv_idx].iov_len == 0)) {
+
+        ++m_iv_idx;
+    }
+}
+
+// The batch of HTTP responses is sent successfully, and it is decided whether to close the connection immediately
+// based on the Connection field in the last request answered.
+bool http_conn::finish_response() {
+
+    release_files();
+
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+
+    if (m_keep_alive && (m_request_start < m_read_idx)) {
+
+        // More requests were pipelined behind the batch, or have started to arrive. Keep them, moved to the front
+        // of the buffer, and leave the socket disarmed: the caller sees pipelined() and queues the connection again.
+        compact_read_buf();
+
+        return true;
+    }
+    else if (m_keep_alive) {
+
+        // The keep-alive connection is idle now, it does not need its buffers until the next request arrives.
+        init();
+        release_buffers();
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
+
+        return true;
+    }
+    else {
+
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        return false;
+    } 
+}
+
+// Append 'len' bytes to the write buffer. Returns false if they do not fit.
+bool http_conn::add_bytes(const char* data, int len) {
+
+    if (len > m_write_buf_size - m_write_idx) return false;
+
+    memcpy(m_write_buf + m_write_idx, data, len);
+    m_write_idx += len;
 
     return true;
 }
 
-bool http_conn::add_status_line(int status, const char* title) {
+// Append 'value' in decimal.
+bool http_conn::add_decimal(unsigned long long value) {
+
+    if (m_write_buf_size - m_write_idx < 20) return false;
+
+    m_write_idx = write_decimal(m_write_buf + m_write_idx, value) - m_write_buf;
 
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    return true;
 }
 
-bool http_conn::add_headers(int content_len) {
+// The status line and the Connection field come from the templates, followed by the Date field.
+bool http_conn::add_status_line(RESPONSE_STATUS status) {
 
-    add_content_length(content_len);
+    header_block block = response_templates::instance().status(status, m_linger);
 
-    add_linger();
-    add_blank_line();
+    return add_bytes(block.data, block.length) && add_bytes(date_field(), DATE_FIELD_LENGTH);
 }
 
-bool http_conn::add_content_length(int content_len) {
+// The fields that end every response with a body. The Connection field is part of the status line template.
+bool http_conn::add_headers(off_t content_len) {
 
-    return add_response("Content-Length: %d\r\n", content_len);
+    return add_content_length(content_len) && add_blank_line();
 }
 
-bool http_conn::add_linger() {
+bool http_conn::add_content_length(off_t content_len) {
 
-    return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    return add_literal("Content-Length: ") && add_decimal(content_len) && add_literal("\r\n");
+}
+
+bool http_conn::add_content_range(off_t first, off_t last, off_t size) {
+
+    return add_literal("Content-Range: bytes ") && add_decimal(first) && add_literal("-") && add_decimal(last) &&
+           add_literal("/") && add_decimal(size) && add_literal("\r\n");
 }
 
 bool http_conn::add_blank_line() {
 
-    return add_response("%s", "\r\n");
+    return add_literal("\r\n");
+}
+
+// The validators of the file being sent, which the client can send back in If-None-Match and If-Modified-Since.
+bool http_conn::add_validators() {
+
+    return add_bytes(m_file->validators, m_file->validators_length);
+}
+
+// The content coding of a precompressed response, and Vary on every response for a file that has sidecars,
+// so that shared caches keep the encoded and the plain responses apart.
+bool http_conn::add_coding() {
+
+    if (m_coding >= 0) {
+
+        if (!(add_literal("Content-Encoding: ") && add_bytes(coding_names[m_coding], strlen(coding_names[m_coding])) && add_literal("\r\n"))) {
+
+            return false;
+        }
+    }
+
+    return !m_vary or add_literal("Vary: Accept-Encoding\r\n");
 }
 
 bool http_conn::add_content(const char* content) {
 
-    return add_response("%s", content);
+    return add_bytes(content, strlen(content));
+}
+
+// An error response with a fixed body. Its status line, Connection and Content-Length, and its body, are static
+// text sent from where they are; only the Date field and the blank line are written to the write buffer.
+bool http_conn::add_error(RESPONSE_STATUS status) {
+
+    header_block head = response_templates::instance().error(status, m_linger);
+
+    int start = m_write_idx;
+
+    if (!(add_bytes(date_field(), DATE_FIELD_LENGTH) && add_blank_line())) return false;
+
+    add_iv((char*) head.data, head.length);
+    add_iv(m_write_buf + start, m_write_idx - start);
+    add_iv((char*) response_statuses[status].body, strlen(response_statuses[status].body));
+
+    return true;
+}
+
+// Whether another pipelined response can join the batch: it needs the memory blocks of the largest response, a slot for its file,
+// and RESPONSE_RESERVE bytes in the write buffer, which is grown if necessary.
+bool http_conn::can_pipeline() {
+
+    if ((m_iv_count + RESPONSE_IOVEC_NUMBER > IOVEC_NUMBER) or (m_file_count >= PIPELINE_DEPTH)) return false;
+
+    return (m_write_buf_size - m_write_idx >= RESPONSE_RESERVE) or grow_write_buf();
+}
+
+// Append a memory block to the batch. A block that continues the previous one, as the headers of consecutive
+// responses in the write buffer do, is merged into it.
+void http_conn::add_iv(char* base, size_t len) {
+
+    if ((m_iv_count > 0) && ((char*) m_iv[m_iv_count - 1].iov_base + m_iv[m_iv_count - 1].iov_len == base)) {
+
+        m_iv[m_iv_count - 1].iov_len += len;
+        return;
+    }
+
+    m_iv[m_iv_count].iov_base = base;
+    m_iv[m_iv_count].iov_len = len;
+
+    ++m_iv_count;
 }
 
 // Determine the content returned to the client based on the result of the server processing the HTTP request.
+// The response is appended to the batch: its headers after those already in the write buffer, its blocks after theirs.
 bool http_conn::process_write(HTTP_CODE ret) {
 
+    if (!m_write_buf) {
+
+        m_write_buf = buffer_pool::instance()->acquire(WRITE_BUFFER_SIZE, &m_write_buf_size);
+    }
+
+    int start = m_write_idx;
+
     switch (ret) {
 
         case INTERNAL_ERROR: {
 
-            add_status_line(500, error_500_title);
-            add_headers(strlen(error_500_form));
-
-            if (!add_content(error_500_form)) return false;
-   
-            break;
+            return add_error(STATUS_500);
         }
         case BAD_REQUEST: {
 
-            add_status_line(400, error_400_title);
-            add_headers(strlen(error_400_form));
-
-            if (!add_content(error_400_form)) return false;
-        
-            break;
+            return add_error(STATUS_400);
         }
         case NO_RESOURCE: {
 
-            add_status_line(404, error_404_title);
-            add_headers(strlen(error_404_form));
+            return add_error(STATUS_404);
+        }
+        case NOT_MODIFIED: {
+
+            // A 304 has no body, so it has no Content-Length either.
+            if (!(add_status_line(STATUS_304) && add_validators() && add_coding() && add_blank_line())) return false;
 
-            if (!add_content(error_404_form)) return false;
-      
             break;
         }
-        case FORBIDDEN_REQUEST: {
+        case RANGE_NOT_SATISFIABLE: {
 
-            add_status_line(403, error_403_title);
-            add_headers(strlen(error_403_form));
+            if (!(add_status_line(STATUS_416) && add_literal("Content-Range: bytes */") && add_decimal(m_file_stat.st_size) &&
+                  add_literal("\r\n") && add_coding() && add_headers(strlen(response_statuses[STATUS_416].body)) &&
+                  add_content(response_statuses[STATUS_416].body))) {
+
+                return false;
+            }
 
-            if (!add_content(error_403_form)) return false;
-      
             break;
         }
+        case FORBIDDEN_REQUEST: {
+
+            return add_error(STATUS_403);
+        }
         case FILE_REQUEST: {
 
-            add_status_line(200, ok_200_title);
+            if (m_range_count > 0) {
+
+                return add_partial_content(start);
+            }
+
+            if (!add_status_line(STATUS_200)) return false;
 
-            if (m_file_stat.st_size != 0) {
+            // Only the headers go through writev, the body follows with sendfile.
+            if (m_file_fd >= 0) {
+
+                if (!(add_validators() && add_coding() && add_literal("Accept-Ranges: bytes\r\n") &&
+                      add_headers(m_file_stat.st_size))) {
+
+                    return false;
+                }
+
+                add_iv(m_write_buf + start, m_write_idx - start);
+
+                return true;
+            }
+            else if (m_file_stat.st_size != 0) {
 
-                add_headers(m_file_stat.st_size);
+                if (!(add_validators() && add_coding() && add_literal("Accept-Ranges: bytes\r\n") &&
+                      add_headers(m_file_stat.st_size))) {
 
-                m_iv[0].iov_base = m_write_buf;
-                m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
+                    return false;
+                }
 
-                m_iv_count = 2;
+                add_iv(m_write_buf + start, m_write_idx - start);
+                add_iv(m_file_address, m_file_stat.st_size);
 
                 return true;
             }
@@ -598,10 +1213,10 @@ bool http_conn::process_write(HTTP_CODE ret) {
 
                 const char* ok_string = "<html><body></body></html>";
 
-                add_headers(strlen(ok_string));
-
-                if (!add_content(ok_string)) return false;    
+                if (!(add_headers(strlen(ok_string)) && add_content(ok_string))) return false;
             }
+
+            break;
         }
         default: {
 
@@ -609,30 +1224,142 @@ bool http_conn::process_write(HTTP_CODE ret) {
         }
     }
 
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
+    add_iv(m_write_buf + start, m_write_idx - start);
+
+    return true;
+}
+
+// Build a 206 response for the ranges in m_ranges; its headers start at 'start' in the write buffer.
+// No file data is copied: a single range is one slice of the mapping, or is sent with sendfile from its first byte,
+// and a multipart/byteranges response alternates the part headers in the write buffer with slices of the mapping.
+bool http_conn::add_partial_content(int start) {
+
+    long long size = m_file_stat.st_size;
+
+    if (!(add_status_line(STATUS_206) && add_validators() && add_coding())) return false;
+
+    if (m_range_count == 1) {
+
+        off_t first = m_ranges[0].first;
+        off_t last = m_ranges[0].last;
 
-    m_iv_count = 1;
+        if (!(add_content_range(first, last, size) && add_headers(last - first + 1))) return false;
+
+        add_iv(m_write_buf + start, m_write_idx - start);
+
+        if (m_file_fd < 0) {
+
+            add_iv(m_file_address + first, last - first + 1);
+        }
+
+        return true;
+    }
+
+    // The part headers must fit next to the response headers, and the memory blocks may not move once added.
+    while (m_write_buf_size - m_write_idx < MULTIPART_RESERVE) {
+
+        if (!grow_write_buf()) return false;
+    }
+
+    // A boundary of its own for every response, so it can not be predicted and planted in a file.
+    static std::atomic<unsigned long> boundary_sequence(0);
+
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "%08lx%08lx", (unsigned long) time(nullptr), ++boundary_sequence);
+
+    int boundary_len = strlen(boundary);
+
+    // The Content-Length comes before the parts, so add them up first. Every part is
+    // "\r\n--<boundary>\r\n", its Content-Range field, a blank line and its slice; the end is "\r\n--<boundary>--\r\n".
+    off_t length = boundary_len + 8;
+
+    for (int i = 0; i < m_range_count; ++i) {
+
+        length += boundary_len + 6;
+        length += 21 + decimal_length(m_ranges[i].first) + 1 + decimal_length(m_ranges[i].last) + 1 + decimal_length(size) + 2;
+        length += 2;
+        length += m_ranges[i].last - m_ranges[i].first + 1;
+    }
+
+    if (!(add_literal("Content-Type: multipart/byteranges; boundary=") && add_bytes(boundary, boundary_len) &&
+          add_literal("\r\n") && add_headers(length))) {
+
+        return false;
+    }
+
+    for (int i = 0; i < m_range_count; ++i) {
+
+        if (!(add_literal("\r\n--") && add_bytes(boundary, boundary_len) && add_literal("\r\n") &&
+              add_content_range(m_ranges[i].first, m_ranges[i].last, size) && add_blank_line())) {
+
+            return false;
+        }
+
+        add_iv(m_write_buf + start, m_write_idx - start);
+        add_iv(m_file_address + m_ranges[i].first, m_ranges[i].last - m_ranges[i].first + 1);
+
+        start = m_write_idx;
+    }
+
+    if (!(add_literal("\r\n--") && add_bytes(boundary, boundary_len) && add_literal("--\r\n"))) return false;
+
+    add_iv(m_write_buf + start, m_write_idx - start);
 
     return true;
 }
 
 // Called by the worker thread in the thread pool, this is the entry function for processing HTTP requests.
+// Every complete request in the read buffer is answered in order, and the responses are sent as one batch.
 void http_conn::process() {
 
-    HTTP_CODE read_ret = process_read();
+    int responses = 0;
 
-    if (read_ret == NO_REQUEST) {
+    while (true) {
 
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
-    }
+        HTTP_CODE read_ret = process_read();
+
+        if (read_ret == NO_REQUEST) break;
+
+        // After a malformed request the rest of the input can not be trusted to start at a request boundary.
+        // A server that is shutting down answers the request, but not the ones pipelined behind it.
+        if ((read_ret == BAD_REQUEST) or m_draining) {
+
+            m_linger = false;
+        }
+
+        bool write_ret = process_write(read_ret);
 
-    bool write_ret = process_write(read_ret);
+        // The connection is closed by its event loop, which also owns its timer: it sees the hang-up once re-armed.
+        if (!write_ret) {
 
-    if (!write_ret) {
+            shutdown_conn();
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
 
-        close_conn();
+            return;
+        }
+
+        // The file of the response now belongs to the batch.
+        if (m_file) {
+
+            m_files[m_file_count++] = m_file;
+
+            m_file = nullptr;
+            m_file_address = 0;
+        }
+
+        m_keep_alive = m_linger;
+        ++responses;
+
+        next_request();
+
+        // A response after which the connection closes, or whose file follows with sendfile, ends the batch.
+        if (!m_keep_alive or (m_file_fd >= 0) or !can_pipeline()) break;
+    }
+
+    if (responses == 0) {
+
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        return;
     }
 
     modfd(m_epollfd, m_sockfd, EPOLLOUT);
@@ -9,16 +9,113 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
-
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+
+#include "13-6 fd_passing.h"
 #include "14-2 locker.h"
 #include "15-3 threadpool.h"
 #include "15-4 http_conn.h"
+#include "15-12 fd_table.h"
+#include "11-5 time_wheel_timer.h"
 
 const int MAX_FD = 65536;
 const int MAX_EVENT_NUMBER = 10000;
 
+// Every TRIM_INTERVAL seconds the first event loop releases the pages of the connection table
+// whose connections have all been closed for at least TRIM_IDLE seconds.
+const int TRIM_INTERVAL = 10;
+const int TRIM_IDLE = 60;
+
+// Connection timeouts in seconds. A request must arrive completely within REQUEST_TIMEOUT of its first bytes
+// (or of the accept, for the first request), however slowly they trickle in; a keep-alive connection may wait
+// KEEPALIVE_TIMEOUT for its next request; and a response must make progress at least every WRITE_TIMEOUT.
+// Each expires on the tick after it has passed, and all are shorter than the 64 slots of the time wheel (11-5).
+const int REQUEST_TIMEOUT = 10;
+const int KEEPALIVE_TIMEOUT = 60;
+const int WRITE_TIMEOUT = 30;
+
+// On SIGTERM or SIGINT the server drains: it stops accepting, answers the requests it has already received with
+// "Connection: close", and gives the remaining connections DRAIN_TIMEOUT seconds to finish before it shuts them
+// down. A second signal shuts them down at once.
+const int DRAIN_TIMEOUT = 10;
+
+// The maximum number of event loops (reactors) that can be started.
+const int MAX_REACTOR_NUMBER = 256;
+
+// The default length of the queue of accepted connections waiting for accept4, per listening socket.
+// The kernel caps it at net.core.somaxconn.
+const int DEFAULT_BACKLOG = 1024;
+
+// Hot upgrade. A server on an address also serves a control socket named after it. A new server started on the
+// same address connects to it, and the running one hands it its listening sockets (UPGRADE_LISTENERS); the new one
+// starts serving them and tells the old one (UPGRADE_READY) to drain, so no connection waiting in an accept queue
+// is ever lost. Draining, the old server also hands its keep-alive connections over as soon as they are idle
+// between two requests (UPGRADE_CONNECTIONS), instead of closing them, so that their clients need not reconnect.
+// Each message is an int carrying its type, and the descriptors it hands over.
+enum UPGRADE_MESSAGE {
+
+    UPGRADE_LISTENERS,
+    UPGRADE_READY,
+    UPGRADE_CONNECTIONS
+};
+
 extern int addfd(int epollfd, int fd, bool one_shot);
 extern int removefd(int epollfd, int fd);
+extern int setnonblocking(int fd);
+extern void modfd(int epollfd, int fd, int ev);
+
+// Each event loop owns a listening socket, an epoll kernel event table and the connections it accepted,
+// and a time wheel with the timers of those connections, ticked every second by a timerfd.
+struct reactor {
+
+    int index;
+    int listenfd;           // -1 once the loop has stopped accepting.
+    int epollfd;
+    int timerfd;
+    time_wheel<http_conn>* timers;
+    pthread_t thread;
+
+    int connections;        // Number of open connections of the loop.
+    bool draining;          // Whether the loop has stopped accepting.
+    time_t drain_deadline;  // When the connections left are shut down.
+    bool hand_over;         // Whether the connections are handed over to a successor as they become idle.
+    bool collect_idle;      // Whether those idle already are still to be found, once the batch of events is processed.
+
+    std::vector<http_conn*> idle;  // Connections to hand over at the end of the batch of events being processed.
+};
+
+// The connection objects and the thread pool are shared by all event loops.
+// A socket belongs to exactly one event loop, so its object is only touched by its owner and the worker running it.
+static fd_table<http_conn>* users = nullptr;
+static threadpool<http_conn>* pool = nullptr;
+
+// The first event loop reads the termination signals from 'sigfd' and counts them in 'drain_signals'; every write
+// to 'drainfd', an eventfd all loops watch edge-triggered and never read, then wakes each loop once to act on them.
+static int sigfd = -1;
+static int drainfd = -1;
+static std::atomic<int> drain_signals(0);
+
+// Number of event loops still accepting, and still running.
+static std::atomic<int> accepting_reactors(0);
+static std::atomic<int> running_reactors(0);
+static bool shared_listener = false;
+
+static reactor* reactors = nullptr;
+static int reactor_number = 1;
+
+// The upgrade channels are only read by the first event loop. 'control_listenfd' waits for a successor, -1 once
+// one has connected; 'successor' is the channel to it and 'predecessor' the channel to the server this one replaces.
+static char control_name[64];
+static int control_listenfd = -1;
+static int successor = -1;
+static int predecessor = -1;
 
 void addsig(int sig, void(handler)(int), bool restart = true) {
 
@@ -46,70 +143,461 @@ void show_error(int connfd, const char* info) {
     close(connfd);
 }
 
-int main(int argc, char* argv[])
-{
-    if (argc <= 2) {
+// Create a listening socket. Every socket is bound with SO_REUSEPORT: when several event loops are started, each
+// of them may get its own socket bound to the same address, and the kernel distributes new connections among them;
+// and a new server can bind the port while the one it replaces is still draining its connections.
+// Accepted sockets inherit the options of the listening socket, so it must not set SO_LINGER to {1, 0}:
+// closing a connection would then reset it, and throw away the end of a response the client has not read yet.
+int create_listenfd(const char* ip, int port, int backlog) {
 
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
-        return 1;
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    assert(listenfd >= 0);
+
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+    int ret = 0;
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    ret = bind(listenfd, (struct sockaddr*)& address, sizeof(address));
+    assert(ret >= 0);
+
+    ret = listen(listenfd, backlog);
+    assert(ret >= 0);
+
+    return listenfd;
+}
+
+// Register a listening socket, edge-triggered. With 'exclusive', the event loops sharing one socket are not all
+// woken up by each new connection, only one of them (or a few) is.
+void add_listenfd(int epollfd, int listenfd, bool exclusive) {
+
+    epoll_event event;
+
+    event.data.fd = listenfd;
+    event.events = EPOLLIN | EPOLLET;
+
+    if (exclusive) {
+
+        event.events |= EPOLLEXCLUSIVE;
     }
 
-    const char* ip = argv[1];
-    int port = atoi(argv[2]);
+    int ret = epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event);
+    assert(ret == 0);
+}
 
-    // Ignore SIGPIPE signal.
-    addsig(SIGPIPE, SIG_IGN);
+// The callback of an expired connection timer. The connection is shut down rather than closed, as a worker may be
+// processing it right now; its event loop sees the hang-up once the socket is armed and closes it there.
+void reap(http_conn* user) {
 
-    // Create thread pool.
-    threadpool<http_conn>* pool = nullptr;
+    // The time wheel deletes the timer after this callback.
+    user->m_timer = nullptr;
+    user->shutdown_conn();
+}
 
-    try {
+// Start the timer of a connection, or move it, so that it expires 'timeout' seconds from now. Either is O(1).
+void set_timer(reactor* r, http_conn* user, int timeout) {
 
-        pool = new threadpool<http_conn>;
+    if (user->m_timer) {
+
+        r->timers->adjust_timer(user->m_timer, timeout);
+        return;
     }
-    catch (...) {
 
-        return 1;
+    user->m_timer = r->timers->add_timer(timeout);
+    user->m_timer->cb_func = reap;
+    user->m_timer->user_data = user;
+}
+
+// Connections are only closed by their event loop, which deletes their timer with them.
+void close_connection(reactor* r, http_conn* user) {
+
+    r->timers->del_timer(user->m_timer);
+    user->m_timer = nullptr;
+
+    if (!user->closed()) {
+
+        --r->connections;
     }
 
-    // Pre-allocate an http_conn object for each possible client connection.
-    http_conn* users = new http_conn[MAX_FD];
-    assert(users);
+    user->close_conn();
+}
 
-    int user_count = 0;
+// Accept every connection waiting on the listening socket of the event loop. The socket is edge-triggered, so
+// one event may stand for any number of connections, and those left in the queue would not be reported again.
+// accept4 makes the sockets nonblocking and close-on-exec in the same call.
+void accept_connections(reactor* r) {
 
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);
+    while (true) {
 
-    struct linger tmp = {1, 0};
-    setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        struct sockaddr_in client_address;
+        socklen_t client_addresslength = sizeof(client_address);
 
-    int ret = 0;
+        int connfd = accept4(r->listenfd, (struct sockaddr*)& client_address, &client_addresslength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
+        if (connfd < 0) {
 
-    address.sin_family = AF_INET;
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    address.sin_port = htons(port);
+            // A connection that was reset while it waited in the queue, or an interrupted call: try the next one.
+            if ((errno == ECONNABORTED) or (errno == EINTR)) continue;
 
-    ret = bind(listenfd, (struct sockaddr*)& address, sizeof(address));
-    assert(ret >= 0);
+            // The queue is empty, or another event loop sharing the socket took the rest of it.
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
 
-    ret = listen(listenfd, 5);
-    assert(ret >= 0);
+                printf("errno is: %d\n", errno);
+            }
+
+            break;
+        }
+
+        if (http_conn::m_user_count >= MAX_FD) {
+
+            show_error(connfd, "Internal server busy");
+            continue;
+        }
+
+        http_conn* user = users->acquire(connfd);
+
+        if (!user) {
+
+            show_error(connfd, "Internal server busy");
+            continue;
+        }
+
+        // Initialize client connection and register it in the epoll table of this event loop.
+        user->init(r->epollfd, connfd, client_address);
+        ++r->connections;
+
+        set_timer(r, user, REQUEST_TIMEOUT);
+    }
+}
+
+// Start draining the event loop. It takes the connections still queued on its listening socket and closes the
+// socket, so that new connections go to the other sockets bound to the port with SO_REUSEPORT, those of the
+// server replacing this one, or are refused. A shared socket is closed by the last loop to stop accepting.
+// When a successor has taken the sockets over, their queues are left to it, and the connections of the loop are
+// handed over to it as they become idle, those idle now first.
+void start_drain(reactor* r) {
+
+    r->draining = true;
+    r->drain_deadline = time(nullptr) + DRAIN_TIMEOUT;
+    r->hand_over = (successor != -1);
+    r->collect_idle = r->hand_over;
+
+    if (!r->hand_over) {
+
+        accept_connections(r);
+    }
+
+    epoll_ctl(r->epollfd, EPOLL_CTL_DEL, r->listenfd, 0);
+
+    if ((--accepting_reactors == 0) or !shared_listener) {
+
+        close(r->listenfd);
+    }
+
+    r->listenfd = -1;
+}
+
+// Hand the idle connections of the event loop over to the successor, MAX_PASSED_FDS to a message. A connection is
+// idle when nothing of a request has been read from it and no response is being sent: all of its state is then in
+// the socket, and no worker has it. This runs once the whole batch of events has been processed, as a later event
+// of the batch may concern a connection found idle earlier; the connection that has just finished a response
+// is the only event of its socket in the batch.
+void hand_over_connections(reactor* r) {
+
+    std::vector<http_conn*>& idle = r->idle;
+
+    // Those that finished a response in this batch are found again among all of them.
+    if (r->collect_idle) {
+
+        idle.clear();
+
+        r->timers->for_each([&idle](tw_timer<http_conn>* timer) {
+
+            if (timer->user_data->idle() && !timer->user_data->writing()) {
+
+                idle.push_back(timer->user_data);
+            }
+        });
 
-    epoll_event events[MAX_EVENT_NUMBER];
+        r->collect_idle = false;
+    }
+
+    int fds[MAX_PASSED_FDS];
+    int n = 0;
+
+    for (size_t i = 0; i < idle.size(); ++i) {
+
+        http_conn* user = idle[i];
+
+        r->timers->del_timer(user->m_timer);
+        user->m_timer = nullptr;
+
+        fds[n++] = user->detach();
+        --r->connections;
+
+        if ((n == MAX_PASSED_FDS) or (i + 1 == idle.size())) {
+
+            int type = UPGRADE_CONNECTIONS;
+
+            // Connections that could not be handed over are closed, as the drain would have closed them.
+            if (send_fds(successor, &type, sizeof(type), fds, n) < 0) {
+
+                printf("handing over %d connections failed, errno is: %d\n", n, errno);
+            }
+
+            for (int j = 0; j < n; ++j) {
+
+                close(fds[j]);
+            }
+
+            n = 0;
+        }
+    }
+
+    idle.clear();
+}
+
+// Start the drain of all event loops, or end it if it has started already.
+void request_drain() {
+
+    ++drain_signals;
+
+    uint64_t one = 1;
+
+    if (write(drainfd, &one, sizeof(one)) != sizeof(one)) {}
+}
+
+// Read the termination signals, in the first event loop, and pass them on to all loops.
+void read_signals() {
+
+    signalfd_siginfo info;
+
+    while (read(sigfd, &info, sizeof(info)) == sizeof(info)) {
+
+        printf("signal %u, %s\n", info.ssi_signo, (drain_signals == 0) ? "draining" : "closing all connections");
+
+        // Every response from now on closes its connection.
+        http_conn::m_draining = true;
+
+        request_drain();
+    }
+}
+
+// Serve under the control name, to wait for a successor.
+void listen_control() {
+
+    control_listenfd = control_listen(control_name);
+
+    if (control_listenfd < 0) {
+
+        printf("another server serves under %s, no hot upgrade\n", control_name);
+        return;
+    }
+
+    addfd(reactors[0].epollfd, control_listenfd, false);
+}
+
+// A new server has connected to take over: hand it the listening sockets, which this server keeps serving until
+// the successor is ready. The control socket is closed first, so that the name is free by the time the successor
+// has the sockets and serves under it itself; if the hand-over fails, this server serves under it again.
+void accept_successor() {
+
+    int fd = accept4(control_listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd < 0) return;
+
+    // A draining server has no listening sockets left to hand over; the new server makes its own.
+    if (drain_signals > 0) {
+
+        close(fd);
+        return;
+    }
+
+    int listenfds[MAX_REACTOR_NUMBER];
+    int n = shared_listener ? 1 : reactor_number;
 
-    int epollfd = epoll_create(5);
-    assert(epollfd != -1);
+    for (int i = 0; i < n; ++i) {
 
-    addfd(epollfd, listenfd, false);
+        listenfds[i] = reactors[i].listenfd;
+    }
+
+    // The event loops send on the channel while they drain; a successor that stops reading must not block them.
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    removefd(reactors[0].epollfd, control_listenfd);
+    control_listenfd = -1;
+
+    int type = UPGRADE_LISTENERS;
+
+    if (send_fds(fd, &type, sizeof(type), listenfds, n) < 0) {
+
+        close(fd);
+        listen_control();
+
+        return;
+    }
+
+    printf("handed %d listening sockets over\n", n);
+
+    successor = fd;
+    addfd(reactors[0].epollfd, successor, false);
+}
+
+// The successor serves the listening sockets: drain, handing the connections over rather than closing them.
+// If it is gone before that, this server goes on serving and waits for another one.
+void read_successor() {
+
+    int type = -1;
+    int n = 0;
+
+    ssize_t ret = recv_fds(successor, &type, sizeof(type), nullptr, 0, &n);
+
+    if ((ret == sizeof(type)) && (type == UPGRADE_READY)) {
+
+        printf("successor ready, draining\n");
+
+        request_drain();
+        return;
+    }
+
+    // The loops may send on the channel once they drain.
+    if ((ret == 0) && (drain_signals == 0)) {
+
+        printf("successor gone\n");
+
+        removefd(reactors[0].epollfd, successor);
+        successor = -1;
+
+        listen_control();
+    }
+}
+
+// Take over the listening sockets of the server running on the same address, if there is one, into 'fds'.
+// Returns their number.
+int take_over(int* fds, int max) {
+
+    predecessor = control_connect(control_name);
+
+    if (predecessor < 0) return 0;
+
+    int type = -1;
+    int n = 0;
+
+    if ((recv_fds(predecessor, &type, sizeof(type), fds, max, &n) != sizeof(type)) or (type != UPGRADE_LISTENERS)) {
 
-    http_conn::m_epollfd = epollfd;
+        for (int i = 0; i < n; ++i) {
+
+            close(fds[i]);
+        }
+
+        close(predecessor);
+        predecessor = -1;
+
+        return 0;
+    }
+
+    printf("took %d listening sockets over\n", n);
+
+    return n;
+}
+
+// Go on serving the connections the predecessor hands over as it drains.
+void receive_connections(reactor* r) {
 
     while (true) {
 
+        int type = -1;
+        int fds[MAX_PASSED_FDS];
+        int n = 0;
+
+        ssize_t ret = recv_fds(predecessor, &type, sizeof(type), fds, MAX_PASSED_FDS, &n);
+
+        if ((ret < 0) && ((errno == EAGAIN) or (errno == EWOULDBLOCK))) return;
+
+        // The predecessor has ended.
+        if (ret <= 0) {
+
+            removefd(r->epollfd, predecessor);
+            predecessor = -1;
+
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+
+            struct sockaddr_in client_address;
+            socklen_t client_addresslength = sizeof(client_address);
+
+            http_conn* user = nullptr;
+
+            if ((type == UPGRADE_CONNECTIONS) && (http_conn::m_user_count < MAX_FD)
+                && (getpeername(fds[i], (struct sockaddr*)& client_address, &client_addresslength) == 0)) {
+
+                user = users->acquire(fds[i]);
+            }
+
+            if (!user) {
+
+                close(fds[i]);
+                continue;
+            }
+
+            // The socket is nonblocking already: the flag is part of the open file, which the descriptor passed shares.
+            user->init(r->epollfd, fds[i], client_address);
+            ++r->connections;
+
+            set_timer(r, user, KEEPALIVE_TIMEOUT);
+        }
+    }
+}
+
+// Act on the termination signals counted so far: the first one starts the drain, a second one ends it.
+void on_drain(reactor* r) {
+
+    if (!r->draining) {
+
+        start_drain(r);
+    }
+
+    if (drain_signals > 1) {
+
+        r->drain_deadline = time(nullptr);
+    }
+}
+
+// Whether the event loop has drained and can end. The first loop keeps time for the others, so it ends last.
+bool drained(reactor* r) {
+
+    return r->draining && (r->connections == 0) && ((r->index != 0) or (running_reactors == 1));
+}
+
+// The event loop. It accepts connections on its own listening socket, performs all reads and writes
+// of the connections it owns, and hands the parsing and response building to the thread pool.
+void* run_reactor(void* arg) {
+
+    reactor* r = (reactor*) arg;
+
+    int epollfd = r->epollfd;
+
+    // Only the first event loop keeps time for the whole server: on its timer ticks it also ticks the clock
+    // of the Date field and, less often, trims the connection table.
+    bool timekeeper = (r->index == 0);
+    time_t last_trim = time(nullptr);
+
+    epoll_event* events = new epoll_event[MAX_EVENT_NUMBER];
+
+    while (!drained(r)) {
+
         int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
 
         if ((number < 0) && (errno != EINTR)) {
@@ -118,55 +606,150 @@ int main(int argc, char* argv[])
             break;
         }
 
+        // The listening socket as the batch was collected. Draining takes it out of the loop, and may close it,
+        // in the middle of the batch: its later events in the batch are then dropped, not taken for a connection.
+        int batch_listenfd = r->listenfd;
+
         for (int i = 0; i < number; ++i) {
 
             int sockfd = events[i].data.fd;
 
-            if (sockfd == listenfd) {
+            if (sockfd == r->timerfd) {
 
-                struct sockaddr_in client_address;
-                socklen_t client_addresslength = sizeof(client_address);
+                // The number of seconds since the last read, more than 1 if the loop was busy.
+                uint64_t expirations = 0;
 
-                int connfd = accept(listenfd, (struct sockaddr*)& client_address, &client_addresslength);
+                if (read(r->timerfd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
 
-                if (connfd < 0) {
+                for (uint64_t j = 0; j < expirations; ++j) {
 
-                    printf("errno is: %d\n", errno);
-                    continue;
+                    r->timers->tick();
                 }
 
-                if (http_conn::m_user_count >= MAX_FD) {
+                // The connections still open at the deadline are timed out all at once.
+                if (r->draining && (time(nullptr) >= r->drain_deadline)) {
 
-                    show_error(connfd, "Internal server busy");
-                    continue;
+                    r->timers->expire_all();
                 }
 
-                // Initialize client connection.
-                users[connfd].init(connfd, client_address);
+                if (timekeeper) {
+
+                    tick_date();
+
+                    if (time(nullptr) - last_trim >= TRIM_INTERVAL) {
+
+                        users->trim(TRIM_IDLE);
+                        last_trim = time(nullptr);
+                    }
+                }
+            }
+            else if (sockfd == r->listenfd) {
+
+                accept_connections(r);
+            }
+            else if (sockfd == batch_listenfd) {
+
+                continue;
+            }
+            else if (sockfd == sigfd) {
+
+                read_signals();
+            }
+            else if (sockfd == drainfd) {
+
+                on_drain(r);
+            }
+            else if ((r->index == 0) && (sockfd == control_listenfd)) {
+
+                accept_successor();
+            }
+            else if ((r->index == 0) && (sockfd == successor)) {
+
+                read_successor();
+            }
+            else if ((r->index == 0) && (sockfd == predecessor)) {
+
+                receive_connections(r);
             }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
 
-                // If there is an exception, directly close the customer connection.
-                users[sockfd].close_conn();
+                http_conn* user = users->get(sockfd);
+
+                // An earlier event of the batch may have closed the connection already.
+                if (!user or user->closed()) continue;
+
+                // If there is an exception, or the connection timed out, directly close the customer connection.
+                close_connection(r, user);
             }
             else if (events[i].events & EPOLLIN) {
 
+                http_conn* user = users->get(sockfd);
+
+                if (!user or user->closed()) continue;
+
+                // The first bytes of a request start its timer, later ones do not move it, so a client
+                // that sends its request a byte at a time can not hold the connection for longer.
+                bool idle = user->idle();
+
                 // Based on the read results, decide whether to add the task to the thread pool or close the connection.
-                if (users[sockfd].read()) {
+                if (!user->read()) {
 
-                    pool->append(users + sockfd);
+                    close_connection(r, user);
+                }
+                else if (user->idle()) {
+
+                    // A spurious wakeup read nothing. The connection stays out of the thread pool, so that the
+                    // hand-over can still take it as idle.
+                    modfd(r->epollfd, sockfd, EPOLLIN);
                 }
                 else {
 
-                    users[sockfd].close_conn();
+                    if (idle) {
+
+                        set_timer(r, user, REQUEST_TIMEOUT);
+                    }
+
+                    // The socket is not armed while the request waits in the queue, so a full queue closes it.
+                    if (!pool->append(user)) {
+
+                        close_connection(r, user);
+                    }
                 }
             }
             else if (events[i].events & EPOLLOUT) {
 
+                http_conn* user = users->get(sockfd);
+
+                if (!user or user->closed()) continue;
+
                 // Based on the result of writing, decide whether to close the connection.
-                if (!users[sockfd].write()) {
+                if (!user->write()) {
+
+                    close_connection(r, user);
+                }
+                else if (user->pipelined()) {
+
+                    // The client pipelined more requests than one batch answers, they are already in the read buffer.
+                    set_timer(r, user, REQUEST_TIMEOUT);
+
+                    if (!pool->append(user)) {
+
+                        close_connection(r, user);
+                    }
+                }
+                else if (user->writing()) {
+
+                    // The socket buffer is full again, but the response made progress.
+                    set_timer(r, user, WRITE_TIMEOUT);
+                }
+                else {
+
+                    set_timer(r, user, KEEPALIVE_TIMEOUT);
 
-                    users[sockfd].close_conn();
+                    if (r->hand_over) {
+
+                        r->idle.push_back(user);
+                    }
                 }
             }
             else {
@@ -175,12 +758,236 @@ int main(int argc, char* argv[])
             }
         }
 
-        close(epollfd);
-        close(listenfd);
+        if (r->collect_idle or !r->idle.empty()) {
+
+            hand_over_connections(r);
+        }
+    }
+
+    delete[] events;
 
-        delete[] users;
-        delete pool;
+    --running_reactors;
 
-        return 0;
+    return r;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 2) {
+
+        printf("usage: %s ip_address port_number [reactor_number [precompressed [backlog [shared_listener [cache_megabytes [cache_ttl]]]]]]\n", basename(argv[0]));
+        return 1;
     }
-}
\ No newline at end of file
+
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+
+    // The number of event loops. With 1 (the default) the server runs a single epoll loop in the main thread;
+    // with more, every loop runs in its own thread with its own listening socket.
+    reactor_number = (argc > 3) ? atoi(argv[3]) : 1;
+
+    if ((reactor_number <= 0) or (reactor_number > MAX_REACTOR_NUMBER)) {
+
+        printf("reactor_number must be between 1 and %d\n", MAX_REACTOR_NUMBER);
+        return 1;
+    }
+
+    // With precompressed set to 1, a file with an up-to-date "file.br" or "file.gz" next to it is sent as that
+    // sidecar to clients that accept its coding. The sidecars are made offline, by 16-11 precompress.
+    if ((argc > 4) && (atoi(argv[4]) == 1)) {
+
+        file_cache::instance()->set_sidecars(true);
+    }
+
+    // The length of the accept queue of each listening socket.
+    int backlog = (argc > 5) ? atoi(argv[5]) : DEFAULT_BACKLOG;
+
+    if (backlog <= 0) {
+
+        printf("backlog must be positive\n");
+        return 1;
+    }
+
+    // With shared_listener set to 1, the event loops share one listening socket instead of one SO_REUSEPORT
+    // socket each, and each new connection wakes up one of them (EPOLLEXCLUSIVE) rather than all of them.
+    // SO_REUSEPORT spreads connections by a hash of their addresses, whatever the load of the loops;
+    // a shared socket is served by whichever loop is waiting, but all loops contend on one accept queue.
+    shared_listener = (reactor_number > 1) && (argc > 6) && (atoi(argv[6]) == 1);
+
+    // The budget of file bytes the cache keeps mapped, and the seconds it trusts the status of a file before it
+    // calls stat again. A longer TTL saves system calls on hot files, but serves a changed file late.
+    long cache_megabytes = (argc > 7) ? atol(argv[7]) : file_cache::DEFAULT_MAX_BYTES / (1024 * 1024);
+    int cache_ttl = (argc > 8) ? atoi(argv[8]) : file_cache::DEFAULT_TTL;
+
+    if ((cache_megabytes <= 0) or (cache_ttl < 0)) {
+
+        printf("cache_megabytes must be positive and cache_ttl not negative\n");
+        return 1;
+    }
+
+    file_cache::instance()->configure(cache_megabytes * 1024 * 1024, file_cache::DEFAULT_MAX_ENTRIES, cache_ttl,
+                                      file_cache::DEFAULT_MAX_FILE_SIZE);
+
+    // Ignore SIGPIPE signal.
+    addsig(SIGPIPE, SIG_IGN);
+
+    // SIGTERM and SIGINT are blocked in every thread, which inherit the mask of the main thread,
+    // and read from a signalfd by the first event loop instead.
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(sigfd != -1);
+
+    drainfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(drainfd != -1);
+
+    // Create thread pool.
+    try {
+
+        pool = new threadpool<http_conn>;
+    }
+    catch (...) {
+
+        return 1;
+    }
+
+    // The table of http_conn objects indexed by socket; its pages are allocated as connections arrive.
+    users = new fd_table<http_conn>(MAX_FD);
+
+    reactors = new reactor[reactor_number];
+
+    // The listening sockets: those of the server running on the address, if there is one, and new ones for the rest.
+    // A socket taken over keeps its accept queue, and gets the backlog of this server. Sockets beyond those needed
+    // are closed; the connections in their queues at that moment are reset.
+    snprintf(control_name, sizeof(control_name), "WebServer.%s:%d", ip, port);
+
+    int listenfds[MAX_REACTOR_NUMBER];
+    int listener_number = shared_listener ? 1 : reactor_number;
+    int inherited = take_over(listenfds, MAX_REACTOR_NUMBER);
+
+    for (int i = 0; i < listener_number; ++i) {
+
+        if (i < inherited) {
+
+            listen(listenfds[i], backlog);
+        }
+        else {
+
+            listenfds[i] = create_listenfd(ip, port, backlog);
+        }
+    }
+
+    for (int i = listener_number; i < inherited; ++i) {
+
+        close(listenfds[i]);
+    }
+
+    int shared_listenfd = shared_listener ? listenfds[0] : -1;
+
+    for (int i = 0; i < reactor_number; ++i) {
+
+        reactors[i].index = i;
+        reactors[i].listenfd = shared_listener ? shared_listenfd : listenfds[i];
+        reactors[i].connections = 0;
+        reactors[i].draining = false;
+        reactors[i].drain_deadline = 0;
+        reactors[i].hand_over = false;
+        reactors[i].collect_idle = false;
+
+        reactors[i].epollfd = epoll_create(5);
+        assert(reactors[i].epollfd != -1);
+
+        add_listenfd(reactors[i].epollfd, reactors[i].listenfd, shared_listener);
+
+        // The time wheel of the loop turns once per second.
+        reactors[i].timers = new time_wheel<http_conn>;
+        reactors[i].timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        assert(reactors[i].timerfd != -1);
+
+        struct itimerspec second = { { 1, 0 }, { 1, 0 } };
+        timerfd_settime(reactors[i].timerfd, 0, &second, nullptr);
+
+        addfd(reactors[i].epollfd, reactors[i].timerfd, false);
+        addfd(reactors[i].epollfd, drainfd, false);
+    }
+
+    addfd(reactors[0].epollfd, sigfd, false);
+
+    listen_control();
+
+    if (predecessor != -1) {
+
+        setnonblocking(predecessor);
+        addfd(reactors[0].epollfd, predecessor, false);
+    }
+
+    accepting_reactors = reactor_number;
+    running_reactors = reactor_number;
+
+    // The main thread runs the first event loop itself, the others get a thread each.
+    for (int i = 1; i < reactor_number; ++i) {
+
+        int ret = pthread_create(&reactors[i].thread, nullptr, run_reactor, reactors + i);
+        assert(ret == 0);
+    }
+
+    // The listening sockets are registered: the predecessor may drain.
+    if (predecessor != -1) {
+
+        int type = UPGRADE_READY;
+        send_fds(predecessor, &type, sizeof(type), nullptr, 0);
+    }
+
+    run_reactor(reactors);
+
+    for (int i = 1; i < reactor_number; ++i) {
+
+        pthread_join(reactors[i].thread, nullptr);
+    }
+
+    // A loop that drained has closed its listening socket already, one that failed has not.
+    for (int i = 0; i < reactor_number; ++i) {
+
+        close(reactors[i].epollfd);
+        close(reactors[i].timerfd);
+
+        if ((reactors[i].listenfd != -1) && !shared_listener) {
+
+            close(reactors[i].listenfd);
+        }
+
+        delete reactors[i].timers;
+    }
+
+    if (shared_listener && (accepting_reactors > 0)) {
+
+        close(shared_listenfd);
+    }
+
+    close(sigfd);
+    close(drainfd);
+
+    if (control_listenfd != -1) close(control_listenfd);
+    if (successor != -1) close(successor);
+    if (predecessor != -1) close(predecessor);
+
+    // The workers are joined before the connections they may still be returning from are freed.
+    delete[] reactors;
+    delete pool;
+    delete users;
+
+    file_cache_stats stats = file_cache::instance()->stats();
+
+    printf("file cache: %ld hits, %ld misses, %ld evictions, %ld invalidations, %ld sidecar stats, %d entries, %zu bytes\n",
+           stats.hits, stats.misses, stats.evictions, stats.invalidations, stats.sidecar_stats, stats.entries, stats.bytes);
+
+    printf("drained\n");
+
+    return 0;
+}
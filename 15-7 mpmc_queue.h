@@ -0,0 +1,162 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+// Size of a cache line. The producer and consumer positions are each given a line of their own,
+// otherwise every push would invalidate the line that the consumers are spinning on and vice versa.
+static const int CACHELINE_SIZE = 64;
+
+// Tell the CPU that we are in a spin-wait loop.
+static inline void cpu_relax() {
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Bounded multi-producer multi-consumer queue based on a ring buffer with per-cell sequence numbers.
+// Producers and consumers claim positions with a single compare-and-swap and never take a lock.
+// Template parameter T is the type of the elements, the queue only stores pointers to them.
+template<typename T>
+class mpmc_queue {
+public:
+    // The parameter capacity is the maximum number of elements in the queue; it is rounded up to a power of two.
+    explicit mpmc_queue(int capacity = 1024);
+    ~mpmc_queue();
+
+    // Add an element to the tail of the queue. Returns false if the queue is full.
+    bool push(T* item);
+
+    // Remove an element from the head of the queue. Returns false if the queue is empty.
+    bool pop(T*& item);
+
+    int capacity() const { return (int)(m_mask + 1); }
+
+private:
+    // A slot of the ring buffer. 'sequence' tells whose turn it is:
+    // equal to the position means free for the producer of that position,
+    // equal to the position + 1 means filled and ready for the consumer of that position.
+    struct cell {
+
+        std::atomic<size_t> sequence;
+        T* data;
+    };
+
+private:
+    cell* m_buffer;
+    size_t m_mask;
+
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_enqueue_pos;  // Next position to be written by a producer.
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_dequeue_pos;  // Next position to be read by a consumer.
+};
+
+template<typename T>
+mpmc_queue<T>::mpmc_queue(int capacity) : m_buffer(nullptr), m_mask(0), m_enqueue_pos(0), m_dequeue_pos(0) {
+
+    if (capacity <= 0) {
+
+        throw std::exception();
+    }
+
+    size_t size = 2;
+
+    while (size < (size_t) capacity) {
+
+        size <<= 1;
+    }
+
+    m_buffer = new cell[size];
+    m_mask = size - 1;
+
+    for (size_t i = 0; i < size; ++i) {
+
+        m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+        m_buffer[i].data = nullptr;
+    }
+}
+
+template<typename T>
+mpmc_queue<T>::~mpmc_queue() {
+
+    delete[] m_buffer;
+}
+
+template<typename T>
+bool mpmc_queue<T>::push(T* item) {
+
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    cell* c = nullptr;
+
+    while (true) {
+
+        c = &m_buffer[pos & m_mask];
+
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        // The cell is free for this position, try to claim it.
+        if (diff == 0) {
+
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        // The cell still holds the element of the previous lap, that is, the queue is full.
+        else if (diff < 0) {
+
+            return false;
+        }
+        // Another producer claimed this position first, reload and try the next one.
+        else {
+
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    c->data = item;
+    c->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+template<typename T>
+bool mpmc_queue<T>::pop(T*& item) {
+
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    cell* c = nullptr;
+
+    while (true) {
+
+        c = &m_buffer[pos & m_mask];
+
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        // The cell has been filled for this position, try to claim it.
+        if (diff == 0) {
+
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        // The producer of this position has not finished yet, that is, the queue is empty.
+        else if (diff < 0) {
+
+            return false;
+        }
+        // Another consumer claimed this position first, reload and try the next one.
+        else {
+
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    item = c->data;
+
+    // Hand the cell over to the producer of the next lap.
+    c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+    return true;
+}
+
+#endif
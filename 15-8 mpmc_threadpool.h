@@ -0,0 +1,187 @@
+#ifndef MPMC_THREADPOOL_H
+#define MPMC_THREADPOOL_H
+
+#include <cstdio>
+#include <exception>
+#include <atomic>
+#include <pthread.h>
+
+#include "14-2 locker.h"
+#include "15-7 mpmc_queue.h"
+
+// Thread pool whose request queue is the lock-free bounded queue of code listing 15-7.
+// It has the same interface as the thread pool of code listing 15-3, so the task class T only needs a process() method.
+// Unlike that pool, appending a request does not take a lock, and the semaphore is only posted
+// when a worker has actually gone to sleep, so a busy pool makes no system calls at all on the request path.
+template<typename T>
+class mpmc_threadpool {
+public:
+    // The parameter thread_number is the number of threads in the thread pool,
+    // and max_requests is the capacity of the request queue (rounded up to a power of two).
+    mpmc_threadpool(int thread_number = 8, int max_requests = 10000);
+    ~mpmc_threadpool();
+
+    // Add tasks to the request queue. Returns false if the queue is full.
+    bool append(T* request);
+
+private:
+    // A function run by a worker thread, which continuously removes tasks from the work queue and executes them.
+    static void* worker(void* arg);
+
+    void run();
+
+    // Wake one parked worker, if there is any.
+    void wake_one();
+
+private:
+    // How many times an idle worker polls the queue before it parks on the semaphore.
+    static const int SPIN_COUNT = 64;
+
+    int m_thread_number;  // Number of threads in the thread pool.
+
+    pthread_t* m_threads;         // An array describing the thread pool with size m_thread_number.
+    mpmc_queue<T> m_workqueue;    // request queue.
+
+    alignas(CACHELINE_SIZE) std::atomic<int> m_idle;  // Number of workers parked (or about to park) on m_parked.
+    std::atomic<bool> m_stop;                         // Whether to end the threads.
+    sem m_parked;                                     // Parked workers sleep here.
+};
+
+template<typename T>
+mpmc_threadpool<T>::mpmc_threadpool(int thread_number, int max_requests) : m_thread_number(thread_number),
+    m_threads(nullptr), m_workqueue(max_requests), m_idle(0), m_stop(false) {
+
+    if ((thread_number <= 0) or (max_requests <= 0)) {
+
+        throw std::exception();
+    }
+
+    m_threads = new pthread_t[m_thread_number];
+
+    // The workers are joined by the destructor, so they are not detached.
+    for (int i = 0; i < thread_number; ++i) {
+
+        printf("create the %d-th thread\n", i);
+
+        if (pthread_create(m_threads + i, nullptr, worker, this) != 0) {
+
+            m_stop = true;
+
+            for (int j = 0; j < i; ++j) {
+
+                m_parked.post();
+            }
+
+            for (int j = 0; j < i; ++j) {
+
+                pthread_join(m_threads[j], nullptr);
+            }
+
+            delete[] m_threads;
+            throw std::exception();
+        }
+    }
+}
+
+template<typename T>
+mpmc_threadpool<T>::~mpmc_threadpool() {
+
+    m_stop = true;
+
+    // Every worker is either running, spinning or parked; one post per worker releases all of them.
+    for (int i = 0; i < m_thread_number; ++i) {
+
+        m_parked.post();
+    }
+
+    for (int i = 0; i < m_thread_number; ++i) {
+
+        pthread_join(m_threads[i], nullptr);
+    }
+
+    delete[] m_threads;
+}
+
+template<typename T>
+bool mpmc_threadpool<T>::append(T* request) {
+
+    if (!m_workqueue.push(request)) return false;
+
+    // The fence pairs with the one in run() between "m_idle.fetch_add" and the second pop,
+    // so either the parking worker sees the new request or we see the worker as idle; a wakeup can not be lost.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_idle.load(std::memory_order_relaxed) > 0) {
+
+        wake_one();
+    }
+
+    return true;
+}
+
+template<typename T>
+void mpmc_threadpool<T>::wake_one() {
+
+    int idle = m_idle.load();
+
+    while (idle > 0) {
+
+        if (m_idle.compare_exchange_weak(idle, idle - 1)) {
+
+            m_parked.post();
+            return;
+        }
+    }
+}
+
+template<typename T>
+void* mpmc_threadpool<T>::worker(void* arg) {
+
+    mpmc_threadpool* pool = (mpmc_threadpool*) arg;
+    pool->run();
+
+    return pool;
+}
+
+template<typename T>
+void mpmc_threadpool<T>::run() {
+
+    while (!m_stop) {
+
+        T* request = nullptr;
+
+        // Poll the queue for a while first, under load the next request usually arrives before we would have slept.
+        for (int i = 0; (i < SPIN_COUNT) && !m_workqueue.pop(request); ++i) {
+
+            cpu_relax();
+        }
+
+        if (!request) {
+
+            // Announce that we are going to park, then check the queue once more before sleeping.
+            m_idle.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (!m_workqueue.pop(request)) {
+
+                m_parked.wait();
+                continue;
+            }
+
+            // We found work after all. Take back our idle count if no producer has taken it yet;
+            // otherwise a post is on its way and will cause one harmless spurious wakeup later.
+            int idle = m_idle.load();
+
+            while ((idle > 0) && !m_idle.compare_exchange_weak(idle, idle - 1)) {
+
+                continue;
+            }
+        }
+
+        if (!request) continue;
+
+        request->process();
+    }
+}
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef WS_THREADPOOL_H
+#define WS_THREADPOOL_H
+
+#include <cstdio>
+#include <exception>
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+
+#include "14-2 locker.h"
+#include "15-7 mpmc_queue.h"
+
+// Chase-Lev work-stealing deque. The owner thread pushes and takes at the bottom without contention,
+// other threads steal from the top. The array grows when full; retired arrays are kept until
+// the deque is destroyed, because a thief may still be reading from them.
+template<typename T>
+class ws_deque {
+public:
+    explicit ws_deque(long capacity = 256) : m_top(0), m_bottom(0) {
+
+        m_array = new ring(capacity);
+        m_retired.push_back(m_array.load(std::memory_order_relaxed));
+    }
+
+    ~ws_deque() {
+
+        for (size_t i = 0; i < m_retired.size(); ++i) {
+
+            delete m_retired[i];
+        }
+    }
+
+    // Called by the owner only.
+    void push(T* item) {
+
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_acquire);
+        ring* a = m_array.load(std::memory_order_relaxed);
+
+        if (b - t > a->size - 1) {
+
+            a = grow(a, b, t);
+        }
+
+        a->put(b, item);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Called by the owner only. Returns nullptr if the deque is empty.
+    T* take() {
+
+        long b = m_bottom.load(std::memory_order_relaxed) - 1;
+        ring* a = m_array.load(std::memory_order_relaxed);
+
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        long t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+
+            // The deque was empty, restore the bottom.
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T* item = a->get(b);
+
+        if (t == b) {
+
+            // This is the last element, race against the thieves for it.
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+
+                item = nullptr;
+            }
+
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        return item;
+    }
+
+    // Called by any other thread. Returns nullptr if the deque is empty or another thread won the race.
+    T* steal() {
+
+        long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b) return nullptr;
+
+        ring* a = m_array.load(std::memory_order_acquire);
+        T* item = a->get(t);
+
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+
+            return nullptr;
+        }
+
+        return item;
+    }
+
+private:
+    // A circular array whose size is a power of two.
+    struct ring {
+
+        long size;
+        std::atomic<T*>* buf;
+
+        explicit ring(long capacity) : size(capacity), buf(new std::atomic<T*>[capacity]) {}
+        ~ring() { delete[] buf; }
+
+        T* get(long i) { return buf[i & (size - 1)].load(std::memory_order_relaxed); }
+        void put(long i, T* item) { buf[i & (size - 1)].store(item, std::memory_order_relaxed); }
+    };
+
+    // Double the array, copying the live range [t, b).
+    ring* grow(ring* a, long b, long t) {
+
+        ring* bigger = new ring(a->size * 2);
+
+        for (long i = t; i < b; ++i) {
+
+            bigger->put(i, a->get(i));
+        }
+
+        m_retired.push_back(bigger);
+        m_array.store(bigger, std::memory_order_release);
+
+        return bigger;
+    }
+
+private:
+    alignas(CACHELINE_SIZE) std::atomic<long> m_top;     // Thieves take from here.
+    alignas(CACHELINE_SIZE) std::atomic<long> m_bottom;  // The owner pushes and takes here.
+    std::atomic<ring*> m_array;
+
+    std::vector<ring*> m_retired;  // Every array ever used, only touched by the owner.
+};
+
+// Work-stealing thread pool. Every worker owns a deque: requests appended by a worker thread go to
+// its own deque and are usually processed by the same thread while their data is still in its cache.
+// Requests appended by other threads go to a shared lock-free injection queue. An idle worker first
+// drains its own deque, then the injection queue, and finally steals from the other workers.
+// It has the same interface as the thread pool of code listing 15-3, so the task class T only needs a process() method.
+template<typename T>
+class ws_threadpool {
+public:
+    // The parameter thread_number is the number of threads in the thread pool,
+    // and max_requests is the capacity of the injection queue (rounded up to a power of two).
+    ws_threadpool(int thread_number = 8, int max_requests = 10000);
+    ~ws_threadpool();
+
+    // Add tasks to the pool. Returns false if the injection queue is full.
+    bool append(T* request);
+
+private:
+    // Per-worker state, each on its own cache lines.
+    struct worker_slot {
+
+        ws_threadpool* pool;
+        int index;
+        unsigned int seed;  // State of the random number generator used to pick a victim.
+        ws_deque<T> deque;
+    };
+
+    // A function run by a worker thread, which continuously finds tasks and executes them.
+    static void* worker(void* arg);
+
+    void run(worker_slot* self);
+
+    // Find a task for the worker 'self', or return nullptr if there is none anywhere.
+    T* find_task(worker_slot* self);
+
+    // Wake one parked worker, if there is any.
+    void wake_one();
+
+private:
+    // How many rounds an idle worker looks for work before it parks on the semaphore.
+    static const int SPIN_COUNT = 64;
+
+    // The worker the current thread runs as, or nullptr if it is not a worker thread.
+    static thread_local worker_slot* t_self;
+
+    int m_thread_number;  // Number of threads in the thread pool.
+
+    pthread_t* m_threads;      // An array describing the thread pool with size m_thread_number.
+    worker_slot** m_slots;     // The per-worker state, indexed by worker number.
+    mpmc_queue<T> m_inject;    // Requests appended by threads outside the pool.
+
+    alignas(CACHELINE_SIZE) std::atomic<int> m_idle;  // Number of workers parked (or about to park) on m_parked.
+    std::atomic<bool> m_stop;                         // Whether to end the threads.
+    sem m_parked;                                     // Parked workers sleep here.
+};
+
+template<typename T>
+thread_local typename ws_threadpool<T>::worker_slot* ws_threadpool<T>::t_self = nullptr;
+
+template<typename T>
+ws_threadpool<T>::ws_threadpool(int thread_number, int max_requests) : m_thread_number(thread_number),
+    m_threads(nullptr), m_slots(nullptr), m_inject(max_requests), m_idle(0), m_stop(false) {
+
+    if ((thread_number <= 0) or (max_requests <= 0)) {
+
+        throw std::exception();
+    }
+
+    m_threads = new pthread_t[m_thread_number];
+    m_slots = new worker_slot*[m_thread_number];
+
+    // All slots must exist before the first worker starts stealing.
+    for (int i = 0; i < thread_number; ++i) {
+
+        m_slots[i] = new worker_slot;
+
+        m_slots[i]->pool = this;
+        m_slots[i]->index = i;
+        m_slots[i]->seed = i * 2654435761u + 1;
+    }
+
+    for (int i = 0; i < thread_number; ++i) {
+
+        printf("create the %d-th thread\n", i);
+
+        if (pthread_create(m_threads + i, nullptr, worker, m_slots[i]) != 0) {
+
+            m_stop = true;
+
+            for (int j = 0; j < i; ++j) {
+
+                m_parked.post();
+            }
+
+            for (int j = 0; j < i; ++j) {
+
+                pthread_join(m_threads[j], nullptr);
+            }
+
+            for (int j = 0; j < thread_number; ++j) {
+
+                delete m_slots[j];
+            }
+
+            delete[] m_slots;
+            delete[] m_threads;
+            throw std::exception();
+        }
+    }
+}
+
+template<typename T>
+ws_threadpool<T>::~ws_threadpool() {
+
+    m_stop = true;
+
+    for (int i = 0; i < m_thread_number; ++i) {
+
+        m_parked.post();
+    }
+
+    for (int i = 0; i < m_thread_number; ++i) {
+
+        pthread_join(m_threads[i], nullptr);
+    }
+
+    for (int i = 0; i < m_thread_number; ++i) {
+
+        delete m_slots[i];
+    }
+
+    delete[] m_slots;
+    delete[] m_threads;
+}
+
+template<typename T>
+bool ws_threadpool<T>::append(T* request) {
+
+    worker_slot* self = t_self;
+
+    // Submissions made from one of our own workers stay on that worker's deque.
+    if (self && (self->pool == this)) {
+
+        self->deque.push(request);
+    }
+    else if (!m_inject.push(request)) {
+
+        return false;
+    }
+
+    // See code listing 15-8: the fence pairs with the one in run() so a wakeup can not be lost.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_idle.load(std::memory_order_relaxed) > 0) {
+
+        wake_one();
+    }
+
+    return true;
+}
+
+template<typename T>
+void ws_threadpool<T>::wake_one() {
+
+    int idle = m_idle.load();
+
+    while (idle > 0) {
+
+        if (m_idle.compare_exchange_weak(idle, idle - 1)) {
+
+            m_parked.post();
+            return;
+        }
+    }
+}
+
+template<typename T>
+void* ws_threadpool<T>::worker(void* arg) {
+
+    worker_slot* self = (worker_slot*) arg;
+
+    t_self = self;
+    self->pool->run(self);
+
+    return self->pool;
+}
+
+template<typename T>
+T* ws_threadpool<T>::find_task(worker_slot* self) {
+
+    T* request = self->deque.take();
+
+    if (request) return request;
+
+    if (m_inject.pop(request)) return request;
+
+    // Steal from the other workers, starting at a random victim so the thieves spread out.
+    self->seed = self->seed * 1103515245 + 12345;
+
+    int start = (self->seed >> 16) % m_thread_number;
+
+    for (int i = 0; i < m_thread_number; ++i) {
+
+        int victim = (start + i) % m_thread_number;
+
+        if (victim == self->index) continue;
+
+        request = m_slots[victim]->deque.steal();
+
+        if (request) return request;
+    }
+
+    return nullptr;
+}
+
+template<typename T>
+void ws_threadpool<T>::run(worker_slot* self) {
+
+    while (!m_stop) {
+
+        T* request = nullptr;
+
+        for (int i = 0; (i < SPIN_COUNT) && !(request = find_task(self)); ++i) {
+
+            cpu_relax();
+        }
+
+        if (!request) {
+
+            // Announce that we are going to park, then look for work once more before sleeping.
+            m_idle.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (!(request = find_task(self))) {
+
+                m_parked.wait();
+                continue;
+            }
+
+            // We found work after all, take back our idle count if no producer has taken it yet.
+            int idle = m_idle.load();
+
+            while ((idle > 0) && !m_idle.compare_exchange_weak(idle, idle - 1)) {
+
+                continue;
+            }
+        }
+
+        request->process();
+    }
+}
+
+#endif
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+// Load test of conditional GET. It first fetches every file given on the command line once to learn its
+// ETag and Last-Modified, then builds a corpus of requests for them: plain GETs and GETs with a stale
+// If-None-Match, which must be answered with 200, and revalidations with the current If-None-Match or
+// If-Modified-Since, which must be answered with 304. Connections send the corpus round robin for a number
+// of seconds at each revalidation share, the status of every response is checked against the corpus,
+// and the request rate and the bytes received per request are reported.
+
+static const int MAX_CONN_NUMBER = 1024;
+static const int BUFFER_SIZE = 64 * 1024;
+
+// A request of the corpus and the status it must get.
+struct corpus_request {
+
+    std::string text;
+    int status;
+};
+
+// A client connection and the response it is waiting for.
+struct client {
+
+    int sockfd;
+    int next;           // Index of the next request of the corpus to send.
+    int status;         // Status expected for the request in flight.
+    int received;       // Status of the response being received.
+    long size;          // Its size in bytes.
+    long skip;          // Bytes of its body still to be received.
+    char* buf;
+    int len;            // Bytes received and not yet consumed.
+};
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int connect_to(const sockaddr_in& address) {
+
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(sockfd >= 0);
+
+    if (connect(sockfd, (struct sockaddr*)& address, sizeof(address)) != 0) {
+
+        printf("connect failure\n");
+        exit(1);
+    }
+
+    return sockfd;
+}
+
+// Copy the value of header 'name' from the response headers in 'headers' into 'value'. Returns false if absent.
+bool find_header(const char* headers, const char* name, char* value, int size) {
+
+    const char* p = strstr(headers, name);
+
+    if (!p) return false;
+
+    p += strlen(name);
+    p += strspn(p, " ");
+
+    int len = strcspn(p, "\r\n");
+
+    if (len >= size) return false;
+
+    memcpy(value, p, len);
+    value[len] = '\0';
+
+    return true;
+}
+
+// Drop up to 'skip' body bytes from the front of the client's buffer. Returns true when the whole body is gone.
+bool discard_body(client* c) {
+
+    int n = (c->skip < c->len) ? (int) c->skip : c->len;
+
+    memmove(c->buf, c->buf + n, c->len - n);
+
+    c->len -= n;
+    c->skip -= n;
+
+    return c->skip == 0;
+}
+
+// Consume the response at the front of the client's buffer, discarding its body as it arrives so that files of
+// any size fit through the buffer. Returns its status and stores its size in bytes once it is complete, else 0.
+int consume_response(client* c, long* bytes) {
+
+    if (c->skip == 0) {
+
+        c->buf[c->len] = '\0';
+
+        char* end = strstr(c->buf, "\r\n\r\n");
+
+        if (!end) return 0;
+
+        *end = '\0';
+
+        int header_length = end + 4 - c->buf;
+        char length[32];
+
+        // A 304 has no body and no Content-Length.
+        c->skip = find_header(c->buf, "Content-Length:", length, sizeof(length)) ? atol(length) : 0;
+        c->size = header_length + c->skip;
+        c->received = atoi(c->buf + 9);
+
+        memmove(c->buf, c->buf + header_length, c->len - header_length);
+        c->len -= header_length;
+    }
+
+    if ((c->skip > 0) && !discard_body(c)) return 0;
+
+    *bytes = c->size;
+
+    return c->received;
+}
+
+// Fetch 'path' once with a blocking connection and build its corpus entries.
+void learn(const sockaddr_in& address, const char* path, std::vector<corpus_request>& fresh, std::vector<corpus_request>& revalidate) {
+
+    int sockfd = connect_to(address);
+
+    char request[512];
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nConnection: close\r\n\r\n", path);
+
+    send(sockfd, request, strlen(request), 0);
+
+    // Only the headers are needed.
+    std::string headers;
+    char buf[4096];
+
+    while (headers.find("\r\n\r\n") == std::string::npos) {
+
+        int ret = recv(sockfd, buf, sizeof(buf), 0);
+
+        if (ret <= 0) break;
+
+        headers.append(buf, ret);
+    }
+
+    close(sockfd);
+
+    char etag[128];
+    char last_modified[128];
+
+    if ((atoi(headers.c_str() + 9) != 200) or !find_header(headers.c_str(), "ETag:", etag, sizeof(etag)) or
+        !find_header(headers.c_str(), "Last-Modified:", last_modified, sizeof(last_modified))) {
+
+        printf("%s: no 200 response with validators\n", path);
+        exit(1);
+    }
+
+    printf("%s: ETag %s, Last-Modified %s\n", path, etag, last_modified);
+
+    const char* keep_alive = "Connection: keep-alive\r\n";
+    char text[1024];
+
+    snprintf(text, sizeof(text), "GET %s HTTP/1.1\r\n%s\r\n", path, keep_alive);
+    fresh.push_back(corpus_request { text, 200 });
+
+    snprintf(text, sizeof(text), "GET %s HTTP/1.1\r\n%sIf-None-Match: \"0-0-0\"\r\n\r\n", path, keep_alive);
+    fresh.push_back(corpus_request { text, 200 });
+
+    snprintf(text, sizeof(text), "GET %s HTTP/1.1\r\n%sIf-None-Match: %s\r\n\r\n", path, keep_alive, etag);
+    revalidate.push_back(corpus_request { text, 304 });
+
+    snprintf(text, sizeof(text), "GET %s HTTP/1.1\r\n%sIf-Modified-Since: %s\r\n\r\n", path, keep_alive, last_modified);
+    revalidate.push_back(corpus_request { text, 304 });
+}
+
+// Build a corpus of 100 requests of which 'share' percent are revalidations, interleaved evenly.
+std::vector<corpus_request> build_corpus(const std::vector<corpus_request>& fresh, const std::vector<corpus_request>& revalidate, int share) {
+
+    std::vector<corpus_request> corpus;
+
+    for (int i = 0; i < 100; ++i) {
+
+        if ((i * share) / 100 != ((i + 1) * share) / 100) {
+
+            corpus.push_back(revalidate[i % revalidate.size()]);
+        }
+        else {
+
+            corpus.push_back(fresh[i % fresh.size()]);
+        }
+    }
+
+    return corpus;
+}
+
+bool send_next(client* c, const std::vector<corpus_request>& corpus) {
+
+    const corpus_request& r = corpus[c->next];
+
+    c->next = (c->next + 1) % corpus.size();
+    c->status = r.status;
+
+    return send(c->sockfd, r.text.data(), r.text.size(), 0) == (ssize_t) r.text.size();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 5) {
+
+        printf("usage: %s ip_address port_number connection_number seconds path...\n", basename(argv[0]));
+        return 1;
+    }
+
+    int num = atoi(argv[3]);
+    double duration = atof(argv[4]);
+
+    assert((num > 0) && (num <= MAX_CONN_NUMBER));
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[1], &address.sin_addr);
+    address.sin_port = htons(atoi(argv[2]));
+
+    std::vector<corpus_request> fresh;
+    std::vector<corpus_request> revalidate;
+
+    for (int i = 5; i < argc; ++i) {
+
+        learn(address, argv[i], fresh, revalidate);
+    }
+
+    client* clients = new client[num];
+
+    for (int i = 0; i < num; ++i) {
+
+        clients[i].sockfd = connect_to(address);
+        clients[i].next = i;
+        clients[i].buf = new char[BUFFER_SIZE];
+    }
+
+    int shares[3] = { 0, 50, 90 };
+
+    for (int s = 0; s < 3; ++s) {
+
+        std::vector<corpus_request> corpus = build_corpus(fresh, revalidate, shares[s]);
+
+        int epoll_fd = epoll_create(100);
+        assert(epoll_fd >= 0);
+
+        for (int i = 0; i < num; ++i) {
+
+            epoll_event event;
+
+            event.data.ptr = clients + i;
+            event.events = EPOLLIN;
+
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].sockfd, &event);
+
+            clients[i].len = 0;
+            clients[i].skip = 0;
+            clients[i].next %= corpus.size();
+
+            send_next(clients + i, corpus);
+        }
+
+        epoll_event events[MAX_CONN_NUMBER];
+
+        long responses = 0;
+        long not_modified = 0;
+        long bytes = 0;
+        long wrong = 0;
+
+        double start = now_seconds();
+        bool stopping = false;
+        int in_flight = num;
+
+        // After the time is up, no new requests are sent and the ones in flight are drained.
+        while (in_flight > 0) {
+
+            stopping = stopping or (now_seconds() - start >= duration);
+
+            int fds = epoll_wait(epoll_fd, events, MAX_CONN_NUMBER, 100);
+
+            for (int i = 0; i < fds; ++i) {
+
+                client* c = (client*) events[i].data.ptr;
+
+                int ret = recv(c->sockfd, c->buf + c->len, BUFFER_SIZE - 1 - c->len, 0);
+
+                if (ret <= 0) {
+
+                    printf("connection closed by the server\n");
+                    return 1;
+                }
+
+                c->len += ret;
+
+                long size = 0;
+                int status = consume_response(c, &size);
+
+                if (status == 0) continue;
+
+                ++responses;
+                bytes += size;
+
+                if (status == 304) ++not_modified;
+                if (status != c->status) ++wrong;
+
+                if (stopping) {
+
+                    --in_flight;
+                }
+                else if (!send_next(c, corpus)) {
+
+                    printf("send failure\n");
+                    return 1;
+                }
+            }
+        }
+
+        double elapsed = now_seconds() - start;
+
+        close(epoll_fd);
+
+        printf("%2d%% revalidations: %.0f req/s, %ld responses (%ld 304), %.0f bytes per response, %ld with a wrong status\n",
+               shares[s], responses / elapsed, responses, not_modified, (double) bytes / responses, wrong);
+
+        if (wrong > 0) return 1;
+    }
+
+    for (int i = 0; i < num; ++i) {
+
+        close(clients[i].sockfd);
+        delete[] clients[i].buf;
+    }
+
+    delete[] clients;
+
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <zlib.h>
+#include <brotli/encode.h>
+
+#include "15-10 file_cache.h"
+
+// Offline compressor of a document root, so that WebServer started with precompressed = 1 never compresses
+// on the request path. Every regular file gets a "file.br" and a "file.gz" sidecar next to it, made with the
+// highest compression level, with the permissions and the modification time of the file. A sidecar that is
+// already up to date is left alone, so running the tool again only compresses what changed, and a sidecar
+// that would not be smaller than the file is not written (and a stale one is removed), since sending it would
+// not save anything. The files are shared out to one thread per core, the largest first.
+//
+// Build with: g++ -std=c++14 -O2 -pthread "16-11 precompress.cpp" -o precompress -lz -lbrotlienc
+
+// A file to compress.
+struct source_file {
+
+    std::string path;
+    struct stat st;
+};
+
+// What the threads did, per coding.
+struct coding_stats {
+
+    std::atomic<long> written;      // Sidecars written.
+    std::atomic<long> current;      // Sidecars already up to date.
+    std::atomic<long> skipped;      // Files for which the sidecar would not be smaller.
+    std::atomic<long> bytes_in;     // Size of the files compressed.
+    std::atomic<long> bytes_out;    // Size of the sidecars written.
+};
+
+static std::vector<source_file> files;
+static std::atomic<size_t> next_file(0);
+static coding_stats stats[CODING_NUMBER];
+static std::atomic<long> failures(0);
+
+// Files smaller than this are not worth a sidecar: their headers cost more than compression saves.
+static off_t min_size = 256;
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool is_sidecar(const char* path) {
+
+    int len = strlen(path);
+
+    for (int i = 0; i < CODING_NUMBER; ++i) {
+
+        int suffix_len = strlen(coding_suffixes[i]);
+
+        if ((len > suffix_len) && (strcmp(path + len - suffix_len, coding_suffixes[i]) == 0)) return true;
+    }
+
+    return false;
+}
+
+int collect(const char* path, const struct stat* st, int type, struct FTW*) {
+
+    if ((type == FTW_F) && S_ISREG(st->st_mode) && (st->st_size >= min_size) && !is_sidecar(path)) {
+
+        files.push_back(source_file { path, *st });
+    }
+
+    return 0;
+}
+
+// Compress 'size' bytes at 'data' into 'out' with the given coding. Returns false on failure.
+bool compress(int coding, const char* data, size_t size, std::string& out) {
+
+    if (coding == CODING_BR) {
+
+        size_t out_size = BrotliEncoderMaxCompressedSize(size);
+
+        out.resize(out_size ? out_size : size + 1024);
+
+        if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC,
+                                   size, (const uint8_t*) data, &out_size, (uint8_t*) &out[0])) {
+
+            return false;
+        }
+
+        out.resize(out_size);
+
+        return true;
+    }
+
+    z_stream stream;
+    memset(&stream, '\0', sizeof(stream));
+
+    // A window of 15 bits plus 16 asks zlib for the gzip format rather than a raw zlib stream.
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+    out.resize(deflateBound(&stream, size));
+
+    stream.next_in = (Bytef*) data;
+    stream.avail_in = size;
+    stream.next_out = (Bytef*) &out[0];
+    stream.avail_out = out.size();
+
+    int ret = deflate(&stream, Z_FINISH);
+
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return ret == Z_STREAM_END;
+}
+
+// Whether the file is worth compressing at the highest level: its first PROBE_SIZE bytes must shrink by at least
+// a twentieth at the fastest gzip level. Media and archives, which are compressed already, fail this quickly
+// instead of costing the full compression on every run.
+static const size_t PROBE_SIZE = 64 * 1024;
+
+bool compressible(const char* data, size_t size) {
+
+    size = std::min(size, PROBE_SIZE);
+
+    uLongf out_size = compressBound(size);
+    std::vector<Bytef> out(out_size);
+
+    if (compress2(out.data(), &out_size, (const Bytef*) data, size, Z_BEST_SPEED) != Z_OK) return true;
+
+    return out_size < size - size / 20;
+}
+
+// Write 'data' to the sidecar 'path' through a temporary file, so the server never sees half of it,
+// with the permissions and the modification time of the source file.
+bool write_sidecar(const std::string& path, const std::string& data, const struct stat& st) {
+
+    std::string temp = path + ".XXXXXX";
+
+    int fd = mkstemp(&temp[0]);
+
+    if (fd < 0) return false;
+
+    size_t done = 0;
+
+    while (done < data.size()) {
+
+        ssize_t ret = write(fd, data.data() + done, data.size() - done);
+
+        if (ret <= 0) break;
+
+        done += ret;
+    }
+
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+
+    bool ok = (done == data.size()) && (fchmod(fd, st.st_mode & 07777) == 0) && (futimens(fd, times) == 0);
+
+    ok = (close(fd) == 0) && ok;
+    ok = ok && (rename(temp.c_str(), path.c_str()) == 0);
+
+    if (!ok) unlink(temp.c_str());
+
+    return ok;
+}
+
+// Whether the sidecar 'path' was made from this version of the source file.
+bool up_to_date(const std::string& path, const struct stat& st) {
+
+    struct stat sidecar_st;
+
+    return (stat(path.c_str(), &sidecar_st) == 0) && (sidecar_st.st_mtim.tv_sec == st.st_mtim.tv_sec) &&
+           (sidecar_st.st_mtim.tv_nsec == st.st_mtim.tv_nsec);
+}
+
+void precompress(const source_file& file) {
+
+    std::string sidecars[CODING_NUMBER];
+    bool needed = false;
+
+    for (int i = 0; i < CODING_NUMBER; ++i) {
+
+        sidecars[i] = file.path + coding_suffixes[i];
+
+        if (up_to_date(sidecars[i], file.st)) {
+
+            ++stats[i].current;
+        }
+        else {
+
+            needed = true;
+        }
+    }
+
+    if (!needed) return;
+
+    int fd = open(file.path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+
+        ++failures;
+        return;
+    }
+
+    void* data = mmap(0, file.st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+
+        ++failures;
+        return;
+    }
+
+    bool worth = compressible((const char*) data, file.st.st_size);
+
+    std::string out;
+
+    for (int i = 0; i < CODING_NUMBER; ++i) {
+
+        if (up_to_date(sidecars[i], file.st)) continue;
+
+        if (!worth) {
+
+            unlink(sidecars[i].c_str());
+
+            ++stats[i].skipped;
+            continue;
+        }
+
+        if (!compress(i, (const char*) data, file.st.st_size, out)) {
+
+            ++failures;
+            continue;
+        }
+
+        if ((off_t) out.size() >= file.st.st_size) {
+
+            unlink(sidecars[i].c_str());
+
+            ++stats[i].skipped;
+            continue;
+        }
+
+        if (!write_sidecar(sidecars[i], out, file.st)) {
+
+            ++failures;
+            continue;
+        }
+
+        ++stats[i].written;
+        stats[i].bytes_in += file.st.st_size;
+        stats[i].bytes_out += out.size();
+    }
+
+    munmap(data, file.st.st_size);
+}
+
+void* worker(void*) {
+
+    while (true) {
+
+        size_t i = next_file++;
+
+        if (i >= files.size()) break;
+
+        precompress(files[i]);
+    }
+
+    return nullptr;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 1) {
+
+        printf("usage: %s doc_root [thread_number [min_size]]\n", basename(argv[0]));
+        return 1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int thread_number = (argc > 2) ? atoi(argv[2]) : (int) ((cores > 0) ? cores : 1);
+
+    if (argc > 3) min_size = atol(argv[3]);
+
+    assert(thread_number > 0);
+
+    if (nftw(argv[1], collect, 64, FTW_PHYS) != 0) {
+
+        printf("can not walk %s\n", argv[1]);
+        return 1;
+    }
+
+    // The largest files first, so that no thread is left compressing a big one alone at the end.
+    std::sort(files.begin(), files.end(), [](const source_file& a, const source_file& b) { return a.st.st_size > b.st.st_size; });
+
+    double start = now_seconds();
+
+    std::vector<pthread_t> threads(thread_number);
+
+    for (int i = 0; i < thread_number; ++i) {
+
+        int ret = pthread_create(&threads[i], nullptr, worker, nullptr);
+        assert(ret == 0);
+    }
+
+    for (int i = 0; i < thread_number; ++i) {
+
+        pthread_join(threads[i], nullptr);
+    }
+
+    double elapsed = now_seconds() - start;
+
+    printf("%zu files with %d threads in %.2f s\n", files.size(), thread_number, elapsed);
+
+    for (int i = 0; i < CODING_NUMBER; ++i) {
+
+        long in = stats[i].bytes_in;
+        long out = stats[i].bytes_out;
+
+        printf("%-4s %ld written (%ld -> %ld bytes, %.1f%%), %ld up to date, %ld not smaller\n", coding_names[i],
+               stats[i].written.load(), in, out, in ? 100.0 * out / in : 0.0, stats[i].current.load(), stats[i].skipped.load());
+    }
+
+    if (failures > 0) {
+
+        printf("%ld failures\n", failures.load());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#include "11-2 lst_timer.h"
+#include "11-5 time_wheel_timer.h"
+#include "11-6 timeHeap.h"
+#include "11-7 hierarchical_wheel.h"
+#include "11-8 indexed_heap.h"
+
+// Microbenchmark of the timer containers: the sorted list of code listing 11-2, the time wheel of 11-5,
+// the time heap of 11-6, the hierarchical wheel of 11-7 and the indexed 4-ary heap of 11-8. Each one is
+// loaded with the same timers, with deadlines spread uniformly over an hour, and then goes through four
+// phases, each timed per operation:
+//   add       create every timer;
+//   adjust    push back the deadline of timers picked at random, as a server does on every request;
+//   cancel    delete half of the timers, as when connections close before their timeout;
+//   expire    move time forward until every remaining timer has run.
+// The sorted list costs O(n) per add and adjust, so it is run with fewer timers (list_number) to finish at all.
+
+// The longest timeout, and the most an adjustment pushes a deadline back, in milliseconds.
+static const uint64_t MAX_TIMEOUT = 3600 * 1000;
+static const uint64_t MAX_EXTENSION = 60 * 1000;
+
+static long expired = 0;
+
+// The same random workload for every container.
+struct workload {
+
+    std::vector<uint64_t> timeouts;     // Deadline of each timer, in milliseconds from the start.
+    std::vector<int> adjusted;          // Timer pushed back by each adjustment.
+    std::vector<uint64_t> extensions;   // By how much.
+    std::vector<int> cancelled;         // Timers deleted, all different.
+};
+
+// Per-phase results, in nanoseconds per operation.
+struct result {
+
+    double add;
+    double adjust;
+    double cancel;
+    double expire;
+};
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+uint64_t next_random() {
+
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return rng_state;
+}
+
+workload make_workload(int n) {
+
+    workload w;
+
+    for (int i = 0; i < n; ++i) {
+
+        w.timeouts.push_back(1000 + next_random() % (MAX_TIMEOUT - 1000));
+        w.adjusted.push_back(next_random() % n);
+        w.extensions.push_back(1 + next_random() % MAX_EXTENSION);
+        w.cancelled.push_back(i);
+    }
+
+    // A random half of the timers, without repeats.
+    for (int i = n - 1; i > 0; --i) {
+
+        std::swap(w.cancelled[i], w.cancelled[next_random() % (i + 1)]);
+    }
+
+    w.cancelled.resize(n / 2);
+
+    return w;
+}
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double per_op(double start, long ops) {
+
+    return (now_seconds() - start) * 1e9 / ops;
+}
+
+void count(int*) { ++expired; }
+
+// The list and the heap keep absolute deadlines in seconds of time(), and their tick() expires whatever is due
+// at the current time(). The deadlines are therefore placed in the past, keeping their order, so that one
+// tick() expires them all.
+time_t past_base() {
+
+    return time(nullptr) - 2 * (MAX_TIMEOUT + MAX_EXTENSION) / 1000;
+}
+
+result bench_lst(const workload& w) {
+
+    result r;
+    int n = w.timeouts.size();
+    time_t base = past_base();
+
+    sort_timer_lst<int> timers;
+    std::vector<util_timer<int>*> handles(n);
+    std::vector<uint64_t> deadlines(w.timeouts);
+
+    double start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        util_timer<int>* timer = new util_timer<int>;
+
+        timer->expire = base + deadlines[i] / 1000;
+        timer->cb_func = count;
+        timer->user_data = nullptr;
+
+        timers.add_timer(timer);
+        handles[i] = timer;
+    }
+
+    r.add = per_op(start, n);
+    start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        int k = w.adjusted[i];
+
+        deadlines[k] += w.extensions[i];
+        handles[k]->expire = base + deadlines[k] / 1000;
+
+        timers.adjust_timer(handles[k]);
+    }
+
+    r.adjust = per_op(start, n);
+    start = now_seconds();
+
+    for (size_t i = 0; i < w.cancelled.size(); ++i) {
+
+        timers.del_timer(handles[w.cancelled[i]]);
+    }
+
+    r.cancel = per_op(start, w.cancelled.size());
+    start = now_seconds();
+
+    timers.tick();
+
+    r.expire = per_op(start, n - w.cancelled.size());
+
+    return r;
+}
+
+result bench_wheel(const workload& w) {
+
+    result r;
+    int n = w.timeouts.size();
+
+    time_wheel<int> timers;
+    std::vector<tw_timer<int>*> handles(n);
+    std::vector<uint64_t> deadlines(w.timeouts);
+
+    double start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        tw_timer<int>* timer = timers.add_timer(deadlines[i] / 1000);
+
+        timer->cb_func = count;
+        handles[i] = timer;
+    }
+
+    r.add = per_op(start, n);
+    start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        int k = w.adjusted[i];
+
+        deadlines[k] += w.extensions[i];
+
+        timers.adjust_timer(handles[k], deadlines[k] / 1000);
+    }
+
+    r.adjust = per_op(start, n);
+    start = now_seconds();
+
+    for (size_t i = 0; i < w.cancelled.size(); ++i) {
+
+        timers.del_timer(handles[w.cancelled[i]]);
+    }
+
+    r.cancel = per_op(start, w.cancelled.size());
+    start = now_seconds();
+
+    // One tick per second of the longest deadline.
+    uint64_t last = *std::max_element(deadlines.begin(), deadlines.end()) / 1000;
+
+    for (uint64_t t = 0; t <= last; ++t) {
+
+        timers.tick();
+    }
+
+    r.expire = per_op(start, n - w.cancelled.size());
+
+    return r;
+}
+
+result bench_heap(const workload& w) {
+
+    result r;
+    int n = w.timeouts.size();
+    time_t base = past_base();
+
+    time_heap<int> timers(64);
+    std::vector<heap_timer<int>*> handles(n);
+    std::vector<uint64_t> deadlines(w.timeouts);
+
+    double start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        heap_timer<int>* timer = new heap_timer<int>(0);
+
+        timer->expire = base + deadlines[i] / 1000;
+        timer->cb_func = count;
+        timer->user_data = nullptr;
+
+        timers.add_timer(timer);
+        handles[i] = timer;
+    }
+
+    r.add = per_op(start, n);
+    start = now_seconds();
+
+    // The heap cannot move a timer: an adjustment cancels it and adds a new one, and the cancelled one stays
+    // in the heap until it reaches the top.
+    for (int i = 0; i < n; ++i) {
+
+        int k = w.adjusted[i];
+
+        deadlines[k] += w.extensions[i];
+
+        heap_timer<int>* timer = new heap_timer<int>(0);
+
+        timer->expire = base + deadlines[k] / 1000;
+        timer->cb_func = count;
+        timer->user_data = nullptr;
+
+        timers.del_timer(handles[k]);
+        timers.add_timer(timer);
+        handles[k] = timer;
+    }
+
+    r.adjust = per_op(start, n);
+    start = now_seconds();
+
+    for (size_t i = 0; i < w.cancelled.size(); ++i) {
+
+        timers.del_timer(handles[w.cancelled[i]]);
+    }
+
+    r.cancel = per_op(start, w.cancelled.size());
+    start = now_seconds();
+
+    timers.tick();
+
+    r.expire = per_op(start, n - w.cancelled.size());
+
+    return r;
+}
+
+result bench_hw(const workload& w) {
+
+    result r;
+    int n = w.timeouts.size();
+
+    hierarchical_wheel<int> timers(0);
+    std::vector<hw_timer<int>*> handles(n);
+    std::vector<uint64_t> deadlines(w.timeouts);
+
+    double start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        hw_timer<int>* timer = timers.add_timer(deadlines[i]);
+
+        timer->cb_func = count;
+        handles[i] = timer;
+    }
+
+    r.add = per_op(start, n);
+    start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        int k = w.adjusted[i];
+
+        deadlines[k] += w.extensions[i];
+
+        timers.adjust_timer(handles[k], deadlines[k]);
+    }
+
+    r.adjust = per_op(start, n);
+    start = now_seconds();
+
+    for (size_t i = 0; i < w.cancelled.size(); ++i) {
+
+        timers.del_timer(handles[w.cancelled[i]]);
+    }
+
+    r.cancel = per_op(start, w.cancelled.size());
+    start = now_seconds();
+
+    timers.advance(*std::max_element(deadlines.begin(), deadlines.end()));
+
+    r.expire = per_op(start, n - w.cancelled.size());
+
+    return r;
+}
+
+result bench_ih(const workload& w) {
+
+    result r;
+    int n = w.timeouts.size();
+    time_t base = time(nullptr);
+
+    indexed_heap<int> timers;
+    std::vector<ih_timer<int>*> handles(n);
+    std::vector<uint64_t> deadlines(w.timeouts);
+
+    double start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        ih_timer<int>* timer = timers.add_timer(deadlines[i] / 1000);
+
+        timer->cb_func = count;
+        handles[i] = timer;
+    }
+
+    r.add = per_op(start, n);
+    start = now_seconds();
+
+    for (int i = 0; i < n; ++i) {
+
+        int k = w.adjusted[i];
+
+        deadlines[k] += w.extensions[i];
+
+        timers.adjust_timer(handles[k], deadlines[k] / 1000);
+    }
+
+    r.adjust = per_op(start, n);
+    start = now_seconds();
+
+    for (size_t i = 0; i < w.cancelled.size(); ++i) {
+
+        timers.del_timer(handles[w.cancelled[i]]);
+    }
+
+    r.cancel = per_op(start, w.cancelled.size());
+    start = now_seconds();
+
+    timers.tick(base + 2 * (MAX_TIMEOUT + MAX_EXTENSION) / 1000);
+
+    r.expire = per_op(start, n - w.cancelled.size());
+
+    return r;
+}
+
+void report(const char* name, int n, result (*bench)(const workload&)) {
+
+    workload w = make_workload(n);
+
+    expired = 0;
+
+    result r = bench(w);
+
+    long expected = n - (long) w.cancelled.size();
+
+    printf("%-20s %8d %10.1f %10.1f %10.1f %10.1f   %s\n", name, n, r.add, r.adjust, r.cancel, r.expire,
+           (expired == expected) ? "ok" : "WRONG EXPIRY COUNT");
+
+    if (expired != expected) exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    int timer_number = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int list_number = (argc > 2) ? atoi(argv[2]) : 20000;
+
+    assert((timer_number > 1) && (list_number > 1));
+
+    printf("%-20s %8s %10s %10s %10s %10s   (ns per operation)\n", "container", "timers", "add", "adjust", "cancel", "expire");
+
+    report("sorted list (11-2)", list_number, bench_lst);
+    report("time wheel (11-5)", timer_number, bench_wheel);
+    report("time heap (11-6)", timer_number, bench_heap);
+    report("hier. wheel (11-7)", timer_number, bench_hw);
+    report("indexed heap (11-8)", timer_number, bench_ih);
+
+    return 0;
+}
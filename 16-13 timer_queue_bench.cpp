@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <queue>
+#include <vector>
+
+#include "11-9 timer_queue.h"
+
+// Test harness of the timer queue of code listing 11-9. Every backend is driven for the same number of seconds
+// by the same synthetic workload of idle timeouts. A set of connections each holds a timer set to IDLE_TIMEOUT;
+// most of them send a request now and then, which pushes their timer back, and a few go silent, so their timer
+// expires. A connection whose timer expired, and one that closes on its own (which deletes its timer),
+// is replaced by a new one. Then all timers are deleted and the queue is watched while idle.
+// For each backend the harness reports the timerfd wakeups and arms, how late the timers ran,
+// the CPU time of the run, and the wakeups while idle. The workload itself costs the same for every backend.
+
+static const uint64_t IDLE_TIMEOUT = 2000000;      // Microseconds.
+static const uint64_t MAX_REQUEST_GAP = 1000000;   // Longest pause of an active connection between requests.
+static const int SILENT_PERCENT = 10;              // Share of the connections that never send a request.
+static const int CLOSE_PERCENT = 1;                // Chance that a request is the last one of its connection.
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+uint64_t next_random() {
+
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return rng_state;
+}
+
+double cpu_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What one run measured.
+struct run_stats {
+
+    long expired;          // Timers run.
+    long adjusted;         // Timers pushed back by a request.
+    long deleted;          // Timers deleted by a connection closing.
+    double late_sum;       // Sum of the delays between the deadline and the run of each timer, in microseconds.
+    double late_max;
+};
+
+static run_stats stats;
+
+// The next request of a connection.
+struct activity {
+
+    uint64_t time;
+    int index;
+    unsigned generation;   // Generation of the connection it was scheduled for.
+
+    bool operator<(const activity& other) const { return time > other.time; }
+};
+
+template<template<typename> class Backend>
+class harness {
+public:
+    // A simulated connection.
+    struct connection {
+
+        typename Backend<connection>::timer* timer;
+        uint64_t deadline;     // When its timer is due.
+        unsigned generation;   // Incremented every time the connection is replaced.
+        int index;
+        harness* owner;
+    };
+
+    harness(int connection_number) : conns(connection_number) {
+
+        for (int i = 0; i < connection_number; ++i) {
+
+            conns[i].index = i;
+            conns[i].generation = 0;
+            conns[i].owner = this;
+
+            open(i, timer_clock());
+        }
+    }
+
+    // Drive the queue for 'seconds', then delete all timers and watch it for 'idle_seconds'.
+    void run(double seconds, double idle_seconds) {
+
+        int epollfd = epoll_create(5);
+        assert(epollfd != -1);
+
+        epoll_event event;
+
+        event.data.fd = timers.fd();
+        event.events = EPOLLIN;
+
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, timers.fd(), &event);
+
+        double cpu = cpu_seconds();
+        uint64_t end = timer_clock() + (uint64_t) (seconds * 1e6);
+
+        while (true) {
+
+            uint64_t now = timer_clock();
+
+            if (now >= end) break;
+
+            // Send the requests that are due.
+            while (!requests.empty() && (requests.top().time <= now)) {
+
+                activity a = requests.top();
+                requests.pop();
+
+                if (a.generation == conns[a.index].generation) request(a.index, now);
+            }
+
+            uint64_t next = requests.empty() ? end : std::min(requests.top().time, end);
+            int timeout = (next > now) ? (int) ((next - now + 999) / 1000) : 0;
+
+            epoll_event events[1];
+
+            if (epoll_wait(epollfd, events, 1, timeout) > 0) {
+
+                timers.handle_expiry();
+            }
+        }
+
+        cpu = cpu_seconds() - cpu;
+
+        long wakeups = timers.wakeup_count();
+        long arms = timers.arm_count();
+
+        for (size_t i = 0; i < conns.size(); ++i) {
+
+            timers.del_timer(conns[i].timer);
+        }
+
+        // The queue has no timers left, so it must stay quiet apart from a deadline armed before the deletes.
+        uint64_t idle_end = timer_clock() + (uint64_t) (idle_seconds * 1e6);
+
+        while (timer_clock() < idle_end) {
+
+            epoll_event events[1];
+
+            if (epoll_wait(epollfd, events, 1, (int) ((idle_end - timer_clock()) / 1000) + 1) > 0) {
+
+                timers.handle_expiry();
+            }
+        }
+
+        close(epollfd);
+
+        printf("%7.0f %7.0f %7ld %9.0f %9.0f %9.2f %5ld\n", wakeups / seconds, arms / seconds, stats.expired,
+               stats.expired ? stats.late_sum / stats.expired / 1000 : 0.0, stats.late_max / 1000, cpu,
+               timers.wakeup_count() - wakeups);
+    }
+
+private:
+    typedef timer_queue<Backend<connection>> queue;
+
+    // Give connection 'i' a new timer and decide whether it will be active or silent.
+    void open(int i, uint64_t now) {
+
+        connection& c = conns[i];
+
+        c.deadline = now + IDLE_TIMEOUT;
+        c.timer = timers.add_timer(IDLE_TIMEOUT, expire, &c);
+
+        if ((int) (next_random() % 100) >= SILENT_PERCENT) {
+
+            requests.push(activity { now + 1 + next_random() % MAX_REQUEST_GAP, i, c.generation });
+        }
+    }
+
+    // Connection 'i' sends a request: it pushes its timer back, or closes.
+    void request(int i, uint64_t now) {
+
+        connection& c = conns[i];
+
+        if ((int) (next_random() % 100) < CLOSE_PERCENT) {
+
+            timers.del_timer(c.timer);
+            ++stats.deleted;
+
+            ++c.generation;
+            open(i, now);
+
+            return;
+        }
+
+        c.deadline = now + IDLE_TIMEOUT;
+        c.timer = timers.adjust_timer(c.timer, IDLE_TIMEOUT);
+        ++stats.adjusted;
+
+        requests.push(activity { now + 1 + next_random() % MAX_REQUEST_GAP, i, c.generation });
+    }
+
+    // Timer callback: the connection timed out and is replaced.
+    static void expire(connection* c) {
+
+        uint64_t now = timer_clock();
+        double late = (now > c->deadline) ? (double) (now - c->deadline) : 0.0;
+
+        ++stats.expired;
+        stats.late_sum += late;
+
+        if (late > stats.late_max) stats.late_max = late;
+
+        ++c->generation;
+        c->owner->open(c->index, now);
+    }
+
+    std::vector<connection> conns;
+    std::priority_queue<activity> requests;
+
+    queue timers;
+};
+
+template<template<typename> class Backend>
+void report(const char* name, int connection_number, double seconds) {
+
+    stats = run_stats();
+    rng_state = 88172645463325252ULL;
+
+    printf("%-22s ", name);
+    fflush(stdout);
+
+    harness<Backend>* h = new harness<Backend>(connection_number);
+
+    h->run(seconds, 1.0);
+
+    delete h;
+}
+
+int main(int argc, char* argv[])
+{
+    int connection_number = (argc > 1) ? atoi(argv[1]) : 10000;
+    double seconds = (argc > 2) ? atof(argv[2]) : 5.0;
+
+    assert((connection_number > 0) && (seconds > 0));
+
+    printf("%d connections, %.1f s per backend, idle timeout %.1f s\n", connection_number, seconds, IDLE_TIMEOUT / 1e6);
+    printf("%-22s %7s %7s %7s %9s %9s %9s %5s\n", "backend", "wake/s", "arm/s", "expired", "late avg", "late max", "cpu s", "idle");
+    printf("%-22s %7s %7s %7s %9s %9s %9s %5s\n", "", "", "", "", "(ms)", "(ms)", "", "wakes");
+
+    report<list_backend>("sorted list (11-2)", connection_number, seconds);
+    report<wheel_backend>("time wheel (11-5)", connection_number, seconds);
+    report<heap_backend>("time heap (11-6)", connection_number, seconds);
+    report<hierarchical_backend>("hier. wheel (11-7)", connection_number, seconds);
+    report<indexed_heap_backend>("indexed heap (11-8)", connection_number, seconds);
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+// Benchmark of the connection rate of a server under bursts of new connections. Connections are opened in
+// bursts of 'burst' nonblocking connects at once; each one sends a single request with "Connection: close" and
+// reads until the server closes it, and the next burst starts when the whole burst is done. The test reports
+// the connections completed per second and the percentiles of the time from connect to the end of the response.
+// A connection that is not done within CONN_TIMEOUT seconds counts as stuck. Sockets are closed with SO_LINGER 0,
+// so that the client side leaves no TIME_WAIT behind and a long run does not run out of local ports.
+// With 'heavy_every' and 'heavy_path', every heavy_every-th connection asks for heavy_path instead, an expensive
+// request (16-15 pool_bench spins on "/spin/<microseconds>"), and the percentiles of the others are given apart.
+
+static const char* request = "GET /index.html HTTP/1.1\r\nConnection: close\r\n\r\n";
+static char heavy_request[256];
+
+static const int MAX_BURST = 16384;
+static const double CONN_TIMEOUT = 10.0;
+
+// A client connection in flight.
+struct client {
+
+    int sockfd;
+    double start;
+    bool sent;
+    bool heavy;
+};
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Close a socket with a reset, so that it does not linger in TIME_WAIT.
+void abort_close(int sockfd) {
+
+    struct linger tmp = {1, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+
+    close(sockfd);
+}
+
+double percentile(std::vector<double>& sorted, double p) {
+
+    if (sorted.empty()) return 0.0;
+
+    return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 4) {
+
+        printf("usage: %s ip_address port_number burst total [heavy_every heavy_path]\n", basename(argv[0]));
+        return 1;
+    }
+
+    int burst = atoi(argv[3]);
+    int total = atoi(argv[4]);
+    int heavy_every = (argc > 6) ? atoi(argv[5]) : 0;
+
+    if (heavy_every > 0) {
+
+        snprintf(heavy_request, sizeof(heavy_request), "GET %s HTTP/1.1\r\nConnection: close\r\n\r\n", argv[6]);
+    }
+
+    assert((burst > 0) && (burst <= MAX_BURST) && (total > 0));
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[1], &address.sin_addr);
+    address.sin_port = htons(atoi(argv[2]));
+
+    int epoll_fd = epoll_create(100);
+    assert(epoll_fd >= 0);
+
+    std::vector<client> clients(burst);
+    std::vector<double> latencies;
+    std::vector<double> light_latencies;
+    epoll_event* events = new epoll_event[burst];
+
+    int done = 0;
+    int stuck = 0;
+    int failed = 0;
+    int started = 0;
+
+    double start = now_seconds();
+
+    while (done + stuck + failed < total) {
+
+        int n = std::min(burst, total - done - stuck - failed);
+        int in_flight = 0;
+
+        for (int i = 0; i < n; ++i) {
+
+            client& c = clients[i];
+
+            c.sockfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            assert(c.sockfd >= 0);
+
+            c.start = now_seconds();
+            c.sent = false;
+            c.heavy = (heavy_every > 0) && (started++ % heavy_every == 0);
+
+            if ((connect(c.sockfd, (struct sockaddr*)& address, sizeof(address)) != 0) && (errno != EINPROGRESS)) {
+
+                abort_close(c.sockfd);
+                ++failed;
+                continue;
+            }
+
+            epoll_event event;
+
+            event.data.ptr = &c;
+            event.events = EPOLLOUT | EPOLLIN;
+
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.sockfd, &event);
+            ++in_flight;
+        }
+
+        double deadline = now_seconds() + CONN_TIMEOUT;
+
+        while ((in_flight > 0) && (now_seconds() < deadline)) {
+
+            int fds = epoll_wait(epoll_fd, events, burst, 100);
+
+            for (int i = 0; i < fds; ++i) {
+
+                client* c = (client*) events[i].data.ptr;
+
+                if (!c->sent && (events[i].events & EPOLLOUT)) {
+
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+
+                    getsockopt(c->sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+                    const char* text = c->heavy ? heavy_request : request;
+
+                    if ((err != 0) or (send(c->sockfd, text, strlen(text), 0) != (ssize_t) strlen(text))) {
+
+                        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sockfd, 0);
+                        abort_close(c->sockfd);
+                        c->sockfd = -1;
+
+                        ++failed;
+                        --in_flight;
+                        continue;
+                    }
+
+                    c->sent = true;
+
+                    epoll_event event;
+
+                    event.data.ptr = c;
+                    event.events = EPOLLIN;
+
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->sockfd, &event);
+                    continue;
+                }
+
+                if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+
+                char buf[4096];
+                int ret = 0;
+
+                while ((ret = recv(c->sockfd, buf, sizeof(buf), 0)) > 0) {}
+
+                if ((ret < 0) && (errno == EAGAIN)) continue;
+
+                // The server closed the connection: the response is complete (or the connection was refused).
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sockfd, 0);
+                abort_close(c->sockfd);
+                c->sockfd = -1;
+
+                if (c->sent) {
+
+                    latencies.push_back(now_seconds() - c->start);
+                    ++done;
+
+                    if (!c->heavy) {
+
+                        light_latencies.push_back(latencies.back());
+                    }
+                }
+                else {
+
+                    ++failed;
+                }
+
+                --in_flight;
+            }
+        }
+
+        // Whatever is left of the burst did not complete in time.
+        for (int i = 0; i < n; ++i) {
+
+            if (clients[i].sockfd >= 0) {
+
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, clients[i].sockfd, 0);
+                abort_close(clients[i].sockfd);
+                clients[i].sockfd = -1;
+
+                ++stuck;
+            }
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("burst %d: %d done, %d stuck, %d failed in %.2f s: %.0f conn/s, latency p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           burst, done, stuck, failed, elapsed, done / elapsed, percentile(latencies, 0.5) * 1000,
+           percentile(latencies, 0.99) * 1000, latencies.empty() ? 0.0 : latencies.back() * 1000);
+
+    if (heavy_every > 0) {
+
+        std::sort(light_latencies.begin(), light_latencies.end());
+
+        printf("light requests: latency p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n",
+               percentile(light_latencies, 0.5) * 1000, percentile(light_latencies, 0.99) * 1000,
+               percentile(light_latencies, 0.999) * 1000, light_latencies.empty() ? 0.0 : light_latencies.back() * 1000);
+    }
+
+    delete[] events;
+    close(epoll_fd);
+
+    return (stuck > 0 or failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include "15-1 processpool.h"
+
+// A server on the process pool of code listing 15-1 for benchmarking how the pool hands connections to its
+// children, with 16-14 accept_bench as the client. Each connection gets a fixed response to its request and is
+// closed, so the pool does little else than accepting and dispatching. The dispatch mode is DISPATCH_NOTIFY (0),
+// the notification of the child that then accepts, or DISPATCH_PASS_FD (1), the accept by the parent that passes
+// the connections on. Each child prints, when it stops, the connections it got and the times it was woken up
+// for new ones in vain. The optional select_policy is the SELECT_POLICY of the parent, round robin (0) by default.
+// A request for "/spin/<microseconds>" keeps its child busy for that long before the response, which makes
+// a mix of cheap and expensive requests with 16-14 accept_bench. A request for "/crash" aborts its child, which
+// the pool then respawns. The optional affinity is the CPU_AFFINITY of the children, none (0) by default.
+
+static const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+
+class bench_conn {
+public:
+    bench_conn() {}
+    ~bench_conn() {}
+
+    void init(int epollfd, int sockfd, const sockaddr_in&) {
+
+        m_epollfd = epollfd;
+        m_sockfd = sockfd;
+        m_read_idx = 0;
+    }
+
+    // Read until the end of the request headers, answer and close.
+    void process() {
+
+        while (true) {
+
+            int ret = recv(m_sockfd, m_buf + m_read_idx, BUFFER_SIZE - 1 - m_read_idx, 0);
+
+            if (ret < 0) {
+
+                if (errno != EAGAIN) {
+
+                    removefd(m_epollfd, m_sockfd);
+                }
+
+                break;
+            }
+            else if (ret == 0) {
+
+                removefd(m_epollfd, m_sockfd);
+                break;
+            }
+
+            m_read_idx += ret;
+            m_buf[m_read_idx] = '\0';
+
+            if (strstr(m_buf, "\r\n\r\n") or (m_read_idx == BUFFER_SIZE - 1)) {
+
+                if (strncmp(m_buf, "GET /crash", 10) == 0) abort();
+
+                spin();
+
+                send(m_sockfd, response, strlen(response), MSG_NOSIGNAL);
+                removefd(m_epollfd, m_sockfd);
+                break;
+            }
+        }
+    }
+
+private:
+    // Spin for the time a "/spin/<microseconds>" request asks for.
+    void spin() {
+
+        if (strncmp(m_buf, "GET /spin/", 10) != 0) return;
+
+        double end = now_seconds() + atoi(m_buf + 10) / 1e6;
+
+        while (now_seconds() < end) {}
+    }
+
+    static double now_seconds() {
+
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+private:
+    static const int BUFFER_SIZE = 1024;
+    static int m_epollfd;
+
+    int m_sockfd;
+    char m_buf[BUFFER_SIZE];
+    int m_read_idx;
+};
+
+int bench_conn::m_epollfd = -1;
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 4) {
+
+        printf("usage: %s ip_address port_number process_number dispatch_mode [select_policy [affinity]]\n", basename(argv[0]));
+        return 1;
+    }
+
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    int process_number = atoi(argv[3]);
+    DISPATCH_MODE dispatch = (atoi(argv[4]) == 1) ? DISPATCH_PASS_FD : DISPATCH_NOTIFY;
+
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(listenfd >= 0);
+
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    int ret = bind(listenfd, (struct sockaddr*)& address, sizeof(address));
+    assert(ret != -1);
+
+    ret = listen(listenfd, 1024);
+    assert(ret != -1);
+
+    processpool<bench_conn>* pool = processpool<bench_conn>::create(listenfd, process_number, dispatch);
+
+    if (pool) {
+
+        pool->set_policy((argc > 5) ? (SELECT_POLICY) atoi(argv[5]) : SELECT_ROUND_ROBIN);
+        pool->set_affinity((argc > 6) ? (CPU_AFFINITY) atoi(argv[6]) : AFFINITY_NONE);
+        pool->run();
+        delete pool;
+    }
+
+    close(listenfd);
+
+    return 0;
+}
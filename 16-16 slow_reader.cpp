@@ -0,0 +1,265 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+
+// Stress test of the output cursor of http_conn::write. Before it connects, the client shrinks its receive buffer and
+// the segment size it announces, so that the send buffer of the server, which starts sized by the congestion window
+// in segments, is small too, even on loopback. It writes 'depth' pipelined requests for one file, and reads the
+// responses a few bytes at a time with a pause between reads. The server then finds its socket buffer full again and
+// again, in the middle of a header, an iovec or a sendfile body, and has to resume from where it stopped. Every body
+// is compared byte for byte with a local copy of the file; the test fails on the first difference, on a response
+// other than 200, on an early close, or when nothing arrives for STALL_TIMEOUT seconds.
+// A file below the sendfile threshold of the server (256 KB) tests the writev path, a larger one the sendfile path.
+
+static const int HEADER_SIZE = 4096;
+static const int STALL_TIMEOUT = 5;
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read the whole of 'path' into memory. Returns nullptr if it can not be read.
+char* load_file(const char* path, off_t* size) {
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    fstat(fd, &st);
+
+    char* data = new char[st.st_size + 1];
+    off_t done = 0;
+
+    while (done < st.st_size) {
+
+        ssize_t ret = read(fd, data + done, st.st_size - done);
+
+        if (ret <= 0) break;
+
+        done += ret;
+    }
+
+    close(fd);
+
+    if (done != st.st_size) {
+
+        delete[] data;
+        return nullptr;
+    }
+
+    *size = st.st_size;
+
+    return data;
+}
+
+// The response stream being checked: the header of the current response, then its body, compared with the file.
+struct checker {
+
+    const char* file;
+    off_t file_size;
+
+    char header[HEADER_SIZE];
+    int header_len;      // Bytes of the current header received, while it is incomplete.
+    off_t body_done;     // Bytes of the current body checked, -1 while the header is incomplete.
+    int responses;       // Responses checked completely.
+};
+
+// Check the bytes 'data' of the response stream. Returns false on the first error, which it reports.
+bool check(checker* c, const char* data, int len) {
+
+    while (len > 0) {
+
+        if (c->body_done < 0) {
+
+            // The header is received byte by byte up to its blank line, so that the body is not consumed with it.
+            if (c->header_len == HEADER_SIZE - 1) {
+
+                printf("response %d: header too long\n", c->responses);
+                return false;
+            }
+
+            c->header[c->header_len++] = *data++;
+            --len;
+
+            c->header[c->header_len] = '\0';
+
+            if ((c->header_len < 4) or (strcmp(c->header + c->header_len - 4, "\r\n\r\n") != 0)) continue;
+
+            if (strncmp(c->header, "HTTP/1.1 200", 12) != 0) {
+
+                printf("response %d: %.*s\n", c->responses, (int) strcspn(c->header, "\r"), c->header);
+                return false;
+            }
+
+            char* field = strstr(c->header, "Content-Length:");
+
+            if (!field or (atoll(field + 15) != c->file_size)) {
+
+                printf("response %d: Content-Length is not %lld\n", c->responses, (long long) c->file_size);
+                return false;
+            }
+
+            c->body_done = 0;
+        }
+
+        int n = len;
+
+        if (n > c->file_size - c->body_done) {
+
+            n = c->file_size - c->body_done;
+        }
+
+        if (memcmp(data, c->file + c->body_done, n) != 0) {
+
+            off_t at = c->body_done;
+
+            while (data[at - c->body_done] == c->file[at]) {
+
+                ++at;
+            }
+
+            printf("response %d: body differs from the file at byte %lld\n", c->responses, (long long) at);
+            return false;
+        }
+
+        c->body_done += n;
+        data += n;
+        len -= n;
+
+        if (c->body_done == c->file_size) {
+
+            ++c->responses;
+
+            c->header_len = 0;
+            c->body_done = -1;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 4) {
+
+        printf("usage: %s ip_address port_number url local_file [depth [rcvbuf [mss [chunk [pause_us]]]]]\n", basename(argv[0]));
+        return 1;
+    }
+
+    const char* url = argv[3];
+    int depth = (argc > 5) ? atoi(argv[5]) : 4;
+    int rcvbuf = (argc > 6) ? atoi(argv[6]) : 4096;
+    int mss = (argc > 7) ? atoi(argv[7]) : 536;
+    int chunk = (argc > 8) ? atoi(argv[8]) : 1024;
+    int pause_us = (argc > 9) ? atoi(argv[9]) : 50;
+
+    assert((depth > 0) && (chunk > 0));
+
+    checker c;
+
+    c.file = load_file(argv[4], &c.file_size);
+
+    if (!c.file) {
+
+        printf("can not read %s\n", argv[4]);
+        return 1;
+    }
+
+    c.header_len = 0;
+    c.body_done = -1;
+    c.responses = 0;
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[1], &address.sin_addr);
+    address.sin_port = htons(atoi(argv[2]));
+
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(sockfd >= 0);
+
+    // The receive buffer sets the window the client advertises, and the maximum segment size the one the server
+    // sends, so both must be small before the handshake.
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+
+    if (connect(sockfd, (struct sockaddr*)& address, sizeof(address)) != 0) {
+
+        printf("connect failure\n");
+        return 1;
+    }
+
+    struct timeval timeout = { STALL_TIMEOUT, 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[1024];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nConnection: keep-alive\r\n\r\n", url);
+
+    for (int i = 0; i < depth; ++i) {
+
+        if (send(sockfd, request, request_len, 0) != request_len) {
+
+            printf("send failure\n");
+            return 1;
+        }
+    }
+
+    char* buf = new char[chunk];
+    long reads = 0;
+    bool ok = true;
+
+    double start = now_seconds();
+
+    while (ok && (c.responses < depth)) {
+
+        int ret = recv(sockfd, buf, chunk, 0);
+
+        if (ret <= 0) {
+
+            printf("%s after %d responses and %lld bytes of the next\n", (ret == 0) ? "connection closed" : "stalled",
+                   c.responses, (long long) ((c.body_done < 0) ? 0 : c.body_done));
+            ok = false;
+            break;
+        }
+
+        ++reads;
+        ok = check(&c, buf, ret);
+
+        if (pause_us > 0) {
+
+            usleep(pause_us);
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+
+    socklen_t len = sizeof(rcvbuf);
+    getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+
+    printf("%s: %d of %d responses of %lld bytes checked, %ld reads, receive buffer %d, %.2f s\n", ok ? "ok" : "FAILED",
+           c.responses, depth, (long long) c.file_size, reads, rcvbuf, elapsed);
+
+    close(sockfd);
+
+    delete[] buf;
+    delete[] c.file;
+
+    return ok ? 0 : 1;
+}
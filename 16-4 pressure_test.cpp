@@ -9,9 +9,37 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
 
-// Each client connection keeps sending this request to the server.
-static const char* request = "GET http://localhost/index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\nxxxxxxxxxxxx";
+// Each client connection keeps sending this request to the server. Nothing may follow the blank line:
+// the server parses any further bytes on a keep-alive connection as the next pipelined request.
+static const char* request = "GET http://localhost/index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+
+// In benchmark mode (a duration is given on the command line) the per-request output is suppressed,
+// connections are opened without delay, and the number of responses received is counted.
+// The latency of every request is recorded too, and a connection the server closes, after a response with
+// "Connection: close" or in the middle of a request, is replaced by a new one. A server restarted under
+// the load is then measured by the latency tail and by the requests that failed.
+static bool bench_mode = false;
+static long responses = 0;
+
+static long failed = 0;            // Requests whose connection was closed or reset before their response.
+static long reconnects = 0;        // Connections opened to replace one the server closed.
+static long connect_failures = 0;  // Connections that could not be opened.
+
+static std::vector<double> sent_at(65536);  // When the request in flight on each socket was sent, 0 if none.
+static std::vector<double> latencies;
+
+// Current monotonic time in seconds.
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 int setnonblocking(int fd) {
 
@@ -40,11 +68,14 @@ bool write_nbytes(int sockfd, const char* buffer, int len) {
 
     int bytes_write = 0;
 
-    printf("write out %d bytes to socket %d\n", len, sockfd);
+    if (!bench_mode) printf("write out %d bytes to socket %d\n", len, sockfd);
+
+    sent_at[sockfd] = now_seconds();
 
     while (1)  {   
 
-        bytes_write = send(sockfd, buffer, len, 0);
+        // A connection the server has closed must not kill the client with SIGPIPE.
+        bytes_write = send(sockfd, buffer, len, MSG_NOSIGNAL);
 
         if (bytes_write == -1) {   
 
@@ -62,26 +93,33 @@ bool write_nbytes(int sockfd, const char* buffer, int len) {
     }   
 }
 
-// Read data from server.
+// Read data from server. Returns false if the connection was closed, or is to be closed after this response.
 bool read_once(int sockfd, char* buffer, int len) {
 
     int bytes_read = 0;
     memset(buffer, '\0', len);
 
-    bytes_read = recv(sockfd, buffer, len, 0);
+    // Leave room for the terminating '\0'.
+    bytes_read = recv(sockfd, buffer, len - 1, 0);
+
+    if ((bytes_read == -1) or (bytes_read == 0)) {
 
-    if (bytes_read == -1) {
+        if (sent_at[sockfd] > 0) ++failed;
 
         return false;
     }
-    else if (bytes_read == 0) {
 
-        return false;
+    ++responses;
+
+    if (bench_mode) {
+
+        latencies.push_back(now_seconds() - sent_at[sockfd]);
+        sent_at[sockfd] = 0;
     }
 
-	printf("read in %d bytes from socket %d with content: %s\n", bytes_read, sockfd, buffer);
+    if (!bench_mode) printf("read in %d bytes from socket %d with content: %s\n", bytes_read, sockfd, buffer);
 
-    return true;
+    return !strstr(buffer, "Connection: close");
 }
 
 // Initiate num TCP connections to the server. We can change num to adjust the test pressure.
@@ -98,19 +136,26 @@ void start_conn(int epoll_fd, int num, const char* ip, int port) {
 
     for (int i = 0; i < num; ++i) {
 
-        sleep(1);
+        if (!bench_mode) sleep(1);
 
         int sockfd = socket(PF_INET, SOCK_STREAM, 0);
 
-        printf("create 1 sock\n");
+        if (!bench_mode) printf("create 1 sock\n");
 
         if (sockfd < 0) continue;
 
         if (connect(sockfd, (struct sockaddr*)& address, sizeof(address)) == 0) {
 
-            printf("build connection %d\n", i);
+            if (!bench_mode) printf("build connection %d\n", i);
+
+            sent_at[sockfd] = 0;
             addfd(epoll_fd, sockfd);
         }
+        else {
+
+            ++connect_failures;
+            close(sockfd);
+        }
     }
 }
 
@@ -120,19 +165,61 @@ void close_conn(int epoll_fd, int sockfd) {
     close(sockfd);
 }
 
+// In benchmark mode, a closed connection is replaced at once, so the load stays the same.
+void replace_conn(int epoll_fd, int sockfd, const char* ip, int port) {
+
+    close_conn(epoll_fd, sockfd);
+
+    if (bench_mode) {
+
+        ++reconnects;
+        start_conn(epoll_fd, 1, ip, port);
+    }
+}
+
+double percentile(double p) {
+
+    if (latencies.empty()) return 0;
+
+    return latencies[std::min(latencies.size() - 1, (size_t) (p * latencies.size()))];
+}
+
 int main(int argc, char* argv[])
 {
-    assert(argc == 4);
+    // Usage: ip_address port_number connection_number [seconds].
+    // With 'seconds', the test runs that long and reports the request throughput,
+    // which is how the single-loop and multi-reactor modes of the web server are compared.
+    assert((argc == 4) or (argc == 5));
+
+    double duration = (argc == 5) ? atof(argv[4]) : 0;
+    bench_mode = (duration > 0);
+
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
 
     int epoll_fd = epoll_create(100);
 
-    start_conn(epoll_fd, atoi(argv[3]), argv[1], atoi(argv[2]));
+    start_conn(epoll_fd, atoi(argv[3]), ip, port);
     epoll_event events[10000];
     char buffer[2048];
 
+    double start = now_seconds();
+
     while (1) {
 
-        int fds = epoll_wait(epoll_fd, events, 10000, 2000);
+        if (bench_mode && (now_seconds() - start >= duration)) {
+
+            printf("%ld responses in %.1f s, %.0f req/s\n", responses, duration, responses / duration);
+
+            std::sort(latencies.begin(), latencies.end());
+
+            printf("latency p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n", percentile(0.5) * 1000,
+                   percentile(0.99) * 1000, percentile(0.999) * 1000, latencies.empty() ? 0 : latencies.back() * 1000);
+            printf("%ld failed requests, %ld reconnects, %ld failed connects\n", failed, reconnects, connect_failures);
+            break;
+        }
+
+        int fds = epoll_wait(epoll_fd, events, 10000, bench_mode ? 100 : 2000);
 
         for (int i = 0; i < fds; i++) {   
 
@@ -142,7 +229,8 @@ int main(int argc, char* argv[])
 
                 if (!read_once(sockfd, buffer, 2048)) {
 
-                    close_conn(epoll_fd, sockfd);
+                    replace_conn(epoll_fd, sockfd, ip, port);
+                    continue;
                 }
 
                 struct epoll_event event;
@@ -156,7 +244,10 @@ int main(int argc, char* argv[])
 
                 if (!write_nbytes(sockfd, request, strlen(request))) {
 
-                    close_conn(epoll_fd, sockfd);
+                    ++failed;
+
+                    replace_conn(epoll_fd, sockfd, ip, port);
+                    continue;
                 }
 
                 struct epoll_event event;
@@ -168,7 +259,9 @@ int main(int argc, char* argv[])
             }
             else if (events[i].events & EPOLLERR) {
 
-                close_conn(epoll_fd, sockfd);
+                if (sent_at[sockfd] > 0) ++failed;
+
+                replace_conn(epoll_fd, sockfd, ip, port);
             }
         }
     }
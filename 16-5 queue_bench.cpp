@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <list>
+#include <atomic>
+
+#include "14-2 locker.h"
+#include "15-7 mpmc_queue.h"
+
+// Microbenchmark of the request queue of the thread pool: the std::list guarded by a locker used by
+// code listing 15-3, against the lock-free bounded queue of code listing 15-7.
+// For each thread count n, n producers and n consumers move a fixed number of elements through the queue.
+
+// The number of elements moved through the queue in each round.
+static const long TOTAL_OPS = 1 << 21;
+
+// Capacity of the bounded queue.
+static const int QUEUE_CAPACITY = 1024;
+
+// The queue of code listing 15-3: a list protected by a mutex.
+class list_queue {
+public:
+    bool push(int* item) {
+
+        m_locker.lock();
+        m_list.push_back(item);
+        m_locker.unlock();
+
+        return true;
+    }
+
+    bool pop(int*& item) {
+
+        m_locker.lock();
+
+        if (m_list.empty()) {
+
+            m_locker.unlock();
+            return false;
+        }
+
+        item = m_list.front();
+        m_list.pop_front();
+        m_locker.unlock();
+
+        return true;
+    }
+
+private:
+    locker m_locker;
+    std::list<int*> m_list;
+};
+
+// Arguments shared by the producer and consumer threads of one round.
+template<typename Q>
+struct bench_args {
+
+    Q* queue;
+    long ops_per_producer;
+    std::atomic<long>* consumed;
+    long total;
+};
+
+static int dummy;
+
+template<typename Q>
+void* producer(void* arg) {
+
+    bench_args<Q>* args = (bench_args<Q>*) arg;
+
+    for (long i = 0; i < args->ops_per_producer; ++i) {
+
+        // The bounded queue may be full, in which case we let the consumers run and try again.
+        while (!args->queue->push(&dummy)) {
+
+            sched_yield();
+        }
+    }
+
+    return nullptr;
+}
+
+template<typename Q>
+void* consumer(void* arg) {
+
+    bench_args<Q>* args = (bench_args<Q>*) arg;
+    int* item = nullptr;
+
+    while (args->consumed->load(std::memory_order_relaxed) < args->total) {
+
+        if (args->queue->pop(item)) {
+
+            args->consumed->fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+
+            sched_yield();
+        }
+    }
+
+    return nullptr;
+}
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run one round with 'threads' producers and 'threads' consumers, and return the throughput in operations per second.
+template<typename Q>
+double run_round(Q* queue, int threads) {
+
+    std::atomic<long> consumed(0);
+
+    bench_args<Q> args;
+
+    args.queue = queue;
+    args.ops_per_producer = TOTAL_OPS / threads;
+    args.consumed = &consumed;
+    args.total = args.ops_per_producer * threads;
+
+    pthread_t* tids = new pthread_t[2 * threads];
+
+    double start = now_seconds();
+
+    for (int i = 0; i < threads; ++i) {
+
+        int ret = pthread_create(tids + i, nullptr, consumer<Q>, &args);
+        assert(ret == 0);
+
+        ret = pthread_create(tids + threads + i, nullptr, producer<Q>, &args);
+        assert(ret == 0);
+    }
+
+    for (int i = 0; i < 2 * threads; ++i) {
+
+        pthread_join(tids[i], nullptr);
+    }
+
+    double elapsed = now_seconds() - start;
+
+    delete[] tids;
+
+    return args.total / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    // Usage: [max_threads], the thread count doubles from 1 up to max_threads (64 by default).
+    int max_threads = (argc > 1) ? atoi(argv[1]) : 64;
+
+    printf("%8s %16s %16s\n", "threads", "list+mutex op/s", "mpmc_queue op/s");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+
+        list_queue lq;
+        mpmc_queue<int> mq(QUEUE_CAPACITY);
+
+        double list_ops = run_round(&lq, threads);
+        double mpmc_ops = run_round(&mq, threads);
+
+        printf("%8d %16.0f %16.0f\n", threads, list_ops, mpmc_ops);
+    }
+
+    return 0;
+}
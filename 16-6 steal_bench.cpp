@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <atomic>
+
+#include "15-3 threadpool.h"
+#include "15-8 mpmc_threadpool.h"
+#include "15-9 ws_threadpool.h"
+
+// Benchmark of the three thread pools under a skewed workload: one request in SKEW_PERIOD is
+// SKEW_FACTOR times more expensive than the others, and every expensive request fans out
+// FANOUT cheap follow-up requests from inside the worker, as a request that triggers sub-requests would.
+
+static const int TASK_NUMBER = 100000;
+static const int SKEW_PERIOD = 100;
+static const int SKEW_FACTOR = 100;
+static const int FANOUT = 8;
+
+// The cost of a cheap request, in iterations of a dependent arithmetic loop.
+static const int BASE_COST = 2000;
+
+static std::atomic<long> finished(0);
+static std::atomic<long> expected(0);
+
+// A request of the benchmark. It has the process() method required by all three pools.
+// It submits its follow-up requests through 'm_submit', so the same class works with every pool.
+class bench_task {
+public:
+    void process() {
+
+        unsigned long x = m_id;
+
+        for (long i = 0; i < m_cost; ++i) {
+
+            x = x * 6364136223846793005ul + 1442695040888963407ul;
+        }
+
+        m_sink = x;
+
+        // An expensive request submits its follow-up requests from the worker thread.
+        if (m_children) {
+
+            for (int i = 0; i < FANOUT; ++i) {
+
+                while (!m_submit(m_pool, m_children + i)) {
+
+                    sched_yield();
+                }
+            }
+        }
+
+        finished.fetch_add(1, std::memory_order_relaxed);
+    }
+
+public:
+    void* m_pool;
+    bool (*m_submit)(void* pool, bench_task* task);
+    long m_id;
+    long m_cost;
+    bench_task* m_children;
+    unsigned long m_sink;
+};
+
+template<typename Pool>
+bool submit(void* pool, bench_task* task) {
+
+    return ((Pool*) pool)->append(task);
+}
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void init_task(bench_task* task, void* pool, bool (*submit_func)(void*, bench_task*), long id, long cost) {
+
+    task->m_pool = pool;
+    task->m_submit = submit_func;
+    task->m_id = id;
+    task->m_cost = cost;
+    task->m_children = nullptr;
+}
+
+// Submit the workload to 'pool' and return the time it takes until every request is processed.
+template<typename Pool>
+double run_workload(Pool* pool) {
+
+    bench_task* tasks = new bench_task[TASK_NUMBER];
+    bench_task* children = new bench_task[(TASK_NUMBER / SKEW_PERIOD + 1) * FANOUT];
+
+    long child_count = 0;
+
+    for (int i = 0; i < TASK_NUMBER; ++i) {
+
+        init_task(tasks + i, pool, submit<Pool>, i, BASE_COST);
+
+        if (i % SKEW_PERIOD == 0) {
+
+            tasks[i].m_cost = BASE_COST * SKEW_FACTOR;
+            tasks[i].m_children = children + child_count;
+
+            for (int j = 0; j < FANOUT; ++j, ++child_count) {
+
+                init_task(children + child_count, pool, submit<Pool>, child_count, BASE_COST);
+            }
+        }
+    }
+
+    finished = 0;
+    expected = TASK_NUMBER + child_count;
+
+    double start = now_seconds();
+
+    for (int i = 0; i < TASK_NUMBER; ++i) {
+
+        while (!pool->append(tasks + i)) {
+
+            sched_yield();
+        }
+    }
+
+    while (finished.load() < expected.load()) {
+
+        usleep(100);
+    }
+
+    double elapsed = now_seconds() - start;
+
+    delete[] children;
+    delete[] tasks;
+
+    return elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    // Usage: [thread_number], 8 by default.
+    int thread_number = (argc > 1) ? atoi(argv[1]) : 8;
+
+    threadpool<bench_task>* list_pool = new threadpool<bench_task>(thread_number, TASK_NUMBER * 2);
+    double list_time = run_workload(list_pool);
+    delete list_pool;
+
+    mpmc_threadpool<bench_task>* mpmc_pool = new mpmc_threadpool<bench_task>(thread_number, TASK_NUMBER * 2);
+    double mpmc_time = run_workload(mpmc_pool);
+    delete mpmc_pool;
+
+    ws_threadpool<bench_task>* ws_pool = new ws_threadpool<bench_task>(thread_number, TASK_NUMBER * 2);
+    double ws_time = run_workload(ws_pool);
+    delete ws_pool;
+
+    printf("%d requests, 1 in %d costs %dx and fans out %d sub-requests, %d threads\n",
+           TASK_NUMBER, SKEW_PERIOD, SKEW_FACTOR, FANOUT, thread_number);
+
+    printf("threadpool (list+mutex): %.3f s\n", list_time);
+    printf("mpmc_threadpool:         %.3f s\n", mpmc_time);
+    printf("ws_threadpool:           %.3f s\n", ws_time);
+
+    return 0;
+}
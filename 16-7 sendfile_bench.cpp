@@ -0,0 +1,195 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+// Benchmark of the two ways http_conn sends a file body: writev from a mmap'd region (small files)
+// and sendfile with an offset (large files). A child process reads and discards everything from a
+// loopback TCP connection, and the parent reports the CPU time it spent per GB sent with each method.
+
+static const int HEADER_SIZE = 128;
+
+double cpu_seconds() {
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Send the header and the file the way http_conn does for small files: map it, writev both, unmap it.
+void send_writev(int sockfd, int filefd, off_t size, char* header) {
+
+    char* address = (char*) mmap(0, size, PROT_READ, MAP_PRIVATE, filefd, 0);
+    assert(address != MAP_FAILED);
+
+    struct iovec iv[2];
+
+    iv[0].iov_base = header;
+    iv[0].iov_len = HEADER_SIZE;
+    iv[1].iov_base = address;
+    iv[1].iov_len = size;
+
+    int count = 2;
+
+    while (count > 0) {
+
+        ssize_t ret = writev(sockfd, iv + 2 - count, count);
+        assert(ret > 0);
+
+        // Advance over what was written, the connection is blocking so there is no EAGAIN here.
+        while ((count > 0) && ((size_t) ret >= iv[2 - count].iov_len)) {
+
+            ret -= iv[2 - count].iov_len;
+            --count;
+        }
+
+        if (count > 0) {
+
+            iv[2 - count].iov_base = (char*) iv[2 - count].iov_base + ret;
+            iv[2 - count].iov_len -= ret;
+        }
+    }
+
+    munmap(address, size);
+}
+
+// Send the header and the file the way http_conn does for large files: writev the header, then sendfile.
+void send_sendfile(int sockfd, int filefd, off_t size, char* header) {
+
+    struct iovec iv[1];
+
+    iv[0].iov_base = header;
+    iv[0].iov_len = HEADER_SIZE;
+
+    ssize_t ret = writev(sockfd, iv, 1);
+    assert(ret == HEADER_SIZE);
+
+    off_t offset = 0;
+
+    while (offset < size) {
+
+        ret = sendfile(sockfd, filefd, &offset, size - offset);
+        assert(ret > 0);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 1) {
+
+        printf("usage: %s file_name [rounds]\n", basename(argv[0]));
+        return 1;
+    }
+
+    int filefd = open(argv[1], O_RDONLY);
+    assert(filefd >= 0);
+
+    int rounds = (argc > 2) ? atoi(argv[2]) : 100;
+
+    struct stat st;
+    fstat(filefd, &st);
+
+    // A listening socket on an ephemeral loopback port.
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(listenfd >= 0);
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    address.sin_port = 0;
+
+    int ret = bind(listenfd, (struct sockaddr*)& address, sizeof(address));
+    assert(ret != -1);
+
+    socklen_t len = sizeof(address);
+    getsockname(listenfd, (struct sockaddr*)& address, &len);
+
+    ret = listen(listenfd, 5);
+    assert(ret != -1);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+
+    if (pid == 0) {
+
+        // The receiver: drain the connection until the sender closes it.
+        int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+
+        ret = connect(sockfd, (struct sockaddr*)& address, sizeof(address));
+        assert(ret != -1);
+
+        char* buf = new char[1 << 20];
+
+        while (recv(sockfd, buf, 1 << 20, 0) > 0) {
+
+            continue;
+        }
+
+        exit(0);
+    }
+
+    int connfd = accept(listenfd, nullptr, nullptr);
+    assert(connfd >= 0);
+
+    char header[HEADER_SIZE];
+    memset(header, 'h', HEADER_SIZE);
+
+    double gb = (double) st.st_size * rounds / (1 << 30);
+
+    const char* names[2] = { "writev+mmap", "sendfile" };
+
+    for (int method = 0; method < 2; ++method) {
+
+        double cpu = cpu_seconds();
+        double wall = now_seconds();
+
+        for (int i = 0; i < rounds; ++i) {
+
+            if (method == 0) {
+
+                send_writev(connfd, filefd, st.st_size, header);
+            }
+            else {
+
+                send_sendfile(connfd, filefd, st.st_size, header);
+            }
+        }
+
+        cpu = cpu_seconds() - cpu;
+        wall = now_seconds() - wall;
+
+        printf("%-12s %.2f GB in %.2f s, %.3f CPU s per GB\n", names[method], gb, wall, cpu / gb);
+    }
+
+    close(connfd);
+    waitpid(pid, nullptr, 0);
+
+    close(listenfd);
+    close(filefd);
+
+    return 0;
+}
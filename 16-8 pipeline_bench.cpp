@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+// Benchmark of HTTP/1.1 pipelining. Every connection writes 'depth' requests at once, reads until all of their
+// responses have arrived, and starts over. The test runs for a number of seconds at each depth (1, 4 and 16 by default)
+// and reports the responses per second, so the gain of answering pipelined requests back-to-back can be read off.
+// Before that, it checks that a request whose Content-Length can not delimit a body in the read buffer is answered
+// with 400, and the request pipelined behind it is not answered at all.
+
+static const char* request = "GET /index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+
+static const int MAX_CONN_NUMBER = 1024;
+static const int MAX_DEPTH = 64;
+static const int BUFFER_SIZE = 64 * 1024;
+
+// A client connection and the responses it is still waiting for.
+struct client {
+
+    int sockfd;
+    int pending;          // Responses still expected for the requests written.
+    char buf[BUFFER_SIZE];
+    int len;              // Bytes of the response stream received and not yet consumed.
+};
+
+double now_seconds() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write 'depth' copies of the request with one send.
+bool send_requests(client* c, int depth) {
+
+    static char batch[MAX_DEPTH * 128];
+
+    int len = strlen(request);
+
+    for (int i = 0; i < depth; ++i) {
+
+        memcpy(batch + i * len, request, len);
+    }
+
+    int total = depth * len;
+    int sent = 0;
+
+    // The requests are small and the socket buffer empty, so this only loops on a short write.
+    while (sent < total) {
+
+        int ret = send(c->sockfd, batch + sent, total - sent, 0);
+
+        if (ret <= 0) return false;
+
+        sent += ret;
+    }
+
+    c->pending = depth;
+
+    return true;
+}
+
+// Consume the complete responses at the front of the buffer. Returns the number consumed, or -1 on a malformed response.
+int consume_responses(client* c) {
+
+    int count = 0;
+
+    while (c->pending > 0) {
+
+        c->buf[c->len] = '\0';
+
+        char* end = strstr(c->buf, "\r\n\r\n");
+
+        if (!end) break;
+
+        char* field = strstr(c->buf, "Content-Length:");
+
+        if (!field or (field > end)) return -1;
+
+        int total = (end + 4 - c->buf) + atoi(field + 15);
+
+        if (c->len < total) break;
+
+        memmove(c->buf, c->buf + total, c->len - total);
+        c->len -= total;
+
+        --c->pending;
+        ++count;
+    }
+
+    return count;
+}
+
+// Send a request with the Content-Length 'length' and a request pipelined behind it, on a new connection, and read
+// until the server closes it. Returns true if the only response is a 400.
+bool check_content_length(const sockaddr_in& address, const char* length) {
+
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(sockfd >= 0);
+
+    if (connect(sockfd, (struct sockaddr*)& address, sizeof(address)) != 0) {
+
+        close(sockfd);
+        return false;
+    }
+
+    // A closed connection is expected; a silent one is a failure, after 2 seconds.
+    struct timeval timeout = { 2, 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char buf[BUFFER_SIZE];
+    int len = snprintf(buf, sizeof(buf), "GET /index.html HTTP/1.1\r\nContent-Length: %s\r\n\r\n%s", length, request);
+
+    send(sockfd, buf, len, 0);
+
+    len = 0;
+
+    while (len < BUFFER_SIZE - 1) {
+
+        int ret = recv(sockfd, buf + len, BUFFER_SIZE - 1 - len, 0);
+
+        if (ret <= 0) {
+
+            if (ret < 0) len = 0;
+
+            break;
+        }
+
+        len += ret;
+    }
+
+    buf[len] = '\0';
+    close(sockfd);
+
+    return (strncmp(buf, "HTTP/1.1 400", 12) == 0) && !strstr(buf + 12, "HTTP/1.1 ");
+}
+
+// Run all connections at one pipeline depth for 'duration' seconds. Returns the number of responses received.
+long run(client* clients, int num, int depth, double duration) {
+
+    int epoll_fd = epoll_create(100);
+    assert(epoll_fd >= 0);
+
+    for (int i = 0; i < num; ++i) {
+
+        epoll_event event;
+
+        event.data.ptr = clients + i;
+        event.events = EPOLLIN;
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].sockfd, &event);
+
+        clients[i].len = 0;
+
+        if (!send_requests(clients + i, depth)) {
+
+            printf("send failure\n");
+            exit(1);
+        }
+    }
+
+    epoll_event events[MAX_CONN_NUMBER];
+    long responses = 0;
+
+    double start = now_seconds();
+
+    while (now_seconds() - start < duration) {
+
+        int fds = epoll_wait(epoll_fd, events, MAX_CONN_NUMBER, 100);
+
+        for (int i = 0; i < fds; ++i) {
+
+            client* c = (client*) events[i].data.ptr;
+
+            int ret = recv(c->sockfd, c->buf + c->len, BUFFER_SIZE - 1 - c->len, 0);
+
+            if (ret <= 0) {
+
+                printf("connection closed by the server\n");
+                exit(1);
+            }
+
+            c->len += ret;
+
+            int count = consume_responses(c);
+
+            if (count < 0) {
+
+                printf("malformed response\n");
+                exit(1);
+            }
+
+            responses += count;
+
+            if ((c->pending == 0) && !send_requests(c, depth)) {
+
+                printf("send failure\n");
+                exit(1);
+            }
+        }
+    }
+
+    // Drain the responses still in flight, so the next depth starts on quiet connections.
+    for (int i = 0; i < num; ++i) {
+
+        while (clients[i].pending > 0) {
+
+            int ret = recv(clients[i].sockfd, clients[i].buf + clients[i].len, BUFFER_SIZE - 1 - clients[i].len, 0);
+
+            if (ret <= 0) break;
+
+            clients[i].len += ret;
+            consume_responses(clients + i);
+        }
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, clients[i].sockfd, 0);
+    }
+
+    close(epoll_fd);
+
+    return responses;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 4) {
+
+        printf("usage: %s ip_address port_number connection_number seconds [depth...]\n", basename(argv[0]));
+        return 1;
+    }
+
+    int num = atoi(argv[3]);
+    double duration = atof(argv[4]);
+
+    assert((num > 0) && (num <= MAX_CONN_NUMBER));
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[1], &address.sin_addr);
+    address.sin_port = htons(atoi(argv[2]));
+
+    // Negative, wrapping when truncated to an int, larger than any read buffer, and not a number.
+    const char* bad_lengths[] = { "-100", "4294967295", "9223372036854775808", "100000000", "12abc", "" };
+
+    for (size_t i = 0; i < sizeof(bad_lengths) / sizeof(bad_lengths[0]); ++i) {
+
+        if (!check_content_length(address, bad_lengths[i])) {
+
+            printf("Content-Length \"%s\" is not rejected\n", bad_lengths[i]);
+            return 1;
+        }
+    }
+
+    client* clients = new client[num];
+
+    for (int i = 0; i < num; ++i) {
+
+        clients[i].sockfd = socket(PF_INET, SOCK_STREAM, 0);
+        assert(clients[i].sockfd >= 0);
+
+        if (connect(clients[i].sockfd, (struct sockaddr*)& address, sizeof(address)) != 0) {
+
+            printf("connect failure\n");
+            return 1;
+        }
+    }
+
+    int default_depths[3] = { 1, 4, 16 };
+
+    int depth_number = (argc > 5) ? argc - 5 : 3;
+
+    for (int i = 0; i < depth_number; ++i) {
+
+        int depth = (argc > 5) ? atoi(argv[5 + i]) : default_depths[i];
+
+        assert((depth > 0) && (depth <= MAX_DEPTH));
+
+        long responses = run(clients, num, depth, duration);
+
+        printf("depth %2d: %ld responses in %.1f s, %.0f req/s\n", depth, responses, duration, responses / duration);
+    }
+
+    for (int i = 0; i < num; ++i) {
+
+        close(clients[i].sockfd);
+    }
+
+    delete[] clients;
+
+    return 0;
+}
@@ -9,6 +9,8 @@
 #include <string.h>
 #include <fcntl.h>
 
+#include "8-4 line_scanner.h"
+
 const int BUFFER_SIZE = 4096;  // Read buffer size.
 
 // The two possible states of the main state machine represent respectively: 
@@ -40,9 +42,17 @@ LINE_STATUS prase_line(char* buffer, int& checked_index, int& read_index) {
     // 'checked_index' points to the byte currently being analyzed in the buffer (the application's read buffer),
     // 'read_index' points to the next byte at the end of the customer data in the buffer. 
     // The 0th to checked_index bytes in the buffer have been analyzed, 
-    // and the checked_index to (read_index-1) bytes are analyzed one by one by the following loop.
+    // and the checked_index to (read_index-1) bytes are analyzed by the following loop.
     for (; checked_index < read_index; ++checked_index) {
 
+        // Skip to the next "\r" or "\n", 16 or 32 bytes at a time; no other byte can end a line.
+        checked_index = scan_line_end(buffer + checked_index, buffer + read_index) - buffer;
+
+        if (checked_index == read_index) {
+
+            break;
+        }
+
         // Get the current bytes to be analyzed.
         temp = buffer[checked_index];
 
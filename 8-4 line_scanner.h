@@ -0,0 +1,111 @@
+#ifndef LINE_SCANNER_H
+#define LINE_SCANNER_H
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Scanner used by the HTTP parsers to find line ends ('\r' or '\n') and field separators (' ' or '\t', ':')
+// in a buffer. It compares 16 (SSE2) or 32 (AVX2) bytes at a time instead of one, and the implementation is
+// chosen once at run time from what the CPU supports, with a plain loop as the fallback on other machines.
+// The range is given by [begin, end), so the buffer does not need to be NUL-terminated, and a caller that
+// has not found what it is looking for can resume the next scan at 'end' once more data has been read.
+
+// Return the first byte in [begin, end) that is equal to 'a' or 'b', or 'end' if there is none.
+typedef const char* (*scan_function)(const char* begin, const char* end, char a, char b);
+
+inline const char* scan_either_scalar(const char* begin, const char* end, char a, char b) {
+
+    for (; begin < end; ++begin) {
+
+        if ((*begin == a) or (*begin == b)) return begin;
+    }
+
+    return end;
+}
+
+#if defined(__SSE2__)
+
+inline const char* scan_either_sse2(const char* begin, const char* end, char a, char b) {
+
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+
+    for (; end - begin >= 16; begin += 16) {
+
+        __m128i v = _mm_loadu_si128((const __m128i*) begin);
+
+        // One bit per byte that matches either character.
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+
+        if (mask) return begin + __builtin_ctz(mask);
+    }
+
+    return scan_either_scalar(begin, end, a, b);
+}
+
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+__attribute__((target("avx2")))
+inline const char* scan_either_avx2(const char* begin, const char* end, char a, char b) {
+
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+
+    for (; end - begin >= 32; begin += 32) {
+
+        __m256i v = _mm256_loadu_si256((const __m256i*) begin);
+
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+
+        if (mask) return begin + __builtin_ctz(mask);
+    }
+
+    // Finish a tail of 16 to 31 bytes with one more 16-byte step.
+    return scan_either_sse2(begin, end, a, b);
+}
+
+#endif
+
+// The best implementation for this CPU.
+inline scan_function select_scanner() {
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) {
+
+        return scan_either_avx2;
+    }
+#endif
+
+#if defined(__SSE2__)
+    return scan_either_sse2;
+#else
+    return scan_either_scalar;
+#endif
+}
+
+inline const char* scan_either(const char* begin, const char* end, char a, char b) {
+
+    // Selected on first use; the static is initialized once even if several threads get here together.
+    static const scan_function scan = select_scanner();
+
+    return scan(begin, end, a, b);
+}
+
+// Return the first '\r' or '\n' in [begin, end), or 'end'.
+inline const char* scan_line_end(const char* begin, const char* end) {
+
+    return scan_either(begin, end, '\r', '\n');
+}
+
+// Return the first space or tab in [begin, end), or 'end'.
+inline const char* scan_blank(const char* begin, const char* end) {
+
+    return scan_either(begin, end, ' ', '\t');
+}
+
+#endif